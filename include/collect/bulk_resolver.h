@@ -0,0 +1,262 @@
+/**
+ * @file bulk_resolver.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_BULK_RESOLVER_H_
+#define COLLECT_BULK_RESOLVER_H_
+
+#include <link.h>
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+#include "collect/resolver.h"
+#include "common/thread_pool.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 不属于当前进程的地址，以所在模块和模块内的地址表示，如 profiler 导出的数据、崩溃归档中的栈帧
+ *
+ */
+struct ModuleOffset {
+    // 模块的 ELF 文件路径，为空时按 build_id_ 在调试文件目录中查找
+    std::string object_filename_;
+    std::string build_id_;
+    // 减去模块加载偏移之后的地址，即 ELF 中的虚拟地址
+    uint64_t offset_{0};
+};
+
+/**
+ * @brief 批量并行解析大量栈帧地址，用于离线处理 profiler 数据、崩溃归档等
+ *
+ * 地址先去重，再按所在模块和地址范围切分成多个分区，分区在任务窃取的线程池中并行解析。
+ * 每个线程持有自己的 TraceResolver（各自打开 bfd、各自的 DWARF 解析状态），同一模块的分区优先分配给同一个线程。
+ * 当前进程中的地址通过 dladdr 找到模块；其他进程或离线数据中的地址以 ModuleOffset 给出，
+ * 直接按模块文件解析（TraceResolver::resolve_in_object），不依赖当前进程加载了哪些模块。
+ * 多线程同时调用 bfd_find_nearest_line 需要 binutils 2.42 及以上（提供 bfd_thread_init），
+ * 更早的 libbfd 只能以 thread_count 为 1 使用
+ */
+class BulkTraceResolver {
+public:
+    // 每个分区最多包含的地址个数
+    static const size_t PARTITION_SIZE = 256;
+
+public:
+    explicit BulkTraceResolver(size_t thread_count = std::thread::hardware_concurrency(),
+        ResolveLevel level = ResolveLevel::FULL)
+        : pool_(thread_count) {
+        for (size_t i = 0; i < pool_.get_thread_count(); ++i) {
+            resolvers_.emplace_back(new TraceResolver());
+            resolvers_.back()->set_resolve_level(level);
+        }
+    }
+    ~BulkTraceResolver() = default;
+    BulkTraceResolver(const BulkTraceResolver&) = delete;
+    BulkTraceResolver& operator=(const BulkTraceResolver&) = delete;
+    BulkTraceResolver(BulkTraceResolver&&) = delete;
+    BulkTraceResolver& operator=(BulkTraceResolver&&) = delete;
+
+public:
+    /**
+     * @brief 解析一批地址，重复的地址只解析一次
+     *
+     * @param addresses
+     * @return std::unordered_map<void*, ResolvedTrace> 地址到解析结果的映射
+     */
+    std::unordered_map<void*, ResolvedTrace> resolve(const std::vector<void*>& addresses) {
+        std::vector<void*> unique_addresses(addresses);
+        std::sort(unique_addresses.begin(), unique_addresses.end());
+        unique_addresses.erase(std::unique(unique_addresses.begin(), unique_addresses.end()),
+            unique_addresses.end());
+
+        // 每个分区写入结果数组中互不重叠的区间，不需要加锁
+        std::vector<ResolvedTrace> results(unique_addresses.size());
+        std::vector<partition> partitions = make_partitions(unique_addresses);
+        for (const auto& part : partitions) {
+            pool_.submit([this, part, &unique_addresses, &results](size_t worker_idx) {
+                TraceResolver& resolver = *resolvers_[worker_idx];
+                for (size_t i = part.begin; i < part.end; ++i) {
+                    Trace trace;
+                    trace.addr_ = unique_addresses[i];
+                    results[i] = resolver.resolve(trace);
+                }
+            }, part.module_idx);
+        }
+        pool_.wait();
+
+        std::unordered_map<void*, ResolvedTrace> resolved_map;
+        resolved_map.reserve(unique_addresses.size());
+        for (size_t i = 0; i < unique_addresses.size(); ++i) {
+            resolved_map.emplace(unique_addresses[i], std::move(results[i]));
+        }
+        return resolved_map;
+    }
+
+    /**
+     * @brief 解析一批其他进程或离线数据中的地址，重复的地址只解析一次
+     *
+     * @param addresses
+     * @return std::vector<ResolvedTrace> 与 addresses 一一对应，object_base_ 为空，addr_ 为模块内的地址
+     */
+    std::vector<ResolvedTrace> resolve(const std::vector<ModuleOffset>& addresses) {
+        // 先确定每个地址所在的文件，build-id 只查找一次
+        std::unordered_map<std::string, std::string> build_id_paths;
+        std::vector<std::pair<std::string, uint64_t>> keys;
+        keys.reserve(addresses.size());
+        for (const auto& address : addresses) {
+            std::string path = address.object_filename_;
+            if (path.empty() && !address.build_id_.empty()) {
+                auto it = build_id_paths.find(address.build_id_);
+                if (it == build_id_paths.end()) {
+                    it = build_id_paths.emplace(address.build_id_,
+                        resolvers_[0]->get_debug_file_locator().find_by_build_id(address.build_id_)).first;
+                }
+                path = it->second;
+            }
+            keys.emplace_back(std::move(path), address.offset_);
+        }
+        std::vector<std::pair<std::string, uint64_t>> unique_keys(keys);
+        std::sort(unique_keys.begin(), unique_keys.end());
+        unique_keys.erase(std::unique(unique_keys.begin(), unique_keys.end()), unique_keys.end());
+
+        // 有序之后同一模块的地址是连续的，按模块和 PARTITION_SIZE 切分
+        std::vector<ResolvedTrace> results(unique_keys.size());
+        size_t module_idx = 0;
+        size_t begin = 0;
+        while (begin < unique_keys.size()) {
+            size_t end = begin + 1;
+            while (end < unique_keys.size() && end - begin < PARTITION_SIZE
+                && unique_keys[end].first == unique_keys[begin].first) {
+                ++end;
+            }
+            pool_.submit([this, begin, end, &unique_keys, &results](size_t worker_idx) {
+                TraceResolver& resolver = *resolvers_[worker_idx];
+                for (size_t i = begin; i < end; ++i) {
+                    void* addr = reinterpret_cast<void*>(static_cast<uintptr_t>(unique_keys[i].second));
+                    if (unique_keys[i].first.empty()) {
+                        results[i].addr_ = addr;
+                    } else {
+                        results[i] = resolver.resolve_in_object(unique_keys[i].first, addr, nullptr);
+                    }
+                }
+            }, module_idx);
+            if (end == unique_keys.size() || unique_keys[end].first != unique_keys[begin].first) {
+                ++module_idx;
+            }
+            begin = end;
+        }
+        pool_.wait();
+
+        std::vector<ResolvedTrace> resolved_traces;
+        resolved_traces.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            size_t idx = static_cast<size_t>(std::lower_bound(unique_keys.begin(), unique_keys.end(), keys[i])
+                - unique_keys.begin());
+            resolved_traces.push_back(results[idx]);
+            resolved_traces.back().idx_ = i;
+        }
+        return resolved_traces;
+    }
+
+    /**
+     * @brief 获取解析线程的个数
+     *
+     * @return size_t
+     */
+    size_t get_thread_count() const {
+        return pool_.get_thread_count();
+    }
+
+private:
+    struct module_range {
+        uintptr_t begin;
+        uintptr_t end;
+    };
+    struct partition {
+        size_t begin;
+        size_t end;
+        size_t module_idx;
+    };
+
+    /**
+     * @brief 按所在模块切分有序的地址，单个模块的地址过多时再按地址范围切分
+     *
+     * @param addresses 有序且无重复的地址
+     * @return std::vector<partition>
+     */
+    static std::vector<partition> make_partitions(const std::vector<void*>& addresses) {
+        std::vector<module_range> modules;
+        dl_iterate_phdr(&collect_module_callback, &modules);
+        std::sort(modules.begin(), modules.end(),
+            [](const module_range& a, const module_range& b) { return a.begin < b.begin; });
+
+        std::vector<partition> partitions;
+        size_t begin = 0;
+        while (begin < addresses.size()) {
+            uintptr_t addr = reinterpret_cast<uintptr_t>(addresses[begin]);
+            // 不在任何模块中的地址归为 modules.size() 这个虚拟模块
+            size_t module_idx = find_module(modules, addr);
+            size_t end = begin + 1;
+            while (end < addresses.size() && end - begin < PARTITION_SIZE
+                && find_module(modules, reinterpret_cast<uintptr_t>(addresses[end])) == module_idx) {
+                ++end;
+            }
+            partition part;
+            part.begin = begin;
+            part.end = end;
+            part.module_idx = module_idx;
+            partitions.push_back(part);
+            begin = end;
+        }
+        return partitions;
+    }
+
+    static size_t find_module(const std::vector<module_range>& modules, uintptr_t addr) {
+        auto it = std::upper_bound(modules.begin(), modules.end(), addr,
+            [](uintptr_t value, const module_range& module) { return value < module.begin; });
+        if (it == modules.begin() || addr >= (it - 1)->end) {
+            return modules.size();
+        }
+        return static_cast<size_t>(it - 1 - modules.begin());
+    }
+
+    static int collect_module_callback(struct dl_phdr_info* info, size_t, void* data) {
+        std::vector<module_range>* modules = static_cast<std::vector<module_range>*>(data);
+        module_range module;
+        module.begin = UINTPTR_MAX;
+        module.end = 0;
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_LOAD) {
+                continue;
+            }
+            module.begin = std::min(module.begin, static_cast<uintptr_t>(info->dlpi_addr + phdr.p_vaddr));
+            module.end = std::max(module.end, static_cast<uintptr_t>(info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz));
+        }
+        if (module.begin < module.end) {
+            modules->push_back(module);
+        }
+        return 0;
+    }
+
+private:
+    utils::ThreadPool pool_;
+    // 每个线程私有的解析器，下标与线程下标一致
+    std::vector<std::unique_ptr<TraceResolver>> resolvers_;
+};
+
+}  // namespace stack_trace
+
+#endif  // COLLECT_BULK_RESOLVER_H_
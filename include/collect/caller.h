@@ -0,0 +1,222 @@
+/**
+ * @file caller.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_CALLER_H_
+#define COLLECT_CALLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include "collect/resolver.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 获取调用者的返回地址，必须内联到调用它的函数中
+ *
+ * level 为 0 时是调用当前函数的位置，使用 __builtin_return_address，不依赖帧指针；
+ * 更深的层级沿帧指针链查找，需要相关函数都保留帧指针（-fno-omit-frame-pointer），链断开时返回 nullptr
+ *
+ * @param level
+ * @return void*
+ */
+__attribute__((always_inline))
+inline void* get_caller_address(size_t level = 0) {
+    if (level == 0) {
+        return __builtin_return_address(0);
+    }
+    // 帧指针指向 [保存的上一个帧指针, 返回地址]
+    void* const* frame = static_cast<void* const*>(__builtin_frame_address(0));
+    for (size_t i = 0; i < level; ++i) {
+        void* const* next = static_cast<void* const*>(frame[0]);
+        // 栈向低地址增长，上层的栈帧一定在更高的地址，且不会相差太远
+        if (next <= frame || reinterpret_cast<uintptr_t>(next) - reinterpret_cast<uintptr_t>(frame) > (16 << 20)
+            || (reinterpret_cast<uintptr_t>(next) & (sizeof(void*) - 1)) != 0) {
+            return nullptr;
+        }
+        frame = next;
+    }
+    return frame[1];
+}
+
+/**
+ * @brief 调用点的缓存，把返回地址映射为格式化好的 "function (file:line)"，解析一次之后永久复用
+ *
+ * 查找是无锁的开放寻址哈希表；未命中时在锁内解析并插入，字符串的地址在进程生命周期内有效
+ */
+class CallerCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 8192;
+
+public:
+    static CallerCache& instance() {
+        static CallerCache cache;
+        return cache;
+    }
+    explicit CallerCache(size_t capacity = DEFAULT_CAPACITY) {
+        capacity_ = 16;
+        while (capacity_ < capacity) {
+            capacity_ <<= 1;
+        }
+        slots_.reset(new Slot[capacity_]);
+        for (size_t i = 0; i < capacity_; ++i) {
+            slots_[i].key.store(0, std::memory_order_relaxed);
+            slots_[i].name.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    ~CallerCache() = default;
+    CallerCache(const CallerCache&) = delete;
+    CallerCache& operator=(const CallerCache&) = delete;
+    CallerCache(CallerCache&&) = delete;
+    CallerCache& operator=(CallerCache&&) = delete;
+
+public:
+    /**
+     * @brief 获取地址对应的调用点名字
+     *
+     * @param addr 返回地址
+     * @return const char* 形如 "function (file:line)"，没有源码信息时为 "function" 或 "object+0x..."
+     */
+    const char* lookup(void* addr) {
+        uintptr_t key = reinterpret_cast<uintptr_t>(addr);
+        if (key == 0) {
+            return "??";
+        }
+        for (size_t i = 0; i < MAX_PROBE; ++i) {
+            const Slot& slot = slots_[(hash(key) + i) & (capacity_ - 1)];
+            uintptr_t slot_key = slot.key.load(std::memory_order_acquire);
+            if (slot_key == key) {
+                return slot.name.load(std::memory_order_relaxed);
+            }
+            if (slot_key == 0) {
+                break;
+            }
+        }
+        return insert(key);
+    }
+
+    /**
+     * @brief 设置解析程度，只对之后第一次出现的调用点生效
+     *
+     * @param level
+     */
+    void set_resolve_level(ResolveLevel level) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        resolver_.set_resolve_level(level);
+    }
+
+    /**
+     * @brief 获取已缓存的调用点个数
+     *
+     * @return size_t
+     */
+    size_t get_size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return names_.size();
+    }
+
+private:
+    struct Slot {
+        std::atomic<uintptr_t> key;
+        std::atomic<const char*> name;
+    };
+
+    static const size_t MAX_PROBE = 16;
+
+    static size_t hash(uintptr_t key) {
+        return static_cast<size_t>((key >> 2) * 0x9E3779B97F4A7C15ULL >> 16);
+    }
+
+    /**
+     * @brief 解析并插入，写入只在锁内进行，先写名字再发布 key
+     *
+     * @param key
+     * @return const char*
+     */
+    const char* insert(uintptr_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t empty_idx = capacity_;
+        for (size_t i = 0; i < MAX_PROBE; ++i) {
+            size_t idx = (hash(key) + i) & (capacity_ - 1);
+            uintptr_t slot_key = slots_[idx].key.load(std::memory_order_relaxed);
+            if (slot_key == key) {
+                return slots_[idx].name.load(std::memory_order_relaxed);
+            }
+            if (slot_key == 0) {
+                empty_idx = idx;
+                break;
+            }
+        }
+        // 哈希表中放不下时仍然返回解析结果，只是每次都会走到这里
+        auto it = overflow_.find(key);
+        if (it != overflow_.end()) {
+            return it->second;
+        }
+        names_.push_back(format(key));
+        const char* name = names_.back().c_str();
+        if (empty_idx != capacity_) {
+            slots_[empty_idx].name.store(name, std::memory_order_relaxed);
+            slots_[empty_idx].key.store(key, std::memory_order_release);
+        } else {
+            overflow_[key] = name;
+        }
+        return name;
+    }
+
+    std::string format(uintptr_t key) {
+        Trace trace;
+        trace.addr_ = reinterpret_cast<void*>(key);
+        ResolvedTrace resolved_trace = resolver_.resolve(trace);
+        std::ostringstream oss;
+        if (!resolved_trace.source_loc_.filename_.empty()) {
+            oss << resolved_trace.source_loc_.function_ << " (" << resolved_trace.source_loc_.filename_
+                << ":" << resolved_trace.source_loc_.line_ << ")";
+        } else if (!resolved_trace.object_function_.empty()) {
+            oss << resolved_trace.object_function_;
+        } else {
+            const std::string& object = resolved_trace.object_filename_;
+            size_t pos = object.rfind('/');
+            oss << (pos == std::string::npos ? object : object.substr(pos + 1)) << "+0x" << std::hex
+                << (key - reinterpret_cast<uintptr_t>(resolved_trace.object_base_));
+        }
+        return oss.str();
+    }
+
+private:
+    size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    mutable std::mutex mutex_;
+    TraceResolver resolver_;
+    // deque 扩容时不会移动已有的元素，字符串的地址保持不变
+    std::deque<std::string> names_;
+    std::unordered_map<uintptr_t, const char*> overflow_;
+};
+
+/**
+ * @brief 获取调用者的名字，如用于日志和监控的标签；命中缓存后只有一次指针读取和一次哈希查找
+ *
+ * @param level 0 表示调用当前函数的位置
+ * @return const char*
+ */
+__attribute__((always_inline))
+inline const char* get_caller_name(size_t level = 0) {
+    return CallerCache::instance().lookup(get_caller_address(level));
+}
+
+}  // namespace stack_trace
+
+#endif  // COLLECT_CALLER_H_
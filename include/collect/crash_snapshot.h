@@ -0,0 +1,869 @@
+/**
+ * @file crash_snapshot.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_CRASH_SNAPSHOT_H_
+#define COLLECT_CRASH_SNAPSHOT_H_
+
+#if defined(__x86_64__)
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include "collect/unwind_cfi.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 崩溃快照文件头
+ *
+ * 文件格式：CrashSnapshotHeader，module_count_ 个 CrashModuleRecord，
+ * 然后是 thread_count_ 个线程，每个线程为 CrashThreadRecord + frame_count_ 个 uint64_t 的栈帧地址 + stack_size_ 字节的栈内存
+ */
+struct CrashSnapshotHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t module_count_;
+    uint32_t thread_count_;
+    int32_t pid_;
+    int32_t crashed_tid_;
+    // 为 0 表示不是崩溃，而是主动调用 dump 生成的快照
+    int32_t signo_;
+    int32_t si_code_;
+    int32_t si_errno_;
+    int32_t sender_pid_;
+    uint32_t reserved_;
+    uint64_t fault_addr_;
+    uint64_t timestamp_ns_;
+    // 在信号处理函数中采集现场花费的时间
+    uint64_t capture_ns_;
+};
+
+/**
+ * @brief 可执行的文件映射，即已加载的模块
+ *
+ */
+struct CrashModuleRecord {
+    uint64_t begin_;
+    uint64_t end_;
+    uint64_t offset_;
+    uint32_t build_id_size_;
+    uint32_t reserved_;
+    uint8_t build_id_[32];
+    char path_[256];
+};
+
+/**
+ * @brief 线程的现场
+ *
+ */
+struct CrashThreadRecord {
+    // 触发快照的线程
+    static const uint32_t FLAG_CRASHED = 1;
+    // 成功采集到了寄存器和栈，超时未响应的线程只有 tid
+    static const uint32_t FLAG_CAPTURED = 2;
+
+    int32_t tid_;
+    uint32_t flags_;
+    uint32_t frame_count_;
+    uint32_t stack_size_;
+    uint64_t stack_begin_;
+    // ucontext 中的通用寄存器，下标为 REG_RIP 等
+    uint64_t regs_[NGREG];
+};
+
+/**
+ * @brief 崩溃快照的配置，所有的缓冲区在 install 时按这些上限预先分配
+ *
+ */
+struct CrashSnapshotOptions {
+    // 快照文件的输出目录
+    std::string directory{"."};
+    size_t max_threads{128};
+    // 解析 /proc/self/maps 时记录的映射个数上限，用于确定各线程栈的边界
+    size_t max_mappings{4096};
+    size_t max_modules{512};
+    size_t max_frames{64};
+    // 每个线程保存的栈内存大小
+    size_t stack_window{16 << 10};
+    // 等待其他线程保存现场的时间上限
+    std::chrono::milliseconds thread_timeout{200};
+    // 通知其他线程保存现场的信号，为 0 时使用 SIGRTMIN + 1
+    int snapshot_signal{0};
+};
+
+/**
+ * @brief 崩溃时写入紧凑的二进制快照，符号解析和 CFI 回溯都留给离线的 CrashSnapshotReader
+ *
+ * 信号处理函数中只使用预先分配的内存和系统调用：读取 /proc/self/maps 得到模块（从内存中的 ELF 头读取 build-id）
+ * 和各线程栈的边界，用 tgkill 通知其他线程在各自的信号处理函数中保存寄存器和栈顶内存，最多等待 thread_timeout，
+ * 然后在拷贝出来的栈上按帧指针回溯得到原始栈帧，写入文件后恢复原来的信号处理方式并重新触发信号
+ */
+class CrashSnapshotWriter {
+public:
+    static const uint32_t VERSION = 1;
+
+public:
+    static CrashSnapshotWriter& instance() {
+        static CrashSnapshotWriter writer;
+        return writer;
+    }
+    CrashSnapshotWriter(const CrashSnapshotWriter&) = delete;
+    CrashSnapshotWriter& operator=(const CrashSnapshotWriter&) = delete;
+    CrashSnapshotWriter(CrashSnapshotWriter&&) = delete;
+    CrashSnapshotWriter& operator=(CrashSnapshotWriter&&) = delete;
+
+public:
+    /**
+     * @brief 分配缓冲区并注册崩溃信号的处理函数，同时为当前线程设置信号栈
+     *
+     * @param options
+     * @return true
+     * @return false 已经注册过或者分配失败
+     */
+    bool install(const CrashSnapshotOptions& options = CrashSnapshotOptions()) {
+        if (is_installed_ || options.directory.size() + 64 >= sizeof(path_) || options.max_threads == 0) {
+            return false;
+        }
+        options_ = options;
+        memcpy(directory_, options.directory.c_str(), options.directory.size() + 1);
+        snapshot_signal_ = options.snapshot_signal != 0 ? options.snapshot_signal : SIGRTMIN + 1;
+        if (!allocate_buffers() || !install_alt_stack()) {
+            return false;
+        }
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        action.sa_sigaction = &crash_signal_handler;
+        for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i) {
+            sigaction(get_crash_signals()[i], &action, &old_actions_[i]);
+        }
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+        action.sa_sigaction = &snapshot_signal_handler;
+        sigaction(snapshot_signal_, &action, &old_snapshot_action_);
+        is_installed_ = true;
+        return true;
+    }
+
+    /**
+     * @brief 恢复原来的信号处理方式并释放缓冲区
+     *
+     */
+    void uninstall() {
+        if (!is_installed_) {
+            return;
+        }
+        for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i) {
+            sigaction(get_crash_signals()[i], &old_actions_[i], nullptr);
+        }
+        sigaction(snapshot_signal_, &old_snapshot_action_, nullptr);
+        munmap(arena_, arena_size_);
+        arena_ = nullptr;
+        is_installed_ = false;
+    }
+
+    /**
+     * @brief 为当前线程设置信号栈，栈溢出导致的崩溃需要在信号栈上处理，每个线程需要各自调用
+     *
+     * @return true
+     * @return false
+     */
+    static bool install_alt_stack() {
+        stack_t old_stack;
+        if (sigaltstack(nullptr, &old_stack) == 0 && (old_stack.ss_flags & SS_DISABLE) == 0) {
+            return true;
+        }
+        size_t size = std::max<size_t>(SIGSTKSZ, 64 << 10);
+        void* stack = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (stack == MAP_FAILED) {
+            return false;
+        }
+        stack_t new_stack;
+        new_stack.ss_sp = stack;
+        new_stack.ss_size = size;
+        new_stack.ss_flags = 0;
+        if (sigaltstack(&new_stack, nullptr) != 0) {
+            munmap(stack, size);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 不崩溃，主动为当前进程生成一份快照，可用于卡死等场景
+     *
+     * @return true
+     * @return false
+     */
+    bool dump() {
+        if (!is_installed_) {
+            return false;
+        }
+        ucontext_t context;
+        getcontext(&context);
+        pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        pid_t expected = 0;
+        if (!crashing_tid_.compare_exchange_strong(expected, tid)) {
+            return false;
+        }
+        bool is_written = write_snapshot(tid, 0, nullptr, &context);
+        crashing_tid_.store(0, std::memory_order_release);
+        return is_written;
+    }
+
+    /**
+     * @brief 获取最近一次写入的快照文件路径
+     *
+     * @return const char*
+     */
+    const char* get_last_path() const {
+        return path_;
+    }
+
+private:
+    CrashSnapshotWriter() = default;
+
+    struct mapping_range {
+        uintptr_t begin;
+        uintptr_t end;
+        bool is_readable;
+    };
+
+    struct thread_slot {
+        CrashThreadRecord record;
+        std::atomic<bool> is_captured{false};
+        uint64_t* frames{nullptr};
+        uint8_t* stack{nullptr};
+    };
+
+    // linux 的 getdents64 返回的目录项
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;  // NOLINT
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    static const size_t CRASH_SIGNAL_COUNT = 6;
+    static const size_t IO_BUFFER_SIZE = 4096;
+    static const size_t MAX_LINE_SIZE = 512;
+    // 同名快照文件已存在时最多尝试的序号
+    static const uint64_t MAX_FILE_SEQUENCE = 1000;
+
+    static const int* get_crash_signals() {
+        static const int crash_signals[CRASH_SIGNAL_COUNT] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTRAP};
+        return crash_signals;
+    }
+
+    static void crash_signal_handler(int signo, siginfo_t* info, void* context) {
+        // 信号处理函数中的系统调用会修改 errno，返回前恢复，避免影响被中断的代码
+        int saved_errno = errno;
+        CrashSnapshotWriter& writer = instance();
+        writer.handle_crash(signo, info, static_cast<ucontext_t*>(context));
+        // 恢复原来的处理方式后重新触发信号，由原来的处理函数或默认行为（如生成 core）结束进程
+        for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i) {
+            if (get_crash_signals()[i] == signo) {
+                sigaction(signo, &writer.old_actions_[i], nullptr);
+            }
+        }
+        syscall(SYS_tgkill, syscall(SYS_getpid), syscall(SYS_gettid), signo);
+        errno = saved_errno;
+    }
+
+    static void snapshot_signal_handler(int, siginfo_t*, void* context) {
+        int saved_errno = errno;
+        instance().handle_snapshot_signal(static_cast<ucontext_t*>(context));
+        errno = saved_errno;
+    }
+
+    void handle_crash(int signo, siginfo_t* info, ucontext_t* context) {
+        pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        pid_t expected = 0;
+        if (crashing_tid_.compare_exchange_strong(expected, tid)) {
+            write_snapshot(tid, signo, info, context);
+            return;
+        }
+        // 其他线程正在写快照时等它写完，自己在快照中以普通线程的身份出现；同一线程在处理中再次崩溃则直接退出
+        if (expected != tid) {
+            wait_until_finished(generation_.load(std::memory_order_acquire), 2 * get_timeout_ns());
+        }
+    }
+
+    /**
+     * @brief 其他线程收到通知后保存自己的寄存器和栈顶内存，然后等待快照写完
+     *
+     * @param context
+     */
+    void handle_snapshot_signal(ucontext_t* context) {
+        uint32_t generation = generation_.load(std::memory_order_acquire);
+        if (finished_generation_.load(std::memory_order_acquire) >= generation) {
+            return;
+        }
+        pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        size_t slot_count = slot_count_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < slot_count; ++i) {
+            thread_slot& slot = slots_[i];
+            if (slot.record.tid_ != tid || slot.is_captured.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            capture_thread(&slot, context);
+            slot.is_captured.store(true, std::memory_order_release);
+            captured_count_.fetch_add(1, std::memory_order_acq_rel);
+            // 保持停在这里，避免快照写完之前线程继续修改内存
+            wait_until_finished(generation, get_timeout_ns());
+            return;
+        }
+    }
+
+    /**
+     * @brief 采集所有线程的现场并写入快照文件
+     *
+     * @param tid 触发快照的线程
+     * @param signo
+     * @param info
+     * @param context 触发快照的线程的现场
+     * @return true
+     * @return false
+     */
+    bool write_snapshot(pid_t tid, int signo, siginfo_t* info, ucontext_t* context) {
+        uint64_t begin_ns = get_clock_ns(CLOCK_MONOTONIC);
+        uint32_t generation = generation_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        captured_count_.store(0, std::memory_order_release);
+        slot_count_.store(0, std::memory_order_release);
+
+        memset(&header_, 0, sizeof(header_));
+        memcpy(header_.magic_, "STCRASH1", sizeof(header_.magic_));
+        header_.version_ = VERSION;
+        header_.pid_ = static_cast<int32_t>(syscall(SYS_getpid));
+        header_.crashed_tid_ = tid;
+        header_.signo_ = signo;
+        if (info != nullptr) {
+            header_.si_code_ = info->si_code;
+            header_.si_errno_ = info->si_errno;
+            header_.sender_pid_ = info->si_pid;
+            header_.fault_addr_ = reinterpret_cast<uint64_t>(info->si_addr);
+        }
+        header_.timestamp_ns_ = get_clock_ns(CLOCK_REALTIME);
+
+        read_mappings();
+        size_t slot_count = list_threads(tid);
+        slot_count_.store(slot_count, std::memory_order_release);
+        size_t signaled_count = 0;
+        for (size_t i = 1; i < slot_count; ++i) {
+            if (syscall(SYS_tgkill, header_.pid_, slots_[i].record.tid_, snapshot_signal_) == 0) {
+                ++signaled_count;
+            }
+        }
+        capture_thread(&slots_[0], context);
+        slots_[0].record.flags_ |= CrashThreadRecord::FLAG_CRASHED;
+        slots_[0].is_captured.store(true, std::memory_order_release);
+        uint64_t deadline_ns = get_clock_ns(CLOCK_MONOTONIC) + get_timeout_ns();
+        while (captured_count_.load(std::memory_order_acquire) < signaled_count
+            && get_clock_ns(CLOCK_MONOTONIC) < deadline_ns) {
+            sleep_ns(100 * 1000);
+        }
+        for (size_t i = 0; i < slot_count; ++i) {
+            if (slots_[i].is_captured.load(std::memory_order_acquire)) {
+                slots_[i].record.flags_ |= CrashThreadRecord::FLAG_CAPTURED;
+                unwind_frames(&slots_[i]);
+            }
+        }
+        header_.thread_count_ = static_cast<uint32_t>(slot_count);
+        header_.module_count_ = static_cast<uint32_t>(module_count_);
+        header_.capture_ns_ = get_clock_ns(CLOCK_MONOTONIC) - begin_ns;
+        bool is_written = write_file(slot_count);
+        finished_generation_.store(generation, std::memory_order_release);
+        return is_written;
+    }
+
+    /**
+     * @brief 保存线程的寄存器和栈顶内存，栈的范围不超出所在的可读映射
+     *
+     * @param slot
+     * @param context
+     */
+    void capture_thread(thread_slot* slot, const ucontext_t* context) {
+        CrashThreadRecord& record = slot->record;
+        for (size_t i = 0; i < NGREG; ++i) {
+            record.regs_[i] = static_cast<uint64_t>(context->uc_mcontext.gregs[i]);
+        }
+        uintptr_t rsp = static_cast<uintptr_t>(context->uc_mcontext.gregs[REG_RSP]) & ~uintptr_t(7);
+        const mapping_range* mapping = find_mapping(rsp);
+        record.stack_begin_ = rsp;
+        record.stack_size_ = 0;
+        if (mapping != nullptr && mapping->is_readable) {
+            size_t size = std::min<size_t>(options_.stack_window, mapping->end - rsp);
+            memcpy(slot->stack, reinterpret_cast<const void*>(rsp), size);
+            record.stack_size_ = static_cast<uint32_t>(size);
+        }
+    }
+
+    /**
+     * @brief 在拷贝出来的栈上按帧指针回溯，只读取拷贝，不会访问非法内存
+     *
+     * @param slot
+     */
+    void unwind_frames(thread_slot* slot) {
+        CrashThreadRecord& record = slot->record;
+        const uint8_t* stack = slot->stack;
+        uintptr_t stack_begin = record.stack_begin_;
+        size_t stack_size = record.stack_size_;
+        auto read_word = [stack, stack_begin, stack_size](uintptr_t addr, uintptr_t* value) {
+            if (addr < stack_begin || addr - stack_begin + sizeof(uintptr_t) > stack_size) {
+                return false;
+            }
+            memcpy(value, stack + (addr - stack_begin), sizeof(uintptr_t));
+            return true;
+        };
+        UnwindRegisters regs;
+        regs.rip = record.regs_[REG_RIP];
+        regs.rsp = record.regs_[REG_RSP];
+        regs.rbp = record.regs_[REG_RBP];
+        UnwindRule rule;
+        CFIUnwinder::set_frame_pointer_rule(&rule);
+        record.frame_count_ = 0;
+        while (record.frame_count_ < options_.max_frames && regs.rip != 0) {
+            slot->frames[record.frame_count_++] = regs.rip;
+            if (!CFIUnwinder::step(rule, &regs, read_word)) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief 列出所有线程，触发快照的线程放在第一个
+     *
+     * @param tid
+     * @return size_t 线程个数
+     */
+    size_t list_threads(pid_t tid) {
+        reset_slot(&slots_[0], tid);
+        size_t slot_count = 1;
+        int fd = static_cast<int>(syscall(SYS_openat, AT_FDCWD, "/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (fd < 0) {
+            return slot_count;
+        }
+        for (;;) {
+            long size = syscall(SYS_getdents64, fd, io_buffer_, IO_BUFFER_SIZE);  // NOLINT
+            if (size <= 0) {
+                break;
+            }
+            for (long pos = 0; pos < size;) {  // NOLINT
+                const linux_dirent64* entry = reinterpret_cast<const linux_dirent64*>(io_buffer_ + pos);
+                pos += entry->d_reclen;
+                pid_t entry_tid = static_cast<pid_t>(parse_number(entry->d_name, 10));
+                if (entry_tid > 0 && entry_tid != tid && slot_count < options_.max_threads) {
+                    reset_slot(&slots_[slot_count++], entry_tid);
+                }
+            }
+        }
+        syscall(SYS_close, fd);
+        return slot_count;
+    }
+
+    static void reset_slot(thread_slot* slot, pid_t tid) {
+        memset(&slot->record, 0, sizeof(slot->record));
+        slot->record.tid_ = tid;
+        slot->is_captured.store(false, std::memory_order_release);
+    }
+
+    /**
+     * @brief 读取 /proc/self/maps，记录所有映射的范围和可执行的文件映射
+     *
+     */
+    void read_mappings() {
+        mapping_count_ = 0;
+        module_count_ = 0;
+        elf_base_ = 0;
+        int fd = static_cast<int>(syscall(SYS_openat, AT_FDCWD, "/proc/self/maps", O_RDONLY | O_CLOEXEC));
+        if (fd < 0) {
+            return;
+        }
+        char line[MAX_LINE_SIZE];
+        size_t line_size = 0;
+        for (;;) {
+            long size = syscall(SYS_read, fd, io_buffer_, IO_BUFFER_SIZE);  // NOLINT
+            if (size <= 0) {
+                break;
+            }
+            for (long i = 0; i < size; ++i) {  // NOLINT
+                char c = io_buffer_[i];
+                if (c == '\n') {
+                    line[line_size] = '\0';
+                    parse_mapping_line(line);
+                    line_size = 0;
+                } else if (line_size + 1 < sizeof(line)) {
+                    line[line_size++] = c;
+                }
+            }
+        }
+        if (line_size > 0) {
+            line[line_size] = '\0';
+            parse_mapping_line(line);
+        }
+        syscall(SYS_close, fd);
+    }
+
+    /**
+     * @brief 解析 maps 的一行：begin-end perms offset dev inode path
+     *
+     * @param line
+     */
+    void parse_mapping_line(const char* line) {
+        const char* p = line;
+        uintptr_t begin = parse_hex(&p);
+        if (*p++ != '-') {
+            return;
+        }
+        uintptr_t end = parse_hex(&p);
+        if (*p++ != ' ' || strlen(p) < 5) {
+            return;
+        }
+        const char* perms = p;
+        p += 5;
+        uintptr_t offset = parse_hex(&p);
+        // 跳过 dev 和 inode
+        for (int field = 0; field < 2; ++field) {
+            while (*p == ' ') {
+                ++p;
+            }
+            while (*p != ' ' && *p != '\0') {
+                ++p;
+            }
+        }
+        while (*p == ' ') {
+            ++p;
+        }
+        const char* path = p;
+        if (mapping_count_ < options_.max_mappings) {
+            mapping_range& mapping = mappings_[mapping_count_++];
+            mapping.begin = begin;
+            mapping.end = end;
+            mapping.is_readable = (perms[0] == 'r');
+        }
+        if (path[0] != '/') {
+            return;
+        }
+        // 文件偏移为 0 的映射包含 ELF 头，后面同一文件的可执行映射从这里读取 build-id
+        if (offset == 0 && perms[0] == 'r') {
+            elf_base_ = begin;
+            elf_base_end_ = end;
+            copy_string(elf_path_, sizeof(elf_path_), path);
+        }
+        if (perms[2] != 'x' || module_count_ >= options_.max_modules) {
+            return;
+        }
+        CrashModuleRecord& module = modules_[module_count_++];
+        memset(&module, 0, sizeof(module));
+        module.begin_ = begin;
+        module.end_ = end;
+        module.offset_ = offset;
+        copy_string(module.path_, sizeof(module.path_), path);
+        if (elf_base_ != 0 && strcmp(elf_path_, module.path_) == 0) {
+            read_build_id(&module);
+        }
+    }
+
+    /**
+     * @brief 从内存中的 ELF 头找到 PT_NOTE，读取 build-id
+     *
+     * @param module
+     */
+    void read_build_id(CrashModuleRecord* module) const {
+        size_t mapped_size = elf_base_end_ - elf_base_;
+        const ElfW(Ehdr)* ehdr = reinterpret_cast<const ElfW(Ehdr)*>(elf_base_);
+        if (mapped_size < sizeof(ElfW(Ehdr)) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+            || ehdr->e_phentsize != sizeof(ElfW(Phdr))
+            || ehdr->e_phoff + ehdr->e_phnum * sizeof(ElfW(Phdr)) > mapped_size) {
+            return;
+        }
+        const ElfW(Phdr)* phdrs = reinterpret_cast<const ElfW(Phdr)*>(elf_base_ + ehdr->e_phoff);
+        uintptr_t load_bias = 0;
+        bool has_load = false;
+        for (size_t i = 0; i < ehdr->e_phnum && !has_load; ++i) {
+            if (phdrs[i].p_type == PT_LOAD) {
+                load_bias = elf_base_ - (phdrs[i].p_vaddr & ~(uintptr_t(getpagesize()) - 1));
+                has_load = true;
+            }
+        }
+        for (size_t i = 0; i < ehdr->e_phnum && has_load; ++i) {
+            uintptr_t note = load_bias + phdrs[i].p_vaddr;
+            if (phdrs[i].p_type != PT_NOTE || note < elf_base_ || note + phdrs[i].p_filesz > elf_base_end_) {
+                continue;
+            }
+            uintptr_t note_end = note + phdrs[i].p_filesz;
+            while (note + sizeof(ElfW(Nhdr)) <= note_end) {
+                const ElfW(Nhdr)* nhdr = reinterpret_cast<const ElfW(Nhdr)*>(note);
+                uintptr_t name = note + sizeof(ElfW(Nhdr));
+                uintptr_t desc = name + ((nhdr->n_namesz + 3) & ~3U);
+                note = desc + ((nhdr->n_descsz + 3) & ~3U);
+                if (note > note_end) {
+                    break;
+                }
+                if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4
+                    && memcmp(reinterpret_cast<const void*>(name), "GNU", 4) == 0) {
+                    module->build_id_size_ = std::min<uint32_t>(nhdr->n_descsz, sizeof(module->build_id_));
+                    memcpy(module->build_id_, reinterpret_cast<const void*>(desc), module->build_id_size_);
+                    return;
+                }
+            }
+        }
+    }
+
+    const mapping_range* find_mapping(uintptr_t addr) const {
+        size_t low = 0, high = mapping_count_;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (mappings_[mid].end <= addr) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low < mapping_count_ && mappings_[low].begin <= addr) {
+            return &mappings_[low];
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 写入快照文件，文件名为 <directory>/crash_<pid>_<秒级时间戳>_<tid>.snapshot
+     *
+     * 使用 O_EXCL 创建，不覆盖已有的快照；同一线程在同一秒内多次 dump 时在文件名后追加序号
+     *
+     * @param slot_count
+     * @return true
+     * @return false
+     */
+    bool write_file(size_t slot_count) {
+        char* p = path_;
+        p = append_string(p, directory_);
+        p = append_string(p, "/crash_");
+        p = append_number(p, static_cast<uint64_t>(header_.pid_));
+        p = append_string(p, "_");
+        p = append_number(p, header_.timestamp_ns_ / 1000000000ULL);
+        p = append_string(p, "_");
+        p = append_number(p, static_cast<uint64_t>(header_.crashed_tid_));
+        int fd = -1;
+        for (uint64_t seq = 0; seq < MAX_FILE_SEQUENCE && fd < 0; ++seq) {
+            char* end = p;
+            if (seq != 0) {
+                end = append_string(end, "_");
+                end = append_number(end, seq);
+            }
+            append_string(end, ".snapshot");
+            fd = static_cast<int>(syscall(SYS_openat, AT_FDCWD, path_, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+            if (fd < 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+        if (fd < 0) {
+            return false;
+        }
+        bool is_written = write_all(fd, &header_, sizeof(header_))
+            && write_all(fd, modules_, module_count_ * sizeof(CrashModuleRecord));
+        for (size_t i = 0; i < slot_count && is_written; ++i) {
+            const thread_slot& slot = slots_[i];
+            is_written = write_all(fd, &slot.record, sizeof(slot.record))
+                && write_all(fd, slot.frames, slot.record.frame_count_ * sizeof(uint64_t))
+                && write_all(fd, slot.stack, slot.record.stack_size_);
+        }
+        syscall(SYS_close, fd);
+        return is_written;
+    }
+
+    static bool write_all(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            long len = syscall(SYS_write, fd, p, size);  // NOLINT
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                return false;
+            }
+            p += len;
+            size -= static_cast<size_t>(len);
+        }
+        return true;
+    }
+
+    /**
+     * @brief 按配置一次性分配所有缓冲区，信号处理函数中不再分配内存
+     *
+     * @return true
+     * @return false
+     */
+    bool allocate_buffers() {
+        size_t slots_size = align(options_.max_threads * sizeof(thread_slot));
+        size_t frames_size = align(options_.max_threads * options_.max_frames * sizeof(uint64_t));
+        size_t stacks_size = align(options_.max_threads * options_.stack_window);
+        size_t mappings_size = align(options_.max_mappings * sizeof(mapping_range));
+        size_t modules_size = align(options_.max_modules * sizeof(CrashModuleRecord));
+        arena_size_ = slots_size + frames_size + stacks_size + mappings_size + modules_size + IO_BUFFER_SIZE;
+        void* arena = mmap(nullptr, arena_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) {
+            return false;
+        }
+        arena_ = static_cast<uint8_t*>(arena);
+        uint8_t* p = arena_;
+        slots_ = reinterpret_cast<thread_slot*>(p);
+        p += slots_size;
+        uint64_t* frames = reinterpret_cast<uint64_t*>(p);
+        p += frames_size;
+        uint8_t* stacks = p;
+        p += stacks_size;
+        for (size_t i = 0; i < options_.max_threads; ++i) {
+            new (&slots_[i]) thread_slot();
+            slots_[i].frames = frames + i * options_.max_frames;
+            slots_[i].stack = stacks + i * options_.stack_window;
+        }
+        mappings_ = reinterpret_cast<mapping_range*>(p);
+        p += mappings_size;
+        modules_ = reinterpret_cast<CrashModuleRecord*>(p);
+        p += modules_size;
+        io_buffer_ = reinterpret_cast<char*>(p);
+        return true;
+    }
+
+    static size_t align(size_t size) {
+        return (size + 63) & ~size_t(63);
+    }
+
+    void wait_until_finished(uint32_t generation, uint64_t timeout_ns) const {
+        uint64_t deadline_ns = get_clock_ns(CLOCK_MONOTONIC) + timeout_ns;
+        while (finished_generation_.load(std::memory_order_acquire) < generation
+            && get_clock_ns(CLOCK_MONOTONIC) < deadline_ns) {
+            sleep_ns(100 * 1000);
+        }
+    }
+
+    uint64_t get_timeout_ns() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            options_.thread_timeout).count());
+    }
+
+    static uint64_t get_clock_ns(clockid_t clock_id) {
+        struct timespec ts;
+        clock_gettime(clock_id, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    static void sleep_ns(uint64_t ns) {
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000ULL);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000ULL);  // NOLINT
+        syscall(SYS_nanosleep, &ts, nullptr);
+    }
+
+    static uintptr_t parse_hex(const char** p) {
+        return static_cast<uintptr_t>(parse_number(*p, 16, p));
+    }
+
+    static uint64_t parse_number(const char* s, unsigned base, const char** end = nullptr) {
+        uint64_t value = 0;
+        for (;; ++s) {
+            unsigned digit;
+            if (*s >= '0' && *s <= '9') {
+                digit = static_cast<unsigned>(*s - '0');
+            } else if (base == 16 && *s >= 'a' && *s <= 'f') {
+                digit = static_cast<unsigned>(*s - 'a' + 10);
+            } else {
+                break;
+            }
+            value = value * base + digit;
+        }
+        if (end != nullptr) {
+            *end = s;
+        }
+        return value;
+    }
+
+    static void copy_string(char* dst, size_t size, const char* src) {
+        size_t len = std::min(strlen(src), size - 1);
+        memcpy(dst, src, len);
+        dst[len] = '\0';
+    }
+
+    static char* append_string(char* p, const char* s) {
+        size_t len = strlen(s);
+        memcpy(p, s, len + 1);
+        return p + len;
+    }
+
+    static char* append_number(char* p, uint64_t value) {
+        char digits[24];
+        size_t count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (count > 0) {
+            *p++ = digits[--count];
+        }
+        *p = '\0';
+        return p;
+    }
+
+private:
+    CrashSnapshotOptions options_;
+    bool is_installed_{false};
+    int snapshot_signal_{0};
+    struct sigaction old_actions_[CRASH_SIGNAL_COUNT];
+    struct sigaction old_snapshot_action_;
+    char directory_[PATH_MAX]{};
+    char path_[PATH_MAX]{};
+
+    // 预先分配的缓冲区
+    uint8_t* arena_{nullptr};
+    size_t arena_size_{0};
+    thread_slot* slots_{nullptr};
+    mapping_range* mappings_{nullptr};
+    CrashModuleRecord* modules_{nullptr};
+    char* io_buffer_{nullptr};
+
+    // 快照的状态
+    CrashSnapshotHeader header_;
+    size_t mapping_count_{0};
+    size_t module_count_{0};
+    uintptr_t elf_base_{0};
+    uintptr_t elf_base_end_{0};
+    char elf_path_[sizeof(CrashModuleRecord::path_)]{};
+    std::atomic<pid_t> crashing_tid_{0};
+    std::atomic<size_t> slot_count_{0};
+    std::atomic<size_t> captured_count_{0};
+    // 每次写快照递增，其他线程据此判断快照是否已经写完
+    std::atomic<uint32_t> generation_{0};
+    std::atomic<uint32_t> finished_generation_{0};
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // COLLECT_CRASH_SNAPSHOT_H_
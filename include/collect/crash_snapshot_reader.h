@@ -0,0 +1,234 @@
+/**
+ * @file crash_snapshot_reader.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_CRASH_SNAPSHOT_READER_H_
+#define COLLECT_CRASH_SNAPSHOT_READER_H_
+
+#if defined(__x86_64__)
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "collect/crash_snapshot.h"
+#include "collect/offline_unwind.h"
+#include "collect/resolver.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 从文件中读出的崩溃快照
+ *
+ */
+struct CrashSnapshot {
+    struct Thread {
+        CrashThreadRecord record_;
+        // 写快照时按帧指针回溯得到的原始栈帧
+        std::vector<void*> frames_;
+        std::vector<uint8_t> stack_;
+    };
+
+    CrashSnapshotHeader header_;
+    std::vector<CrashModuleRecord> modules_;
+    std::vector<Thread> threads_;
+};
+
+/**
+ * @brief 离线分析崩溃快照：在保存的栈内存上重新做 CFI 回溯，并按快照中的模块列表解析符号
+ *
+ */
+class CrashSnapshotReader {
+public:
+    explicit CrashSnapshotReader(size_t max_depth = 64) : unwinder_(max_depth) {}
+    ~CrashSnapshotReader() = default;
+    CrashSnapshotReader(const CrashSnapshotReader&) = delete;
+    CrashSnapshotReader& operator=(const CrashSnapshotReader&) = delete;
+    CrashSnapshotReader(CrashSnapshotReader&&) = delete;
+    CrashSnapshotReader& operator=(CrashSnapshotReader&&) = delete;
+
+public:
+    /**
+     * @brief 读取快照文件
+     *
+     * @param path
+     * @return true
+     * @return false 文件不存在、格式或版本不对、内容被截断
+     */
+    bool load(const std::string& path) {
+        snapshot_ = CrashSnapshot();
+        std::ifstream ifs(path, std::ios::binary);
+        CrashSnapshotHeader& header = snapshot_.header_;
+        if (!read_value(ifs, &header) || memcmp(header.magic_, "STCRASH1", sizeof(header.magic_)) != 0
+            || header.version_ != CrashSnapshotWriter::VERSION) {
+            return false;
+        }
+        // 按剩余的文件大小检查各个计数，损坏的文件不会导致分配过大的内存
+        if (uint64_t(header.module_count_) * sizeof(CrashModuleRecord) > get_remaining(ifs)) {
+            return false;
+        }
+        std::vector<RemoteMapping> mappings;
+        snapshot_.modules_.resize(header.module_count_);
+        for (auto& module : snapshot_.modules_) {
+            if (!read_value(ifs, &module)) {
+                return false;
+            }
+            module.path_[sizeof(module.path_) - 1] = '\0';
+            RemoteMapping mapping;
+            mapping.begin = module.begin_;
+            mapping.end = module.end_;
+            mapping.offset = module.offset_;
+            mapping.is_exec = true;
+            mapping.path = module.path_;
+            mappings.push_back(std::move(mapping));
+        }
+        if (uint64_t(header.thread_count_) * sizeof(CrashThreadRecord) > get_remaining(ifs)) {
+            return false;
+        }
+        snapshot_.threads_.resize(header.thread_count_);
+        for (auto& thread : snapshot_.threads_) {
+            if (!read_value(ifs, &thread.record_)
+                || uint64_t(thread.record_.frame_count_) * sizeof(uint64_t) + thread.record_.stack_size_
+                    > get_remaining(ifs)) {
+                return false;
+            }
+            std::vector<uint64_t> frames(thread.record_.frame_count_);
+            thread.stack_.resize(thread.record_.stack_size_);
+            if (!read_bytes(ifs, frames.data(), frames.size() * sizeof(uint64_t))
+                || !read_bytes(ifs, thread.stack_.data(), thread.stack_.size())) {
+                return false;
+            }
+            for (uint64_t frame : frames) {
+                thread.frames_.push_back(reinterpret_cast<void*>(frame));
+            }
+        }
+        unwinder_.set_mappings(std::move(mappings));
+        return true;
+    }
+
+    /**
+     * @brief 获取已读取的快照
+     *
+     * @return const CrashSnapshot&
+     */
+    const CrashSnapshot& get_snapshot() const {
+        return snapshot_;
+    }
+
+    /**
+     * @brief 在保存的栈内存上做 CFI 回溯，比快照中基于帧指针的原始栈帧更完整
+     *
+     * @param thread
+     * @return std::vector<void*> 没有采集到现场的线程返回空
+     */
+    std::vector<void*> unwind(const CrashSnapshot::Thread& thread) {
+        std::vector<void*> frames;
+        if (!(thread.record_.flags_ & CrashThreadRecord::FLAG_CAPTURED)) {
+            return frames;
+        }
+        UnwindRegisters regs;
+        regs.rip = thread.record_.regs_[REG_RIP];
+        regs.rsp = thread.record_.regs_[REG_RSP];
+        regs.rbp = thread.record_.regs_[REG_RBP];
+        unwinder_.unwind(regs, thread.record_.stack_begin_, thread.stack_.data(), thread.stack_.size(), &frames);
+        return frames;
+    }
+
+    /**
+     * @brief 按快照中的模块列表解析栈帧地址
+     *
+     * @param frames
+     * @param resolver
+     * @return std::vector<ResolvedTrace>
+     */
+    std::vector<ResolvedTrace> resolve(const std::vector<void*>& frames, TraceResolver& resolver) {
+        return unwinder_.resolve(frames, resolver);
+    }
+
+    /**
+     * @brief 检查本地的 ELF 文件是否和崩溃时加载的是同一个，不是同一个时解析结果不可信
+     *
+     * @param module
+     * @return true 一致，或者快照中没有记录 build-id
+     * @return false
+     */
+    bool is_build_id_matched(const CrashModuleRecord& module) {
+        std::string build_id = get_build_id(module);
+        const RemoteMapping* mapping = unwinder_.find_mapping(module.begin_);
+        return build_id.empty() || (mapping != nullptr && unwinder_.get_build_id(*mapping) == build_id);
+    }
+
+    /**
+     * @brief 获取快照中记录的 build-id
+     *
+     * @param module
+     * @return std::string 十六进制的 build-id
+     */
+    static std::string get_build_id(const CrashModuleRecord& module) {
+        std::string build_id;
+        char hex[3];
+        for (uint32_t i = 0; i < module.build_id_size_ && i < sizeof(module.build_id_); ++i) {
+            snprintf(hex, sizeof(hex), "%02x", module.build_id_[i]);
+            build_id += hex;
+        }
+        return build_id;
+    }
+
+    /**
+     * @brief 设置查找模块文件的根目录，用于在其他机器上分析快照（如解压出来的 sysroot）
+     *
+     * @param root_dir
+     */
+    void set_root_dir(const std::string& root_dir) {
+        unwinder_.set_root_dir(root_dir);
+    }
+
+private:
+    template <typename T>
+    static bool read_value(std::ifstream& ifs, T* value) {
+        return read_bytes(ifs, value, sizeof(T));
+    }
+
+    /**
+     * @brief 获取文件中还未读取的字节数
+     *
+     * @param ifs
+     * @return uint64_t
+     */
+    static uint64_t get_remaining(std::ifstream& ifs) {
+        std::streampos pos = ifs.tellg();
+        ifs.seekg(0, std::ios::end);
+        std::streampos end = ifs.tellg();
+        ifs.seekg(pos);
+        if (pos < 0 || end < pos) {
+            return 0;
+        }
+        return static_cast<uint64_t>(end - pos);
+    }
+
+    static bool read_bytes(std::ifstream& ifs, void* data, size_t size) {
+        if (size == 0) {
+            return true;
+        }
+        ifs.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+        return static_cast<size_t>(ifs.gcount()) == size;
+    }
+
+private:
+    CrashSnapshot snapshot_;
+    OfflineUnwinder unwinder_;
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // COLLECT_CRASH_SNAPSHOT_READER_H_
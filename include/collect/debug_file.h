@@ -0,0 +1,261 @@
+/**
+ * @file debug_file.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_DEBUG_FILE_H_
+#define COLLECT_DEBUG_FILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+namespace stack_trace {
+
+/**
+ * @brief 查找分离的调试信息文件（strip 后的二进制对应的 .debug 文件）
+ *
+ * 查找顺序与 gdb 一致：
+ * 1. 通过 NT_GNU_BUILD_ID 查找 <root>/.build-id/xx/yyyy.debug
+ * 2. 通过 .gnu_debuglink 依次查找 <dir>/<link>、<dir>/.debug/<link>、<root>/<dir>/<link>，并校验 CRC
+ */
+class DebugFileLocator {
+public:
+    DebugFileLocator() : search_roots_{"/usr/lib/debug"} {}
+    ~DebugFileLocator() = default;
+
+public:
+    /**
+     * @brief 设置调试文件的搜索根目录，会覆盖默认的 /usr/lib/debug
+     *
+     * @param roots
+     */
+    void set_search_roots(const std::vector<std::string>& roots) {
+        search_roots_ = roots;
+    }
+
+    /**
+     * @brief 追加调试文件的搜索根目录
+     *
+     * @param root
+     */
+    void add_search_root(const std::string& root) {
+        search_roots_.push_back(root);
+    }
+
+    /**
+     * @brief 获取调试文件的搜索根目录
+     *
+     * @return const std::vector<std::string>&
+     */
+    const std::vector<std::string>& get_search_roots() const {
+        return search_roots_;
+    }
+
+    /**
+     * @brief 通过 build-id 查找调试文件
+     *
+     * @param build_id 十六进制形式的 build-id
+     * @return std::string 找不到时返回空串
+     */
+    std::string find_by_build_id(const std::string& build_id) const {
+        if (build_id.size() <= 2) {
+            return "";
+        }
+        for (const auto& root : search_roots_) {
+            std::string path = root + "/.build-id/" + build_id.substr(0, 2) + "/" + build_id.substr(2) + ".debug";
+            if (access(path.c_str(), R_OK) == 0) {
+                return path;
+            }
+        }
+        return "";
+    }
+
+    /**
+     * @brief 通过 .gnu_debuglink 查找调试文件，只返回 CRC 校验通过的文件
+     *
+     * @param object_filename 被调试的 ELF 文件路径
+     * @param debuglink .gnu_debuglink 中记录的文件名
+     * @param crc .gnu_debuglink 中记录的 CRC
+     * @return std::string 找不到时返回空串
+     */
+    std::string find_by_debuglink(const std::string& object_filename,
+        const std::string& debuglink, uint32_t crc) const {
+        if (debuglink.empty()) {
+            return "";
+        }
+        // 不带目录的文件名在当前目录中，不能拼成根目录下的路径
+        std::string dir = ".";
+        size_t pos = object_filename.rfind('/');
+        if (pos != std::string::npos) {
+            dir = object_filename.substr(0, pos);
+        }
+        std::vector<std::string> candidates;
+        candidates.push_back(dir + "/" + debuglink);
+        candidates.push_back(dir + "/.debug/" + debuglink);
+        // 全局调试目录下按绝对路径组织，相对路径不在其中查找
+        if (dir.empty() || dir[0] == '/') {
+            for (const auto& root : search_roots_) {
+                candidates.push_back(root + dir + "/" + debuglink);
+            }
+        }
+        for (const auto& path : candidates) {
+            // 调试文件不能是被调试的文件本身
+            if (path == object_filename || access(path.c_str(), R_OK) != 0) {
+                continue;
+            }
+            uint32_t file_crc = 0;
+            if (calc_file_crc32(path, &file_crc) && file_crc == crc) {
+                return path;
+            }
+        }
+        return "";
+    }
+
+public:
+    /**
+     * @brief 解析 .note.gnu.build-id 段的内容，返回十六进制形式的 build-id
+     *
+     * @param data 段内容
+     * @param size 段大小
+     * @return std::string 解析失败时返回空串
+     */
+    static std::string parse_build_id_note(const unsigned char* data, size_t size) {
+        // ELF note 的格式：namesz(4) descsz(4) type(4) name(按 4 字节对齐) desc(按 4 字节对齐)
+        static const uint32_t NT_GNU_BUILD_ID_TYPE = 3;
+        size_t offset = 0;
+        while (offset + 12 <= size) {
+            uint32_t name_size, desc_size, type;
+            memcpy(&name_size, data + offset, 4);
+            memcpy(&desc_size, data + offset + 4, 4);
+            memcpy(&type, data + offset + 8, 4);
+            offset += 12;
+            size_t name_offset = offset;
+            offset += align4(name_size);
+            size_t desc_offset = offset;
+            offset += align4(desc_size);
+            if (offset > size) {
+                break;
+            }
+            if (type == NT_GNU_BUILD_ID_TYPE && name_size == 4
+                && memcmp(data + name_offset, "GNU", 4) == 0) {
+                return to_hex(data + desc_offset, desc_size);
+            }
+        }
+        return "";
+    }
+
+    /**
+     * @brief 解析 .gnu_debuglink 段的内容
+     *
+     * @param data 段内容
+     * @param size 段大小
+     * @param debuglink 调试文件名
+     * @param crc 调试文件的 CRC
+     * @return true
+     * @return false
+     */
+    static bool parse_debuglink(const unsigned char* data, size_t size, std::string* debuglink, uint32_t* crc) {
+        // 格式：以 '\0' 结尾的文件名，按 4 字节对齐，后跟 4 字节的 CRC
+        const void* end = memchr(data, '\0', size);
+        if (end == nullptr) {
+            return false;
+        }
+        size_t name_len = static_cast<size_t>(static_cast<const unsigned char*>(end) - data);
+        size_t crc_offset = align4(name_len + 1);
+        if (name_len == 0 || crc_offset + 4 > size) {
+            return false;
+        }
+        debuglink->assign(reinterpret_cast<const char*>(data), name_len);
+        memcpy(crc, data + crc_offset, 4);
+        return true;
+    }
+
+    /**
+     * @brief 计算文件的 CRC32，算法与 .gnu_debuglink 使用的一致
+     *
+     * @param filename
+     * @param crc
+     * @return true
+     * @return false
+     */
+    static bool calc_file_crc32(const std::string& filename, uint32_t* crc) {
+        FILE* fp = fopen(filename.c_str(), "rb");
+        if (fp == nullptr) {
+            return false;
+        }
+        std::vector<unsigned char> buf(64 * 1024);
+        uint32_t value = 0;
+        size_t len = 0;
+        while ((len = fread(&buf[0], 1, buf.size(), fp)) > 0) {
+            value = crc32(value, &buf[0], len);
+        }
+        bool is_ok = (ferror(fp) == 0);
+        fclose(fp);
+        *crc = value;
+        return is_ok;
+    }
+
+    /**
+     * @brief CRC32（多项式 0xedb88320），可以分段累积计算
+     *
+     * @param crc 上一段的计算结果，初始为 0
+     * @param buf
+     * @param len
+     * @return uint32_t
+     */
+    static uint32_t crc32(uint32_t crc, const unsigned char* buf, size_t len) {
+        static const Crc32Table table;
+        crc = ~crc;
+        for (size_t i = 0; i < len; ++i) {
+            crc = table.value_[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+private:
+    struct Crc32Table {
+        Crc32Table() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? (0xedb88320U ^ (c >> 1)) : (c >> 1);
+                }
+                value_[i] = c;
+            }
+        }
+        uint32_t value_[256];
+    };
+
+    static size_t align4(size_t value) {
+        return (value + 3) & ~static_cast<size_t>(3);
+    }
+
+    static std::string to_hex(const unsigned char* data, size_t size) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(size * 2);
+        for (size_t i = 0; i < size; ++i) {
+            hex.push_back(digits[data[i] >> 4]);
+            hex.push_back(digits[data[i] & 0xf]);
+        }
+        return hex;
+    }
+
+private:
+    // 调试文件的搜索根目录
+    std::vector<std::string> search_roots_;
+};
+
+}  // namespace stack_trace
+
+#endif  // COLLECT_DEBUG_FILE_H_
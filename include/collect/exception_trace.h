@@ -0,0 +1,373 @@
+/**
+ * @file exception_trace.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_EXCEPTION_TRACE_H_
+#define COLLECT_EXCEPTION_TRACE_H_
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cxxabi.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "collect/resolver_base.h"
+#include "collect/trace.h"
+#include "collect/unwind_cfi.h"
+#include "common/utils.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 异常抛出时的栈帧地址，可以直接交给 Printer 输出
+ *
+ */
+class ThrowTrace {
+public:
+    ThrowTrace() = default;
+    ThrowTrace(size_t thread_id, const std::type_info* type, std::vector<void*> frames)
+        : thread_id_(thread_id), type_(type), frames_(std::move(frames)) {}
+    ~ThrowTrace() = default;
+
+public:
+    /**
+     * @brief 是否找到了异常抛出时的栈，未被采样或被类型过滤的异常只有类型没有栈
+     *
+     * @return true
+     * @return false
+     */
+    bool is_valid() const {
+        return !frames_.empty();
+    }
+
+    /**
+     * @brief 获取异常的类型名
+     *
+     * @return std::string
+     */
+    std::string get_type_name() const {
+        return type_ != nullptr ? utils::demangle(type_->name()) : std::string();
+    }
+
+    size_t get_size() const {
+        return frames_.size();
+    }
+
+    Trace operator[](size_t idx) const {
+        if (idx >= get_size()) {
+            return Trace();
+        }
+        Trace res;
+        res.addr_ = frames_[idx];
+        res.idx_ = idx;
+        return res;
+    }
+
+    void* const* begin() const {
+        return frames_.empty() ? nullptr : &frames_[0];
+    }
+
+    /**
+     * @brief 获取抛出异常的线程 ID
+     *
+     * @return size_t
+     */
+    size_t get_thread_id() const {
+        return thread_id_;
+    }
+
+private:
+    size_t thread_id_{0};
+    const std::type_info* type_{nullptr};
+    std::vector<void*> frames_;
+};
+
+/**
+ * @brief 类型过滤的方式
+ *
+ */
+enum class ExceptionFilterMode {
+    // 只记录过滤列表中的类型
+    INCLUDE = 0,
+    // 不记录过滤列表中的类型
+    EXCLUDE,
+};
+
+/**
+ * @brief 记录 C++ 异常抛出时的栈，在 catch 块中取出并解析
+ *
+ * 需要在某一个源文件中 include 本文件之前定义 STACK_TRACE_EXCEPTION_HOOK，以拦截 __cxa_throw（通常放在可执行文件中，
+ * 这样所有动态库抛出的异常都会经过它），并调用 enable 开启。抛出时只把原始地址写入线程局部的环形槽位，不分配内存，
+ * 按异常对象的地址查找；符号解析在取出之后才进行。只能在抛出异常的线程中取出，跨线程传递的 exception_ptr 找不到
+ */
+class ExceptionTracer {
+public:
+    static const size_t MAX_FRAMES = 32;
+    // 每个线程保留最近的异常个数，嵌套的 try/catch 也能找到外层的异常
+    static const size_t SLOT_COUNT = 8;
+    static const size_t MAX_TYPE_FILTERS = 16;
+
+public:
+    static ExceptionTracer& instance() {
+        static ExceptionTracer tracer;
+        return tracer;
+    }
+    ExceptionTracer(const ExceptionTracer&) = delete;
+    ExceptionTracer& operator=(const ExceptionTracer&) = delete;
+    ExceptionTracer(ExceptionTracer&&) = delete;
+    ExceptionTracer& operator=(ExceptionTracer&&) = delete;
+
+public:
+    /**
+     * @brief 开始记录异常抛出时的栈
+     *
+     */
+    void enable() {
+        // backtrace 第一次调用时会加载 libgcc_s，提前调用，避免在抛出异常时分配内存
+        void* frame = nullptr;
+        backtrace(&frame, 1);
+        is_enabled_.store(true, std::memory_order_release);
+    }
+
+    void disable() {
+        is_enabled_.store(false, std::memory_order_release);
+    }
+
+    bool is_enabled() const {
+        return is_enabled_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置采样率，每个线程每 rate 个异常记录一次栈
+     *
+     * @param rate 为 0 或 1 时每个异常都记录
+     */
+    void set_sample_rate(uint32_t rate) {
+        sample_rate_.store(rate == 0 ? 1 : rate, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置抓取栈的实现方式
+     *
+     * @param backend
+     */
+    void set_unwind_backend(UnwindBackend backend) {
+        unwind_backend_.store(backend, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置类型过滤的方式，默认为 EXCLUDE，即过滤列表为空时记录所有类型
+     *
+     * @param mode
+     */
+    void set_filter_mode(ExceptionFilterMode mode) {
+        filter_mode_.store(mode, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 添加过滤的类型，按精确的类型匹配，不考虑继承关系
+     *
+     * @param type 如 typeid(std::out_of_range)
+     * @return true
+     * @return false 超出 MAX_TYPE_FILTERS 个
+     */
+    bool add_type_filter(const std::type_info& type) {
+        std::lock_guard<std::mutex> lock(filter_mutex_);
+        size_t count = filter_count_.load(std::memory_order_relaxed);
+        if (count >= MAX_TYPE_FILTERS) {
+            return false;
+        }
+        type_filters_[count].store(&type, std::memory_order_relaxed);
+        filter_count_.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    void clear_type_filters() {
+        std::lock_guard<std::mutex> lock(filter_mutex_);
+        filter_count_.store(0, std::memory_order_release);
+    }
+
+    /**
+     * @brief 在 catch 块中获取当前正在处理的异常抛出时的栈
+     *
+     * 按类型匹配当前线程最近一次抛出的异常；有多个同类型的异常嵌套时，优先使用 find
+     *
+     * @return ThrowTrace
+     */
+    ThrowTrace get_current() const {
+        const std::type_info* type = abi::__cxa_current_exception_type();
+        if (type == nullptr) {
+            return ThrowTrace();
+        }
+        const throw_slots& slots = get_slots();
+        for (size_t i = 1; i <= SLOT_COUNT; ++i) {
+            const throw_record& record = slots.records[(slots.next + SLOT_COUNT - i) % SLOT_COUNT];
+            if (record.type != nullptr && *record.type == *type) {
+                return to_trace(record);
+            }
+        }
+        return ThrowTrace();
+    }
+
+    /**
+     * @brief 按异常对象查找抛出时的栈，如 catch (const std::exception& e) { find(e); }
+     *
+     * @tparam T
+     * @param exception 以引用捕获的异常对象
+     * @return ThrowTrace
+     */
+    template <typename T>
+    ThrowTrace find(const T& exception) const {
+        return find_object(get_object_address(exception, std::is_polymorphic<T>()));
+    }
+
+    /**
+     * @brief 由拦截的 __cxa_throw 调用
+     *
+     * @param exception 异常对象
+     * @param type
+     */
+    __attribute__((noinline))
+    static void on_throw(void* exception, const std::type_info* type) {
+        ExceptionTracer& tracer = instance();
+        if (!tracer.is_enabled()) {
+            return;
+        }
+        throw_slots& slots = get_slots();
+        throw_record& record = slots.records[slots.next];
+        slots.next = (slots.next + 1) % SLOT_COUNT;
+        record.exception = exception;
+        record.type = type;
+        record.frame_count = 0;
+        // 未被采样或被过滤的异常也占一个槽位，避免 get_current 匹配到更早的同类型异常
+        if (++slots.throw_count % tracer.sample_rate_.load(std::memory_order_relaxed) != 0
+            || !tracer.is_type_matched(type)) {
+            return;
+        }
+        int frame_count = 0;
+#if defined(__x86_64__)
+        if (tracer.unwind_backend_.load(std::memory_order_relaxed) == UnwindBackend::CFI) {
+            frame_count = static_cast<int>(CFIUnwinder::instance().unwind(record.frames, MAX_FRAMES));
+        } else {
+            frame_count = backtrace(record.frames, MAX_FRAMES);
+        }
+#else
+        frame_count = backtrace(record.frames, MAX_FRAMES);
+#endif
+        record.frame_count = frame_count > 0 ? static_cast<size_t>(frame_count) : 0;
+    }
+
+private:
+    ExceptionTracer() = default;
+
+    struct throw_record {
+        const void* exception;
+        const std::type_info* type;
+        size_t frame_count;
+        void* frames[MAX_FRAMES];
+    };
+
+    struct throw_slots {
+        throw_record records[SLOT_COUNT];
+        size_t next;
+        uint32_t throw_count;
+    };
+
+    // 第一个栈帧是 on_throw，第二个是 __cxa_throw
+    static const size_t SKIP_FRAMES = 2;
+
+    static throw_slots& get_slots() {
+        static thread_local throw_slots slots;
+        return slots;
+    }
+
+    bool is_type_matched(const std::type_info* type) const {
+        size_t count = filter_count_.load(std::memory_order_acquire);
+        bool is_found = false;
+        for (size_t i = 0; i < count && !is_found; ++i) {
+            is_found = (*type_filters_[i].load(std::memory_order_relaxed) == *type);
+        }
+        return filter_mode_.load(std::memory_order_relaxed) == ExceptionFilterMode::INCLUDE ? is_found : !is_found;
+    }
+
+    ThrowTrace find_object(const void* exception) const {
+        const throw_slots& slots = get_slots();
+        for (size_t i = 1; i <= SLOT_COUNT; ++i) {
+            const throw_record& record = slots.records[(slots.next + SLOT_COUNT - i) % SLOT_COUNT];
+            if (record.type != nullptr && record.exception == exception) {
+                return to_trace(record);
+            }
+        }
+        return ThrowTrace();
+    }
+
+    static ThrowTrace to_trace(const throw_record& record) {
+        std::vector<void*> frames;
+        if (record.frame_count > SKIP_FRAMES) {
+            frames.assign(record.frames + SKIP_FRAMES, record.frames + record.frame_count);
+        }
+        return ThrowTrace(static_cast<size_t>(syscall(SYS_gettid)), record.type, std::move(frames));
+    }
+
+    // 以基类引用捕获时，抛出的对象地址是最终派生类对象的地址
+    template <typename T>
+    static const void* get_object_address(const T& exception, std::true_type) {
+        return dynamic_cast<const void*>(&exception);
+    }
+
+    template <typename T>
+    static const void* get_object_address(const T& exception, std::false_type) {
+        return &exception;
+    }
+
+private:
+    std::atomic<bool> is_enabled_{false};
+    std::atomic<uint32_t> sample_rate_{1};
+    std::atomic<UnwindBackend> unwind_backend_{UnwindBackend::BACKTRACE};
+    std::atomic<ExceptionFilterMode> filter_mode_{ExceptionFilterMode::EXCLUDE};
+    std::mutex filter_mutex_;
+    std::atomic<const std::type_info*> type_filters_[MAX_TYPE_FILTERS];
+    std::atomic<size_t> filter_count_{0};
+};
+
+}  // namespace stack_trace
+
+#if defined(STACK_TRACE_EXCEPTION_HOOK)
+
+namespace __cxxabiv1 {
+
+/**
+ * @brief 拦截 __cxa_throw，记录栈后交给 libstdc++ 中真正的实现
+ *
+ */
+extern "C" void __cxa_throw(void* exception, std::type_info* type, void (*destructor)(void*)) {
+    typedef void (*cxa_throw_t)(void*, std::type_info*, void (*)(void*));
+    static cxa_throw_t real_cxa_throw = reinterpret_cast<cxa_throw_t>(dlsym(RTLD_NEXT, "__cxa_throw"));
+    if (real_cxa_throw == nullptr) {
+        abort();
+    }
+    stack_trace::ExceptionTracer::on_throw(exception, type);
+    real_cxa_throw(exception, type, destructor);
+    __builtin_unreachable();
+}
+
+}  // namespace __cxxabiv1
+
+#endif  // defined(STACK_TRACE_EXCEPTION_HOOK)
+
+#endif  // COLLECT_EXCEPTION_TRACE_H_
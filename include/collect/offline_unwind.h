@@ -0,0 +1,370 @@
+/**
+ * @file offline_unwind.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_OFFLINE_UNWIND_H_
+#define COLLECT_OFFLINE_UNWIND_H_
+
+#if defined(__x86_64__)
+
+#include <fcntl.h>
+#include <link.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "collect/debug_file.h"
+#include "collect/resolver.h"
+#include "collect/unwind_cfi.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 其他进程（或崩溃快照）中的一个内存映射，对应 /proc/<pid>/maps 的一行
+ *
+ */
+struct RemoteMapping {
+    uintptr_t begin{0};
+    uintptr_t end{0};
+    uintptr_t offset{0};
+    bool is_exec{false};
+    std::string path;
+};
+
+/**
+ * @brief 离线回溯和解析不属于本进程的栈：寄存器和栈内存是拷贝出来的，模块按映射从磁盘上的 ELF 文件读取
+ *
+ * 回溯读取 ELF 文件中包含 .eh_frame_hdr/.eh_frame 的段，把目标地址换算到该段在本进程中的地址后复用 CFIUnwinder 的规则编译；
+ * 找不到 FDE 时退化为帧指针。解析使用 TraceResolver::resolve_in_object
+ */
+class OfflineUnwinder {
+public:
+    explicit OfflineUnwinder(size_t max_depth = 64)
+        : max_depth_(max_depth), page_size_(static_cast<uintptr_t>(getpagesize())) {}
+    ~OfflineUnwinder() = default;
+    OfflineUnwinder(const OfflineUnwinder&) = delete;
+    OfflineUnwinder& operator=(const OfflineUnwinder&) = delete;
+    OfflineUnwinder(OfflineUnwinder&&) = delete;
+    OfflineUnwinder& operator=(OfflineUnwinder&&) = delete;
+
+public:
+    /**
+     * @brief 设置目标的内存映射，会清空已计算的回溯规则
+     *
+     * @param mappings
+     */
+    void set_mappings(std::vector<RemoteMapping> mappings) {
+        mappings_ = std::move(mappings);
+        std::sort(mappings_.begin(), mappings_.end(),
+            [](const RemoteMapping& a, const RemoteMapping& b) { return a.begin < b.begin; });
+        rule_cache_.clear();
+    }
+
+    /**
+     * @brief 获取目标的内存映射
+     *
+     * @return const std::vector<RemoteMapping>&
+     */
+    const std::vector<RemoteMapping>& get_mappings() const {
+        return mappings_;
+    }
+
+    /**
+     * @brief 设置查找 ELF 文件的根目录，如 /proc/<pid>/root，找不到时再按原路径查找
+     *
+     * @param root_dir
+     */
+    void set_root_dir(const std::string& root_dir) {
+        root_dir_ = root_dir;
+    }
+
+    /**
+     * @brief 设置回溯的最大深度
+     *
+     * @param max_depth
+     */
+    void set_max_depth(size_t max_depth) {
+        max_depth_ = max_depth;
+    }
+
+    /**
+     * @brief 在拷贝出来的栈上做 CFI 回溯
+     *
+     * @param regs 栈顶的寄存器，rip 为精确的指令地址
+     * @param stack_begin 拷贝的栈内存在目标中的起始地址
+     * @param stack 拷贝的栈内存
+     * @param stack_size
+     * @param frames
+     */
+    void unwind(const UnwindRegisters& regs, uintptr_t stack_begin, const uint8_t* stack, size_t stack_size,
+        std::vector<void*>* frames) {
+        auto read_word = [stack_begin, stack, stack_size](uintptr_t addr, uintptr_t* value) {
+            if (addr < stack_begin || addr - stack_begin + sizeof(uintptr_t) > stack_size) {
+                return false;
+            }
+            memcpy(value, stack + (addr - stack_begin), sizeof(uintptr_t));
+            return true;
+        };
+        UnwindRegisters current = regs;
+        bool is_exact_pc = true;
+        while (frames->size() < max_depth_ && current.rip != 0) {
+            frames->push_back(reinterpret_cast<void*>(current.rip));
+            UnwindRule rule;
+            find_rule(is_exact_pc ? current.rip : current.rip - 1, &rule);
+            if (!CFIUnwinder::step(rule, &current, read_word)) {
+                break;
+            }
+            is_exact_pc = false;
+        }
+    }
+
+    /**
+     * @brief 解析栈帧地址
+     *
+     * @param frames
+     * @param resolver
+     * @return std::vector<ResolvedTrace>
+     */
+    std::vector<ResolvedTrace> resolve(const std::vector<void*>& frames, TraceResolver& resolver) {
+        std::vector<ResolvedTrace> resolved_traces;
+        resolved_traces.reserve(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            const RemoteMapping* mapping = find_mapping(reinterpret_cast<uintptr_t>(frames[i]));
+            object_info* object = mapping != nullptr ? load_object(*mapping) : nullptr;
+            uintptr_t load_bias = 0;
+            ResolvedTrace resolved_trace;
+            if (object != nullptr && get_load_bias(*mapping, *object, &load_bias)) {
+                resolved_trace = resolver.resolve_in_object(object->local_path, frames[i],
+                    reinterpret_cast<void*>(load_bias));
+            } else {
+                resolved_trace.addr_ = frames[i];
+            }
+            if (mapping != nullptr) {
+                resolved_trace.object_filename_ = mapping->path;
+            }
+            resolved_trace.idx_ = i;
+            resolved_traces.push_back(std::move(resolved_trace));
+        }
+        return resolved_traces;
+    }
+
+    /**
+     * @brief 获取映射对应的本地 ELF 文件的 build-id，用于检查文件是否已经被替换
+     *
+     * @param mapping
+     * @return std::string 十六进制的 build-id，文件不存在或没有 build-id 时为空
+     */
+    std::string get_build_id(const RemoteMapping& mapping) {
+        object_info* object = load_object(mapping);
+        return object != nullptr ? object->build_id : std::string();
+    }
+
+    /**
+     * @brief 查找地址所在的映射
+     *
+     * @param addr
+     * @return const RemoteMapping* 找不到时返回 nullptr
+     */
+    const RemoteMapping* find_mapping(uintptr_t addr) const {
+        auto it = std::upper_bound(mappings_.begin(), mappings_.end(), addr,
+            [](uintptr_t value, const RemoteMapping& mapping) { return value < mapping.begin; });
+        if (it == mappings_.begin() || addr >= (it - 1)->end) {
+            return nullptr;
+        }
+        return &*(it - 1);
+    }
+
+private:
+    // 离线回溯和解析需要的 ELF 文件信息
+    struct object_info {
+        bool is_valid{false};
+        std::string local_path;
+        std::string build_id;
+        std::vector<ElfW(Phdr)> load_segments;
+        // 包含 .eh_frame_hdr 和 .eh_frame 的 PT_LOAD 段的内容
+        std::vector<uint8_t> eh_frame_segment;
+        uintptr_t eh_frame_segment_vaddr{0};
+        uintptr_t eh_frame_hdr_vaddr{0};
+    };
+
+    /**
+     * @brief 获取目标中 PC 的回溯规则，找不到 FDE 时退化为帧指针
+     *
+     * @param pc
+     * @param rule
+     */
+    void find_rule(uintptr_t pc, UnwindRule* rule) {
+        auto it = rule_cache_.find(pc);
+        if (it != rule_cache_.end()) {
+            *rule = it->second;
+            return;
+        }
+        const RemoteMapping* mapping = find_mapping(pc);
+        object_info* object = (mapping != nullptr && mapping->is_exec) ? load_object(*mapping) : nullptr;
+        uintptr_t load_bias = 0;
+        bool is_found = false;
+        if (object != nullptr && !object->eh_frame_segment.empty() && get_load_bias(*mapping, *object, &load_bias)) {
+            // 把目标中的地址换算成段内容在本进程中的地址，.eh_frame 中的相对地址仍然成立
+            const uint8_t* segment = object->eh_frame_segment.data();
+            uintptr_t local_pc = reinterpret_cast<uintptr_t>(segment) + (pc - load_bias - object->eh_frame_segment_vaddr);
+            is_found = CFIUnwinder::compile_fde_rule(
+                segment + (object->eh_frame_hdr_vaddr - object->eh_frame_segment_vaddr), local_pc, rule);
+        }
+        if (!is_found) {
+            CFIUnwinder::set_frame_pointer_rule(rule);
+        }
+        rule_cache_[pc] = *rule;
+    }
+
+    /**
+     * @brief 按映射中的文件偏移找到对应的 PT_LOAD 段，计算模块的加载偏移
+     *
+     * @param mapping
+     * @param object
+     * @param load_bias
+     * @return true
+     * @return false
+     */
+    bool get_load_bias(const RemoteMapping& mapping, const object_info& object, uintptr_t* load_bias) const {
+        for (const auto& phdr : object.load_segments) {
+            if ((phdr.p_offset & ~(page_size_ - 1)) == mapping.offset) {
+                *load_bias = mapping.begin - (phdr.p_vaddr & ~(page_size_ - 1));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 读取映射对应的 ELF 文件的程序头、build-id 和 .eh_frame 所在的段
+     *
+     * @param mapping
+     * @return object_info* 不是 ELF 文件时返回 nullptr
+     */
+    object_info* load_object(const RemoteMapping& mapping) {
+        if (mapping.path.empty() || mapping.path[0] != '/') {
+            return nullptr;
+        }
+        std::string local_path = root_dir_ + mapping.path;
+        if (root_dir_.empty() || access(local_path.c_str(), R_OK) != 0) {
+            local_path = mapping.path;
+        }
+        auto it = objects_.find(local_path);
+        if (it != objects_.end()) {
+            return it->second.is_valid ? &it->second : nullptr;
+        }
+        object_info& object = objects_[local_path];
+        object.local_path = local_path;
+        int fd = open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        object.is_valid = read_object(fd, &object);
+        close(fd);
+        return object.is_valid ? &object : nullptr;
+    }
+
+    static bool read_object(int fd, object_info* object) {
+        ElfW(Ehdr) ehdr;
+        if (pread(fd, &ehdr, sizeof(ehdr), 0) != static_cast<ssize_t>(sizeof(ehdr))
+            || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64
+            || ehdr.e_phentsize != sizeof(ElfW(Phdr))) {
+            return false;
+        }
+        std::vector<ElfW(Phdr)> phdrs(ehdr.e_phnum);
+        ssize_t phdrs_size = static_cast<ssize_t>(phdrs.size() * sizeof(ElfW(Phdr)));
+        if (phdrs.empty() || pread(fd, phdrs.data(), static_cast<size_t>(phdrs_size),
+            static_cast<off_t>(ehdr.e_phoff)) != phdrs_size) {
+            return false;
+        }
+        bool has_eh_frame_hdr = false;
+        for (const auto& phdr : phdrs) {
+            if (phdr.p_type == PT_LOAD) {
+                object->load_segments.push_back(phdr);
+            } else if (phdr.p_type == PT_GNU_EH_FRAME) {
+                object->eh_frame_hdr_vaddr = phdr.p_vaddr;
+                has_eh_frame_hdr = true;
+            } else if (phdr.p_type == PT_NOTE && object->build_id.empty() && phdr.p_filesz < (1 << 20)) {
+                std::vector<uint8_t> notes(phdr.p_filesz);
+                if (!notes.empty() && pread(fd, notes.data(), notes.size(), static_cast<off_t>(phdr.p_offset))
+                    == static_cast<ssize_t>(notes.size())) {
+                    object->build_id = DebugFileLocator::parse_build_id_note(notes.data(), notes.size());
+                }
+            }
+        }
+        if (!has_eh_frame_hdr) {
+            return true;
+        }
+        for (const auto& phdr : object->load_segments) {
+            if (object->eh_frame_hdr_vaddr < phdr.p_vaddr || object->eh_frame_hdr_vaddr >= phdr.p_vaddr + phdr.p_filesz) {
+                continue;
+            }
+            object->eh_frame_segment.resize(phdr.p_filesz);
+            object->eh_frame_segment_vaddr = phdr.p_vaddr;
+            if (pread(fd, object->eh_frame_segment.data(), phdr.p_filesz, static_cast<off_t>(phdr.p_offset))
+                != static_cast<ssize_t>(phdr.p_filesz) || !check_eh_frame_hdr(*object)) {
+                object->eh_frame_segment.clear();
+            }
+            break;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 检查 .eh_frame_hdr 查找表指向的 FDE 都在读出的段内
+     *
+     * @param object
+     * @return true
+     * @return false
+     */
+    static bool check_eh_frame_hdr(const object_info& object) {
+        const std::vector<uint8_t>& segment = object.eh_frame_segment;
+        size_t hdr_offset = object.eh_frame_hdr_vaddr - object.eh_frame_segment_vaddr;
+        // 只处理链接器生成的常见编码：eh_frame_ptr 为 pcrel|sdata4，fde_count 为 udata4，查找表为 datarel|sdata4
+        if (hdr_offset + 12 > segment.size() || segment[hdr_offset] != 1 || segment[hdr_offset + 1] != 0x1b
+            || segment[hdr_offset + 2] != 0x03 || segment[hdr_offset + 3] != 0x3b) {
+            return false;
+        }
+        uint32_t fde_count;
+        memcpy(&fde_count, &segment[hdr_offset + 8], sizeof(fde_count));
+        size_t table_offset = hdr_offset + 12;
+        if (table_offset + static_cast<size_t>(fde_count) * 8 > segment.size()) {
+            return false;
+        }
+        for (uint32_t i = 0; i < fde_count; ++i) {
+            int32_t fde;
+            memcpy(&fde, &segment[table_offset + i * 8 + 4], sizeof(fde));
+            int64_t fde_offset = static_cast<int64_t>(hdr_offset) + fde;
+            if (fde_offset < 0 || static_cast<size_t>(fde_offset) + 8 > segment.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    size_t max_depth_;
+    uintptr_t page_size_;
+    std::string root_dir_;
+    std::vector<RemoteMapping> mappings_;
+    // 以本地路径为 key 的 ELF 文件信息
+    std::unordered_map<std::string, object_info> objects_;
+    // 已计算过的回溯规则，映射变化时清空
+    std::unordered_map<uintptr_t, UnwindRule> rule_cache_;
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // COLLECT_OFFLINE_UNWIND_H_
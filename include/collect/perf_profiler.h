@@ -0,0 +1,637 @@
+/**
+ * @file perf_profiler.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_PERF_PROFILER_H_
+#define COLLECT_PERF_PROFILER_H_
+
+#if defined(__x86_64__)
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "collect/offline_unwind.h"
+#include "collect/remote_trace.h"
+#include "collect/resolver.h"
+#include "common/stats.h"
+#include "printer/flame_graph.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 采样使用的软件事件
+ *
+ */
+enum class PerfClock {
+    // 线程在 CPU 上运行的时间
+    TASK_CLOCK = 0,
+    // CPU 时钟
+    CPU_CLOCK,
+};
+
+/**
+ * @brief 采样的配置
+ *
+ */
+struct PerfProfilerOptions {
+    PerfClock clock{PerfClock::TASK_CLOCK};
+    // 每秒的采样次数
+    uint64_t frequency{99};
+    // 为 0 时采样当前进程
+    pid_t pid{0};
+    // 为 0 时采样进程的所有线程，否则只采样这一个线程。
+    // 之后创建的线程由读取线程每 100ms 扫描一次 /proc/<pid>/task 加入，存活时间短于扫描间隔的线程可能完全没有样本
+    pid_t tid{0};
+    // 是否采集内核栈，没有权限（perf_event_paranoid > 1 且没有 CAP_PERFMON）时自动退化为只采集用户栈
+    bool is_kernel{true};
+    // 每个 ring buffer 的数据页数，必须是 2 的幂
+    size_t ring_pages{64};
+    size_t max_depth{127};
+};
+
+/**
+ * @brief 一次采样
+ *
+ */
+struct PerfSample {
+    pid_t pid_{0};
+    pid_t tid_{0};
+    uint64_t time_ns_{0};
+    // 叶子在前
+    std::vector<uint64_t> kernel_frames_;
+    std::vector<uint64_t> user_frames_;
+};
+
+/**
+ * @brief 按地址查找内核符号，来自 /proc/kallsyms
+ *
+ */
+class KernelSymbols {
+public:
+    KernelSymbols() = default;
+    ~KernelSymbols() = default;
+    KernelSymbols(const KernelSymbols&) = delete;
+    KernelSymbols& operator=(const KernelSymbols&) = delete;
+    KernelSymbols(KernelSymbols&&) = delete;
+    KernelSymbols& operator=(KernelSymbols&&) = delete;
+
+public:
+    /**
+     * @brief 读取 /proc/kallsyms
+     *
+     * @param path
+     * @return true
+     * @return false 文件不存在或地址被 kptr_restrict 隐藏
+     */
+    bool load(const std::string& path = "/proc/kallsyms") {
+        symbols_.clear();
+        std::ifstream ifs(path);
+        std::string line;
+        while (std::getline(ifs, line)) {
+            char* end = nullptr;
+            uint64_t addr = strtoull(line.c_str(), &end, 16);
+            // 只保留代码段的符号
+            if (addr == 0 || end == nullptr || end[0] != ' ' || (end[1] != 't' && end[1] != 'T'
+                && end[1] != 'w' && end[1] != 'W') || end[2] != ' ') {
+                continue;
+            }
+            std::string name(end + 3);
+            size_t tab = name.find('\t');
+            if (tab != std::string::npos) {
+                // 模块中的符号形如 "name\t[module]"
+                name = name.substr(0, tab) + " " + name.substr(tab + 1);
+            }
+            symbols_.push_back(symbol{addr, std::move(name)});
+        }
+        std::sort(symbols_.begin(), symbols_.end(),
+            [](const symbol& a, const symbol& b) { return a.addr < b.addr; });
+        return !symbols_.empty();
+    }
+
+    /**
+     * @brief 查找地址所在的内核函数
+     *
+     * @param addr
+     * @return std::string 找不到时为地址的十六进制形式
+     */
+    std::string lookup(uint64_t addr) const {
+        auto it = std::upper_bound(symbols_.begin(), symbols_.end(), addr,
+            [](uint64_t value, const symbol& sym) { return value < sym.addr; });
+        if (it == symbols_.begin()) {
+            std::ostringstream oss;
+            oss << "0x" << std::hex << addr;
+            return oss.str();
+        }
+        return (it - 1)->name;
+    }
+
+private:
+    struct symbol {
+        uint64_t addr;
+        std::string name;
+    };
+
+    std::vector<symbol> symbols_;
+};
+
+/**
+ * @brief 基于 perf_event_open 的采样：内核在时钟中断中按帧指针回溯出内核栈和用户栈，写入 mmap 的 ring buffer，
+ * 由单独的读取线程消费，被采样的线程不需要做任何事情，也能看到在内核中的时间
+ *
+ * 用户栈由内核沿帧指针回溯，被采样的代码需要保留帧指针（-fno-omit-frame-pointer）才能得到完整的栈
+ */
+class PerfProfiler {
+public:
+    using sample_callback_t = std::function<void(const PerfSample&)>;
+
+public:
+    explicit PerfProfiler(const PerfProfilerOptions& options = PerfProfilerOptions())
+        : options_(options), page_size_(static_cast<size_t>(getpagesize())) {}
+    ~PerfProfiler() {
+        stop();
+    }
+    PerfProfiler(const PerfProfiler&) = delete;
+    PerfProfiler& operator=(const PerfProfiler&) = delete;
+    PerfProfiler(PerfProfiler&&) = delete;
+    PerfProfiler& operator=(PerfProfiler&&) = delete;
+
+public:
+    /**
+     * @brief 设置每次采样的回调，在读取线程中调用，需要在 start 之前设置
+     *
+     * @param callback
+     */
+    void set_sample_callback(sample_callback_t callback) {
+        callback_ = std::move(callback);
+    }
+
+    /**
+     * @brief 打开事件并开始采样
+     *
+     * @return true
+     * @return false 失败时 errno 为 perf_event_open 或 mmap 的错误
+     */
+    bool start() {
+        if (is_running_ || (options_.ring_pages & (options_.ring_pages - 1)) != 0) {
+            errno = EINVAL;
+            return false;
+        }
+        pid_ = options_.pid != 0 ? options_.pid : getpid();
+        std::vector<pid_t> tids;
+        if (options_.tid != 0) {
+            tids.push_back(options_.tid);
+        } else {
+            tids = RemoteStackCapture::list_threads(pid_);
+        }
+        is_kernel_.store(options_.is_kernel, std::memory_order_relaxed);
+        for (pid_t tid : tids) {
+            // 线程可能在列出之后退出，其他错误则放弃
+            if (!add_thread(tid) && errno != ESRCH) {
+                int saved_errno = errno;
+                close_rings();
+                errno = saved_errno;
+                return false;
+            }
+        }
+        if (rings_.empty()) {
+            errno = ESRCH;
+            return false;
+        }
+        stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        is_running_ = true;
+        // 事件不继承到子线程，之后创建的读取线程不会被采样
+        reader_thread_ = std::thread(&PerfProfiler::read_loop, this);
+        return true;
+    }
+
+    /**
+     * @brief 停止采样，读完 ring buffer 中剩余的样本后返回
+     *
+     */
+    void stop() {
+        if (!is_running_) {
+            return;
+        }
+        uint64_t value = 1;
+        if (write(stop_fd_, &value, sizeof(value)) < 0) {
+            // eventfd 不会写失败，读取线程最迟在 poll 超时后退出
+        }
+        // 运行期间 rings_ 只由读取线程修改，等它退出之后再关闭事件
+        reader_thread_.join();
+        for (auto& ring : rings_) {
+            ioctl(ring.fd, PERF_EVENT_IOC_DISABLE, 0);
+            drain(&ring);
+        }
+        close_rings();
+        close(stop_fd_);
+        stop_fd_ = -1;
+        is_running_ = false;
+    }
+
+    /**
+     * @brief 是否采集到了内核栈
+     *
+     * @return true
+     * @return false
+     */
+    bool is_kernel_enabled() const {
+        return is_kernel_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_sample_count() const {
+        return sample_count_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 获取 ring buffer 写满而丢失的样本数
+     *
+     * @return uint64_t
+     */
+    uint64_t get_lost_count() const {
+        return lost_count_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 把聚合的栈解析后添加到火焰图中，内核栈帧带 "_[k]" 后缀
+     *
+     * @param graph
+     * @param resolver 用于解析用户栈帧
+     */
+    void add_to(FlameGraph* graph, TraceResolver& resolver) {
+        for (const auto& item : get_names(resolver)) {
+            graph->add_stack(item.first, item.second);
+        }
+    }
+
+    /**
+     * @brief 输出为 folded 格式，可以交给 stack_trace_flame_graph 或其他火焰图工具
+     *
+     * @param os
+     * @param resolver 用于解析用户栈帧
+     */
+    void write_folded(std::ostream& os, TraceResolver& resolver) {
+        for (const auto& item : get_names(resolver)) {
+            for (size_t i = 0; i < item.first.size(); ++i) {
+                os << (i == 0 ? "" : ";") << item.first[i];
+            }
+            os << " " << item.second << "\n";
+        }
+    }
+
+    /**
+     * @brief 清空聚合的栈
+     *
+     */
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stacks_.clear();
+    }
+
+private:
+    struct ring_buffer {
+        pid_t tid{0};
+        int fd{-1};
+        uint8_t* base{nullptr};
+        size_t mmap_size{0};
+    };
+
+    struct callchain_hash {
+        size_t operator()(const std::vector<uint64_t>& chain) const {
+            size_t hash = chain.size();
+            for (uint64_t ip : chain) {
+                hash = hash * 31 + std::hash<uint64_t>()(ip);
+            }
+            return hash;
+        }
+    };
+
+    // 读取线程扫描新线程的间隔
+    static const int SCAN_INTERVAL_MS = 100;
+
+    /**
+     * @brief 为线程打开事件并开始采样
+     *
+     * 内核不允许 mmap 继承到子线程（inherit）的单线程事件，只能每个线程各打开一个事件
+     *
+     * @param tid
+     * @return true
+     * @return false
+     */
+    bool add_thread(pid_t tid) {
+        ring_buffer ring;
+        if (!open_event(tid, &ring)) {
+            return false;
+        }
+        ring.tid = tid;
+        rings_.push_back(ring);
+        ioctl(ring.fd, PERF_EVENT_IOC_ENABLE, 0);
+        return true;
+    }
+
+    /**
+     * @brief 为进程中新创建的线程打开事件，跳过读取线程自己
+     *
+     */
+    void scan_threads() {
+        std::unordered_set<pid_t> known;
+        for (const auto& ring : rings_) {
+            known.insert(ring.tid);
+        }
+        for (pid_t tid : RemoteStackCapture::list_threads(pid_)) {
+            if (tid != reader_tid_ && known.count(tid) == 0) {
+                add_thread(tid);
+            }
+        }
+    }
+
+    bool open_event(pid_t tid, ring_buffer* ring) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = options_.clock == PerfClock::CPU_CLOCK ? PERF_COUNT_SW_CPU_CLOCK : PERF_COUNT_SW_TASK_CLOCK;
+        attr.freq = 1;
+        attr.sample_freq = options_.frequency;
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        attr.use_clockid = 1;
+        attr.clockid = CLOCK_MONOTONIC;
+        attr.sample_max_stack = static_cast<uint16_t>(std::min<size_t>(options_.max_depth, 0xffff));
+        attr.watermark = 1;
+        attr.wakeup_watermark = static_cast<uint32_t>(options_.ring_pages * page_size_ / 4);
+        int fd = -1;
+        for (;;) {
+            bool is_kernel = is_kernel_.load(std::memory_order_relaxed);
+            attr.exclude_kernel = is_kernel ? 0 : 1;
+            attr.exclude_callchain_kernel = attr.exclude_kernel;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd >= 0 || !is_kernel || (errno != EACCES && errno != EPERM)) {
+                break;
+            }
+            is_kernel_.store(false, std::memory_order_relaxed);
+        }
+        if (fd < 0) {
+            return false;
+        }
+        ring->mmap_size = (options_.ring_pages + 1) * page_size_;
+        void* base = mmap(nullptr, ring->mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        ring->fd = fd;
+        ring->base = static_cast<uint8_t*>(base);
+        return true;
+    }
+
+    void close_rings() {
+        for (auto& ring : rings_) {
+            munmap(ring.base, ring.mmap_size);
+            close(ring.fd);
+        }
+        rings_.clear();
+    }
+
+    void read_loop() {
+        reader_tid_ = static_cast<pid_t>(syscall(SYS_gettid));
+        std::vector<struct pollfd> fds;
+        uint64_t last_scan_ns = get_monotonic_ns();
+        for (;;) {
+            fds.resize(rings_.size() + 1);
+            for (size_t i = 0; i < rings_.size(); ++i) {
+                fds[i].fd = rings_[i].fd;
+                fds[i].events = POLLIN;
+                fds[i].revents = 0;
+            }
+            fds.back().fd = stop_fd_;
+            fds.back().events = POLLIN;
+            fds.back().revents = 0;
+            int ret = poll(fds.data(), fds.size(), SCAN_INTERVAL_MS);
+            if (ret < 0 && errno != EINTR) {
+                break;
+            }
+            // 线程退出后事件一直处于 POLLHUP，读完剩余的样本后关闭，否则 poll 会立即返回
+            size_t keep = 0;
+            for (size_t i = 0; i < rings_.size(); ++i) {
+                drain(&rings_[i]);
+                if (fds[i].revents & POLLHUP) {
+                    munmap(rings_[i].base, rings_[i].mmap_size);
+                    close(rings_[i].fd);
+                } else {
+                    rings_[keep++] = rings_[i];
+                }
+            }
+            rings_.resize(keep);
+            if (fds.back().revents & POLLIN) {
+                break;
+            }
+            uint64_t now_ns = get_monotonic_ns();
+            if (options_.tid == 0 && now_ns - last_scan_ns >= SCAN_INTERVAL_MS * 1000000ULL) {
+                scan_threads();
+                last_scan_ns = now_ns;
+            }
+        }
+    }
+
+    /**
+     * @brief 读取 ring buffer 中的所有记录
+     *
+     * @param ring
+     */
+    void drain(ring_buffer* ring) {
+        struct perf_event_mmap_page* meta = reinterpret_cast<struct perf_event_mmap_page*>(ring->base);
+        const uint8_t* data = ring->base + page_size_;
+        uint64_t data_size = options_.ring_pages * page_size_;
+        uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+        while (tail < head) {
+            struct perf_event_header header;
+            copy_from_ring(data, data_size, tail, &header, sizeof(header));
+            if (header.size < sizeof(header) || tail + header.size > head) {
+                break;
+            }
+            // 记录可能跨过 ring buffer 的末尾，拷贝出来再解析
+            record_buffer_.resize(header.size);
+            copy_from_ring(data, data_size, tail, record_buffer_.data(), header.size);
+            if (header.type == PERF_RECORD_SAMPLE) {
+                parse_sample(record_buffer_.data() + sizeof(header), header.size - sizeof(header));
+            } else if (header.type == PERF_RECORD_LOST && header.size >= sizeof(header) + 16) {
+                uint64_t lost = 0;
+                memcpy(&lost, record_buffer_.data() + sizeof(header) + 8, sizeof(lost));
+                lost_count_.fetch_add(lost, std::memory_order_relaxed);
+            }
+            tail += header.size;
+        }
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    static void copy_from_ring(const uint8_t* data, uint64_t data_size, uint64_t pos, void* dst, size_t size) {
+        size_t offset = static_cast<size_t>(pos & (data_size - 1));
+        size_t first = std::min<size_t>(size, data_size - offset);
+        memcpy(dst, data + offset, first);
+        memcpy(static_cast<uint8_t*>(dst) + first, data, size - first);
+    }
+
+    /**
+     * @brief 解析 PERF_RECORD_SAMPLE：pid/tid、time、callchain，调用链中用上下文标记区分内核栈和用户栈
+     *
+     * @param p
+     * @param size
+     */
+    void parse_sample(const uint8_t* p, size_t size) {
+        if (size < 24) {
+            return;
+        }
+        PerfSample sample;
+        uint32_t ids[2];
+        memcpy(ids, p, sizeof(ids));
+        sample.pid_ = static_cast<pid_t>(ids[0]);
+        sample.tid_ = static_cast<pid_t>(ids[1]);
+        memcpy(&sample.time_ns_, p + 8, sizeof(uint64_t));
+        uint64_t nr = 0;
+        memcpy(&nr, p + 16, sizeof(nr));
+        if (nr > (size - 24) / sizeof(uint64_t)) {
+            return;
+        }
+        std::vector<uint64_t> chain(nr);
+        memcpy(chain.data(), p + 24, nr * sizeof(uint64_t));
+        std::vector<uint64_t>* frames = &sample.user_frames_;
+        for (uint64_t ip : chain) {
+            if (ip >= static_cast<uint64_t>(PERF_CONTEXT_MAX)) {
+                frames = (ip == static_cast<uint64_t>(PERF_CONTEXT_KERNEL)) ? &sample.kernel_frames_
+                    : (ip == static_cast<uint64_t>(PERF_CONTEXT_USER)) ? &sample.user_frames_ : nullptr;
+            } else if (frames != nullptr) {
+                frames->push_back(ip);
+            }
+        }
+        sample_count_.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // 聚合的 key 为原始调用链，保留了上下文标记
+            ++stacks_[chain];
+        }
+        if (callback_) {
+            callback_(sample);
+        }
+    }
+
+    /**
+     * @brief 解析聚合的栈，得到从根开始的栈帧名
+     *
+     * @param resolver
+     * @return std::vector<std::pair<std::vector<std::string>, uint64_t>>
+     */
+    std::vector<std::pair<std::vector<std::string>, uint64_t>> get_names(TraceResolver& resolver) {
+        std::unordered_map<std::vector<uint64_t>, uint64_t, callchain_hash> stacks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stacks = stacks_;
+        }
+        // 多个线程同时获取结果时只加载一次 kallsyms，之后只读
+        if (is_kernel_.load(std::memory_order_relaxed)) {
+            std::call_once(kernel_symbols_once_, [this]() { kernel_symbols_.load(); });
+        }
+        // 采样其他进程时按其映射离线解析
+        bool is_self = (pid_ == getpid());
+        OfflineUnwinder unwinder;
+        if (!is_self) {
+            std::vector<RemoteMapping> mappings;
+            RemoteStackCapture::read_mappings(pid_, &mappings);
+            unwinder.set_mappings(std::move(mappings));
+            unwinder.set_root_dir("/proc/" + std::to_string(pid_) + "/root");
+        }
+        std::unordered_map<uint64_t, std::string> user_names;
+        std::vector<std::pair<std::vector<std::string>, uint64_t>> result;
+        for (const auto& item : stacks) {
+            // 调用链是叶子在前，上下文标记之后的地址属于对应的栈
+            std::vector<std::pair<uint64_t, bool>> frames;
+            bool is_kernel_frame = false;
+            for (uint64_t ip : item.first) {
+                if (ip >= static_cast<uint64_t>(PERF_CONTEXT_MAX)) {
+                    is_kernel_frame = (ip == static_cast<uint64_t>(PERF_CONTEXT_KERNEL));
+                } else {
+                    frames.emplace_back(ip, is_kernel_frame);
+                }
+            }
+            std::vector<std::string> names;
+            for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame) {
+                uint64_t ip = frame->first;
+                if (frame->second) {
+                    names.push_back(kernel_symbols_.lookup(ip) + "_[k]");
+                    continue;
+                }
+                auto it = user_names.find(ip);
+                if (it == user_names.end()) {
+                    ResolvedTrace resolved_trace;
+                    if (is_self) {
+                        Trace trace;
+                        trace.addr_ = reinterpret_cast<void*>(ip);
+                        resolved_trace = resolver.resolve(trace);
+                    } else {
+                        resolved_trace = unwinder.resolve(std::vector<void*>(1, reinterpret_cast<void*>(ip)),
+                            resolver)[0];
+                    }
+                    it = user_names.emplace(ip, FlameGraph::get_frame_name(resolved_trace)).first;
+                }
+                names.push_back(it->second);
+            }
+            result.emplace_back(std::move(names), item.second);
+        }
+        return result;
+    }
+
+private:
+    PerfProfilerOptions options_;
+    size_t page_size_;
+    pid_t pid_{0};
+    // 读取线程发现新线程时可能因权限不足关闭内核调用链，其他线程同时在读
+    std::atomic<bool> is_kernel_{true};
+    bool is_running_{false};
+    std::vector<ring_buffer> rings_;
+    int stop_fd_{-1};
+    std::thread reader_thread_;
+    // 只在读取线程中使用
+    pid_t reader_tid_{0};
+    std::vector<uint8_t> record_buffer_;
+    sample_callback_t callback_;
+    std::atomic<uint64_t> sample_count_{0};
+    std::atomic<uint64_t> lost_count_{0};
+    std::mutex mutex_;
+    std::unordered_map<std::vector<uint64_t>, uint64_t, callchain_hash> stacks_;
+    KernelSymbols kernel_symbols_;
+    std::once_flag kernel_symbols_once_;
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // COLLECT_PERF_PROFILER_H_
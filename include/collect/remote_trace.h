@@ -0,0 +1,351 @@
+/**
+ * @file remote_trace.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_REMOTE_TRACE_H_
+#define COLLECT_REMOTE_TRACE_H_
+
+#if defined(__x86_64__)
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "collect/offline_unwind.h"
+#include "collect/resolver.h"
+#include "common/stats.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 其他进程中一个线程的栈帧地址
+ *
+ */
+struct RemoteThreadTrace {
+    pid_t tid{0};
+    std::string name;
+    UnwindRegisters regs;
+    std::vector<void*> frames;
+};
+
+/**
+ * @brief 从外部抓取其他进程所有线程的堆栈（pstack），目标进程只暂停毫秒级
+ *
+ * 用 PTRACE_SEIZE + PTRACE_INTERRUPT 停住所有线程，读取寄存器，用一次 process_vm_readv 拷贝每个线程栈顶的一段内存，
+ * 然后立即 detach。回溯和符号解析都在 detach 之后由 OfflineUnwinder 离线进行。
+ * 需要有 ptrace 目标进程的权限（同用户且 ptrace_scope 允许，或 CAP_SYS_PTRACE）
+ */
+class RemoteStackCapture {
+public:
+    // 每个线程拷贝的栈大小
+    static const size_t DEFAULT_STACK_WINDOW = 64 << 10;
+
+public:
+    explicit RemoteStackCapture(size_t stack_window = DEFAULT_STACK_WINDOW, size_t max_depth = 64)
+        : stack_window_(stack_window), unwinder_(max_depth) {}
+    ~RemoteStackCapture() = default;
+    RemoteStackCapture(const RemoteStackCapture&) = delete;
+    RemoteStackCapture& operator=(const RemoteStackCapture&) = delete;
+    RemoteStackCapture(RemoteStackCapture&&) = delete;
+    RemoteStackCapture& operator=(RemoteStackCapture&&) = delete;
+
+public:
+    /**
+     * @brief 抓取进程所有线程的栈帧地址
+     *
+     * @param pid
+     * @param traces
+     * @return true
+     * @return false 无法读取进程的映射或者无法 attach 任何线程，错误码通过 get_error 获取
+     */
+    bool capture(pid_t pid, std::vector<RemoteThreadTrace>* traces) {
+        traces->clear();
+        pid_ = pid;
+        pause_ns_ = 0;
+        error_ = 0;
+        // 映射和线程列表在停住进程之前读取，减少暂停时间
+        std::vector<RemoteMapping> mappings;
+        errno = 0;
+        if (!read_mappings(pid, &mappings)) {
+            error_ = errno != 0 ? errno : ESRCH;
+            return false;
+        }
+        // 目标进程可能在其他的 mount namespace 中
+        unwinder_.set_mappings(std::move(mappings));
+        unwinder_.set_root_dir("/proc/" + std::to_string(pid) + "/root");
+        std::vector<thread_snapshot> threads;
+        // 已经退出的线程返回 ESRCH，优先记录其他的失败原因（如 EPERM）
+        int seize_error = ESRCH;
+        for (pid_t tid : list_threads(pid)) {
+            if (ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) == 0) {
+                thread_snapshot thread;
+                thread.tid = tid;
+                threads.push_back(std::move(thread));
+            } else if (seize_error == ESRCH) {
+                seize_error = errno;
+            }
+        }
+        if (threads.empty()) {
+            error_ = seize_error;
+            return false;
+        }
+
+        uint64_t pause_begin_ns = get_monotonic_ns();
+        for (auto& thread : threads) {
+            ptrace(PTRACE_INTERRUPT, thread.tid, nullptr, nullptr);
+        }
+        for (auto& thread : threads) {
+            thread.is_stopped = wait_stopped(&thread);
+            if (thread.is_stopped) {
+                read_registers(&thread);
+            }
+        }
+        read_stacks(&threads);
+        for (auto& thread : threads) {
+            // 停住时截获的信号在 detach 时重新投递
+            ptrace(PTRACE_DETACH, thread.tid, nullptr,
+                reinterpret_cast<void*>(static_cast<uintptr_t>(thread.pending_signal)));
+        }
+        pause_ns_ = get_monotonic_ns() - pause_begin_ns;
+
+        for (const auto& thread : threads) {
+            if (!thread.is_stopped) {
+                continue;
+            }
+            RemoteThreadTrace trace;
+            trace.tid = thread.tid;
+            trace.name = read_thread_name(pid, thread.tid);
+            trace.regs = thread.regs;
+            unwinder_.unwind(thread.regs, thread.stack_begin, thread.stack.data(), thread.stack.size(), &trace.frames);
+            traces->push_back(std::move(trace));
+        }
+        return true;
+    }
+
+    /**
+     * @brief 解析 capture 得到的栈帧地址，需要在下一次 capture 之前调用
+     *
+     * @param trace
+     * @param resolver
+     * @return std::vector<ResolvedTrace>
+     */
+    std::vector<ResolvedTrace> resolve(const RemoteThreadTrace& trace, TraceResolver& resolver) {
+        return unwinder_.resolve(trace.frames, resolver);
+    }
+
+    /**
+     * @brief 获取上一次 capture 目标进程被暂停的时间
+     *
+     * @return uint64_t 纳秒
+     */
+    uint64_t get_pause_ns() const {
+        return pause_ns_;
+    }
+
+    /**
+     * @brief 获取上一次 capture 失败的原因
+     *
+     * @return int errno 的值，成功时为 0
+     */
+    int get_error() const {
+        return error_;
+    }
+
+    /**
+     * @brief 获取上一次 capture 时目标进程的映射
+     *
+     * @return const std::vector<RemoteMapping>&
+     */
+    const std::vector<RemoteMapping>& get_mappings() const {
+        return unwinder_.get_mappings();
+    }
+
+    /**
+     * @brief 读取 /proc/<pid>/maps
+     *
+     * @param pid
+     * @param mappings 按起始地址排序
+     * @return true
+     * @return false
+     */
+    static bool read_mappings(pid_t pid, std::vector<RemoteMapping>* mappings) {
+        mappings->clear();
+        std::ifstream ifs("/proc/" + std::to_string(pid) + "/maps");
+        if (!ifs) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(ifs, line)) {
+            unsigned long begin = 0, end = 0, offset = 0;  // NOLINT
+            char perms[8] = {0};
+            int path_pos = 0;
+            if (sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &begin, &end, perms, &offset, &path_pos) < 4) {
+                continue;
+            }
+            RemoteMapping mapping;
+            mapping.begin = begin;
+            mapping.end = end;
+            mapping.offset = offset;
+            mapping.is_exec = (strchr(perms, 'x') != nullptr);
+            if (path_pos > 0 && static_cast<size_t>(path_pos) < line.size()) {
+                mapping.path = line.substr(static_cast<size_t>(path_pos));
+            }
+            mappings->push_back(std::move(mapping));
+        }
+        return !mappings->empty();
+    }
+
+    /**
+     * @brief 列出进程的所有线程
+     *
+     * @param pid
+     * @return std::vector<pid_t>
+     */
+    static std::vector<pid_t> list_threads(pid_t pid) {
+        std::vector<pid_t> tids;
+        std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+        DIR* dir = opendir(task_dir.c_str());
+        if (dir == nullptr) {
+            return tids;
+        }
+        while (struct dirent* entry = readdir(dir)) {
+            pid_t tid = static_cast<pid_t>(atoi(entry->d_name));
+            if (tid > 0) {
+                tids.push_back(tid);
+            }
+        }
+        closedir(dir);
+        std::sort(tids.begin(), tids.end());
+        return tids;
+    }
+
+private:
+    struct thread_snapshot {
+        pid_t tid{0};
+        bool is_stopped{false};
+        // 停住时截获的信号，detach 时需要重新投递
+        int pending_signal{0};
+        UnwindRegisters regs;
+        // 拷贝出来的栈内存及其在目标进程中的起始地址
+        uintptr_t stack_begin{0};
+        std::vector<uint8_t> stack;
+    };
+
+    /**
+     * @brief 等待线程进入 ptrace 停止状态
+     *
+     * @param thread
+     * @return true
+     * @return false 线程已经退出
+     */
+    static bool wait_stopped(thread_snapshot* thread) {
+        int status = 0;
+        for (;;) {
+            pid_t ret = waitpid(thread->tid, &status, __WALL);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0 || !WIFSTOPPED(status)) {
+                return false;
+            }
+            // PTRACE_INTERRUPT 产生的是 PTRACE_EVENT_STOP，其他情况是信号投递前的停止
+            if ((status >> 16) != PTRACE_EVENT_STOP) {
+                thread->pending_signal = WSTOPSIG(status);
+            }
+            return true;
+        }
+    }
+
+    static void read_registers(thread_snapshot* thread) {
+        struct user_regs_struct regs;
+        if (ptrace(PTRACE_GETREGS, thread->tid, nullptr, &regs) != 0) {
+            thread->is_stopped = false;
+            return;
+        }
+        thread->regs.rip = static_cast<uintptr_t>(regs.rip);
+        thread->regs.rsp = static_cast<uintptr_t>(regs.rsp);
+        thread->regs.rbp = static_cast<uintptr_t>(regs.rbp);
+    }
+
+    /**
+     * @brief 用尽量少的 process_vm_readv 拷贝所有线程栈顶的内存，窗口不超出栈所在的映射
+     *
+     * @param threads
+     */
+    void read_stacks(std::vector<thread_snapshot>* threads) {
+        std::vector<struct iovec> local_iov;
+        std::vector<struct iovec> remote_iov;
+        std::vector<thread_snapshot*> iov_threads;
+        for (auto& thread : *threads) {
+            const RemoteMapping* mapping = thread.is_stopped ? unwinder_.find_mapping(thread.regs.rsp) : nullptr;
+            if (mapping == nullptr) {
+                continue;
+            }
+            thread.stack_begin = thread.regs.rsp & ~static_cast<uintptr_t>(sizeof(uintptr_t) - 1);
+            thread.stack.resize(std::min<uintptr_t>(stack_window_, mapping->end - thread.stack_begin));
+            struct iovec local, remote;
+            local.iov_base = thread.stack.data();
+            local.iov_len = thread.stack.size();
+            remote.iov_base = reinterpret_cast<void*>(thread.stack_begin);
+            remote.iov_len = thread.stack.size();
+            local_iov.push_back(local);
+            remote_iov.push_back(remote);
+            iov_threads.push_back(&thread);
+        }
+        for (size_t begin = 0; begin < local_iov.size(); begin += IOV_MAX) {
+            size_t count = std::min<size_t>(IOV_MAX, local_iov.size() - begin);
+            ssize_t expected = 0;
+            for (size_t i = begin; i < begin + count; ++i) {
+                expected += static_cast<ssize_t>(local_iov[i].iov_len);
+            }
+            ssize_t ret = process_vm_readv(pid_, &local_iov[begin], count, &remote_iov[begin], count, 0);
+            if (ret == expected) {
+                continue;
+            }
+            // 部分失败时 process_vm_readv 不会告知是哪一段，逐个重新读取
+            for (size_t i = begin; i < begin + count; ++i) {
+                ssize_t len = process_vm_readv(pid_, &local_iov[i], 1, &remote_iov[i], 1, 0);
+                iov_threads[i]->stack.resize(len > 0 ? static_cast<size_t>(len) : 0);
+            }
+        }
+    }
+
+    static std::string read_thread_name(pid_t pid, pid_t tid) {
+        std::string name;
+        std::ifstream ifs("/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/comm");
+        std::getline(ifs, name);
+        return name;
+    }
+
+private:
+    size_t stack_window_;
+    pid_t pid_{0};
+    uint64_t pause_ns_{0};
+    int error_{0};
+    OfflineUnwinder unwinder_;
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // COLLECT_REMOTE_TRACE_H_
@@ -13,12 +13,16 @@
 #define COLLECT_RESOLVER_BASE_H_
 
 #include <dlfcn.h>
+#include <link.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string>
 #include <vector>
 #include <utility>
 #include <fstream>
+#include <unordered_map>
+#include "collect/trace_types.h"
+#include "common/stats.h"
 #include "common/utils.h"
 
 namespace stack_trace {
@@ -45,6 +49,10 @@ struct ResolvedTrace : public Trace {
     };
     std::string object_filename_;
     std::string object_function_;
+    // 模块的加载偏移，addr_ 减去它即为 ELF 中的虚拟地址
+    void* object_base_{nullptr};
+    // 是否找到了地址所在的模块，非 PIE 的主程序加载偏移为 0，不能用 object_base_ 判断
+    bool is_object_found_{false};
     SourceLoc source_loc_;
 };
 
@@ -73,6 +81,24 @@ public:
         return ResolvedTrace();
     }
 
+    /**
+     * @brief 设置栈帧的解析程度
+     *
+     * @param level
+     */
+    void set_resolve_level(ResolveLevel level) {
+        resolve_level_ = level;
+    }
+
+    /**
+     * @brief 获取栈帧的解析程度
+     *
+     * @return ResolveLevel
+     */
+    ResolveLevel get_resolve_level() const {
+        return resolve_level_;
+    }
+
 public:
     template <class ST>
     void load_stacktrace(const ST& st) {
@@ -95,6 +121,47 @@ public:
     }
 
 protected:
+    /**
+     * @brief 查找地址所在的模块，只遍历已加载模块的程序头，不查符号表
+     *
+     * @param addr
+     * @param object_filename 模块的文件路径
+     * @param load_bias 模块的加载偏移
+     * @return true
+     * @return false
+     */
+    bool find_object(const void* addr, std::string* object_filename, void** load_bias) const {
+        find_object_context context;
+        context.addr = reinterpret_cast<uintptr_t>(addr);
+        if (dl_iterate_phdr(&find_object_callback, &context) == 0) {
+            return false;
+        }
+        // 主程序的 dlpi_name 为空
+        *object_filename = (context.filename == nullptr || *context.filename == '\0') ? exec_path_ : context.filename;
+        *load_bias = reinterpret_cast<void*>(context.load_bias);
+        return true;
+    }
+
+    /**
+     * @brief 获取模块的统计计数器，关闭统计时返回 nullptr
+     *
+     * @param base_addr 模块的基址，用作本地缓存的 key，避免每次都按文件名查找
+     * @param object_filename
+     * @return ObjectCounters*
+     */
+    ObjectCounters* get_object_counters(void* base_addr, const std::string& object_filename) {
+        if (!StatsRegistry::instance().is_enabled()) {
+            return nullptr;
+        }
+        auto it = object_counters_map_.find(base_addr);
+        if (it != object_counters_map_.end()) {
+            return it->second;
+        }
+        ObjectCounters* counters = StatsRegistry::instance().get_object_counters(object_filename);
+        object_counters_map_[base_addr] = counters;
+        return counters;
+    }
+
     /**
      * @brief 解析符号名
      * 
@@ -106,6 +173,26 @@ protected:
     }
 
 private:
+    struct find_object_context {
+        uintptr_t addr{0};
+        uintptr_t load_bias{0};
+        const char* filename{nullptr};
+    };
+
+    static int find_object_callback(struct dl_phdr_info* info, size_t, void* data) {
+        find_object_context* context = static_cast<find_object_context*>(data);
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+            uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+            if (phdr.p_type == PT_LOAD && context->addr >= start && context->addr < start + phdr.p_memsz) {
+                context->load_bias = info->dlpi_addr;
+                context->filename = info->dlpi_name;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
     /**
      * @brief 获取当前进程的启动命令
      * 
@@ -145,6 +232,8 @@ private:
 private:
     std::string argv0_;
     std::string exec_path_;
+    ResolveLevel resolve_level_{ResolveLevel::FULL};
+    std::unordered_map<void*, ObjectCounters*> object_counters_map_;
 };
 
 }  // namespace stack_trace
@@ -24,17 +24,43 @@
 #include <dlfcn.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <utility>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <mutex>
 #include <unordered_map>
 #include "collect/resolver_base.h"
+#include "collect/debug_file.h"
+#include "collect/symbol_cache.h"
+
+// binutils 2.42 起 bfd 在设置了锁之后才是线程安全的，更早的版本没有这个函数，弱引用为 nullptr
+extern "C" bool bfd_thread_init(bool (*lock)(void*), bool (*unlock)(void*), void* data) __attribute__((weak));
 
 namespace stack_trace {
 
+/**
+ * @brief 已打开 ELF 文件的缓存限制
+ *
+ */
+struct ObjectCacheOptions {
+    // 缓存的 ELF 文件占用内存的上限（以符号表和函数索引的大小计算），0 表示不限制
+    size_t max_bytes{256 << 20};
+    // 缓存的 ELF 文件占用文件描述符的上限，0 表示不限制
+    size_t max_fds{64};
+    // 加载失败的 ELF 文件在这段时间内不再重试，过期后记录被删除
+    std::chrono::milliseconds negative_ttl{std::chrono::seconds(60)};
+    // 最多保留的加载失败记录，超出时删除最早失败的，0 表示不限制
+    size_t max_failed{256};
+};
+
 /**
  * @brief 使用 BFD 进行函数解析
  * 
@@ -43,11 +69,34 @@ class BFDTraceResolver : public TraceResolverImplBase {
 public:
     typedef utils::handle<bfd *, utils::deleter<bfd_boolean, bfd*, &bfd_close>> bfd_handle_t;
     typedef utils::handle<asymbol **> bfd_symtab_t;
+    struct function_symbol {
+        bfd_vma addr;
+        bfd_vma end;
+        const char* name;
+    };
     struct bfd_file_object {
         bfd_handle_t handle;
         bfd_vma base_addr;
         bfd_symtab_t symtab;
         bfd_symtab_t dynamic_symtab;
+        // 分离的调试信息文件，行号和函数名优先从这里解析
+        bfd_handle_t debug_handle;
+        bfd_symtab_t debug_symtab;
+        std::string build_id;
+        // 按地址排序的函数符号，SYMBOL 级别解析时按需构建
+        std::vector<function_symbol> functions;
+        bool is_function_index_built{false};
+        // 符号表占用的内存
+        size_t symtab_bytes{0};
+        ObjectCounters* counters{nullptr};
+        // 计入缓存的内存和文件描述符
+        size_t cache_bytes{0};
+        size_t cache_fds{0};
+        // 加载失败的时间，为 0 表示加载成功
+        uint64_t failed_time_ns{0};
+        std::list<std::string>::iterator lru_pos;
+        // 在加载失败列表中的位置，只在加载失败时有效
+        std::list<std::string>::iterator failed_pos;
     };
     struct find_sym_result {
         bool found;
@@ -62,10 +111,19 @@ public:
         void *base_addr;
         find_sym_result result;
     };
+    struct loaded_module {
+        std::string build_id;
+        uintptr_t load_bias;
+    };
 
 public:
     BFDTraceResolver() = default;
-    ~BFDTraceResolver() = default;
+    ~BFDTraceResolver() {
+        symbol_cache_.flush();
+        while (!file_obj_bfd_map_.empty()) {
+            evict_object(file_obj_bfd_map_.begin(), false);
+        }
+    }
     BFDTraceResolver(const BFDTraceResolver&) = delete;
     BFDTraceResolver& operator=(const BFDTraceResolver&) = delete;
     BFDTraceResolver(BFDTraceResolver&&) = delete;
@@ -73,9 +131,57 @@ public:
 
 public:
     ResolvedTrace resolve(const Trace& trace) override {
+        ResolvedTrace resolved_trace = resolve_trace(trace);
+        // 解析完成后 ELF 文件不再被使用，此时按 LRU 淘汰超出限制的部分
+        trim_object_cache();
+        return resolved_trace;
+    }
+
+    /**
+     * @brief 设置已打开 ELF 文件的缓存限制
+     *
+     * @param options
+     */
+    void set_object_cache_options(const ObjectCacheOptions& options) {
+        object_cache_options_ = options;
+        trim_object_cache();
+    }
+
+    /**
+     * @brief 获取已打开 ELF 文件的缓存限制
+     *
+     * @return const ObjectCacheOptions&
+     */
+    const ObjectCacheOptions& get_object_cache_options() const {
+        return object_cache_options_;
+    }
+
+    /**
+     * @brief 清空已打开 ELF 文件的缓存，释放所有的 bfd 和符号表
+     *
+     */
+    void clear_object_cache() {
+        while (!file_obj_bfd_map_.empty()) {
+            evict_object(file_obj_bfd_map_.begin(), false);
+        }
+    }
+
+private:
+    /**
+     * @brief 解析单个栈帧
+     *
+     * @param trace
+     * @return ResolvedTrace
+     */
+    ResolvedTrace resolve_trace(const Trace& trace) {
         ResolvedTrace resolved_trace;
         resolved_trace.addr_ = trace.addr_;
         resolved_trace.idx_ = trace.idx_;
+        if (get_resolve_level() == ResolveLevel::RAW) {
+            resolved_trace.is_object_found_ = find_object(trace.addr_, &resolved_trace.object_filename_,
+                &resolved_trace.object_base_);
+            return resolved_trace;
+        }
         Dl_info symbol_info;
         if (!dladdr(trace.addr_, &symbol_info)) {
             return resolved_trace;
@@ -87,107 +193,693 @@ public:
             return resolved_trace;
         }
         resolved_trace.object_filename_ = resolve_exec_path(&symbol_info);
-        bfd_file_object* file_obj;
-        struct stat obj_stat;
-        struct stat dli_stat;
-        if (stat(resolved_trace.object_filename_.c_str(), &obj_stat) == 0
-            && stat(symbol_info.dli_fname, &dli_stat) == 0
-            && obj_stat.st_ino == dli_stat.st_ino) {
-            file_obj = load_object_with_bfd(resolved_trace.object_filename_);
-        } else {
-            file_obj = nullptr;
+        ObjectCounters* counters = get_object_counters(symbol_info.dli_fbase, resolved_trace.object_filename_);
+        ObjectCounters::add(counters, &ObjectCounters::dladdr_calls_);
+        if (get_resolve_level() == ResolveLevel::SYMBOL) {
+            resolve_symbol(symbol_info, counters, &resolved_trace);
+            fill_object_base(&resolved_trace);
+            return resolved_trace;
         }
-        if (file_obj == nullptr || !file_obj->handle) {
-            file_obj = load_object_with_bfd(symbol_info.dli_fname);
-            if (!file_obj->handle) {
+        const loaded_module* module = nullptr;
+        if (symbol_cache_.is_enabled()) {
+            module = find_loaded_module(symbol_info.dli_fbase, trace.addr_);
+            if (find_in_symbol_cache(module, symbol_info, &resolved_trace)) {
+                ObjectCounters::add(counters, &ObjectCounters::symbol_cache_hits_);
                 return resolved_trace;
             }
+            ObjectCounters::add(counters, &ObjectCounters::symbol_cache_misses_);
+        }
+        bfd_file_object* file_obj = load_object(resolved_trace.object_filename_, symbol_info, counters);
+        if (file_obj == nullptr) {
+            fill_object_base(&resolved_trace);
+            return resolved_trace;
+        }
+        if (fill_source_loc(file_obj, trace.addr_, symbol_info.dli_fbase, &resolved_trace) && module != nullptr) {
+            symbol_cache_.add_line(module->build_id, uintptr_t(trace.addr_) - module->load_bias,
+                resolved_trace.source_loc_.function_, resolved_trace.source_loc_.filename_,
+                resolved_trace.source_loc_.line_,
+                resolved_trace.addr_ != trace.addr_ ? CachedSymbol::FLAG_ADJUSTED_CALL_SITE : 0);
         }
+        fill_object_base(&resolved_trace);
+        return resolved_trace;
+    }
+
+    /**
+     * @brief 用 DWARF 解析文件名和行号，返回地址减 1（call 指令内）也能解析时优先使用减 1 后的结果
+     *
+     * @param file_obj
+     * @param addr
+     * @param base_addr 模块的加载偏移
+     * @param resolved_trace
+     * @return true
+     * @return false
+     */
+    bool fill_source_loc(bfd_file_object* file_obj, void* addr, void* base_addr, ResolvedTrace* resolved_trace) {
         find_sym_result* details_selected;
-        find_sym_result details_call_site = find_symbol_details(file_obj, trace.addr_, symbol_info.dli_fbase);
+        find_sym_result details_call_site = find_symbol_details(file_obj, addr, base_addr);
         details_selected = &details_call_site;
 
         find_sym_result details_adjusted_call_site = find_symbol_details(
-            file_obj, reinterpret_cast<void*>(uintptr_t(trace.addr_)-1), symbol_info.dli_fbase);
+            file_obj, reinterpret_cast<void*>(uintptr_t(addr)-1), base_addr);
         if (details_call_site.found && details_adjusted_call_site.found) {
             details_selected = &details_adjusted_call_site;
-            resolved_trace.addr_ = reinterpret_cast<void*>(uintptr_t(trace.addr_)-1);
+            resolved_trace->addr_ = reinterpret_cast<void*>(uintptr_t(addr)-1);
         }
         if (details_selected == &details_call_site && details_call_site.found) {
-            details_call_site = find_symbol_details(file_obj, resolved_trace.addr_, symbol_info.dli_fbase);
+            details_call_site = find_symbol_details(file_obj, resolved_trace->addr_, base_addr);
         }
 
-        if (details_selected->found) {
-            if (details_selected->filename) {
-                resolved_trace.source_loc_.filename_ = details_selected->filename;
+        if (!details_selected->found) {
+            return false;
+        }
+        if (details_selected->filename) {
+            resolved_trace->source_loc_.filename_ = details_selected->filename;
+        }
+        resolved_trace->source_loc_.line_ = details_selected->line;
+        if (details_selected->funcname) {
+            resolved_trace->source_loc_.function_ = demangle(details_selected->funcname);
+            if (resolved_trace->object_function_.empty()) {
+                resolved_trace->object_function_ = resolved_trace->source_loc_.function_;
             }
-            resolved_trace.source_loc_.line_ = details_selected->line;
-            if (details_selected->funcname) {
-                resolved_trace.source_loc_.function_ = demangle(details_selected->funcname);
-                if (!symbol_info.dli_sname) {
-                    resolved_trace.object_function_ = resolved_trace.source_loc_.function_;
+        }
+        return true;
+    }
+
+public:
+    /**
+     * @brief 解析指定 ELF 文件中的地址，不依赖 dladdr，可用于解析其他进程或离线的地址
+     *
+     * @param object_filename ELF 文件的路径
+     * @param addr 地址，第一个之外的栈帧为返回地址
+     * @param load_bias 模块的加载偏移，addr 减去它即为 ELF 中的虚拟地址
+     * @return ResolvedTrace
+     */
+    ResolvedTrace resolve_in_object(const std::string& object_filename, void* addr, void* load_bias) {
+        ResolvedTrace resolved_trace;
+        resolved_trace.addr_ = addr;
+        resolved_trace.object_filename_ = object_filename;
+        resolved_trace.object_base_ = load_bias;
+        resolved_trace.is_object_found_ = true;
+        if (get_resolve_level() == ResolveLevel::RAW) {
+            return resolved_trace;
+        }
+        StatsRegistry& stats = StatsRegistry::instance();
+        ObjectCounters* counters = stats.is_enabled() ? stats.get_object_counters(object_filename) : nullptr;
+        bfd_file_object* file_obj = load_object_with_bfd(object_filename, counters);
+        if (file_obj->handle) {
+            if (get_resolve_level() == ResolveLevel::FULL) {
+                fill_source_loc(file_obj, addr, load_bias, &resolved_trace);
+            }
+            if (resolved_trace.object_function_.empty()) {
+                const char* function = find_function_in_index(file_obj, uintptr_t(addr) - uintptr_t(load_bias));
+                if (function != nullptr) {
+                    resolved_trace.object_function_ = demangle(function);
                 }
             }
         }
+        trim_object_cache();
         return resolved_trace;
     }
 
+    /**
+     * @brief 获取调试文件的查找器，可用于配置调试文件的搜索根目录
+     *
+     * @return DebugFileLocator&
+     */
+    DebugFileLocator& get_debug_file_locator() {
+        return debug_file_locator_;
+    }
+
+    /**
+     * @brief 获取持久化的符号索引缓存，可用于设置缓存目录、主动写入缓存文件
+     *
+     * @return SymbolCache&
+     */
+    SymbolCache& get_symbol_cache() {
+        return symbol_cache_;
+    }
+
+    /**
+     * @brief 把还没有写入的已解析地址写入持久化的符号索引，如进程退出前（_exit 不会析构解析器）
+     *
+     */
+    void flush_symbol_cache() {
+        symbol_cache_.flush();
+    }
+
 private:
+    /**
+     * @brief 函数名解析失败时，记录模块的加载偏移，用于输出模块内的偏移
+     *
+     * @param resolved_trace
+     */
+    void fill_object_base(ResolvedTrace* resolved_trace) const {
+        if (resolved_trace->object_function_.empty()) {
+            std::string object_filename;
+            resolved_trace->is_object_found_ = find_object(resolved_trace->addr_, &object_filename,
+                &resolved_trace->object_base_);
+        }
+    }
+
+    /**
+     * @brief 加载地址所在的 ELF 文件
+     *
+     * @param object_filename
+     * @param symbol_info
+     * @param counters
+     * @return bfd_file_object* 加载失败时返回 nullptr
+     */
+    bfd_file_object* load_object(const std::string& object_filename, const Dl_info& symbol_info,
+        ObjectCounters* counters) {
+        bfd_file_object* file_obj;
+        struct stat obj_stat;
+        struct stat dli_stat;
+        bool is_same_file = false;
+        ObjectCounters::add(counters, &ObjectCounters::stat_calls_);
+        if (stat(object_filename.c_str(), &obj_stat) == 0) {
+            ObjectCounters::add(counters, &ObjectCounters::stat_calls_);
+            is_same_file = stat(symbol_info.dli_fname, &dli_stat) == 0 && obj_stat.st_ino == dli_stat.st_ino;
+        }
+        if (is_same_file) {
+            file_obj = load_object_with_bfd(object_filename, counters);
+        } else {
+            file_obj = nullptr;
+        }
+        if (file_obj == nullptr || !file_obj->handle) {
+            file_obj = load_object_with_bfd(symbol_info.dli_fname, counters);
+            if (!file_obj->handle) {
+                return nullptr;
+            }
+        }
+        return file_obj;
+    }
+
+    /**
+     * @brief 只使用符号表解析函数名，dladdr 找不到时（比如 static 函数不在 .dynsym 中）再查 .symtab，不读取 DWARF
+     *
+     * @param symbol_info
+     * @param counters
+     * @param resolved_trace
+     */
+    void resolve_symbol(const Dl_info& symbol_info, ObjectCounters* counters, ResolvedTrace* resolved_trace) {
+        if (!resolved_trace->object_function_.empty()) {
+            return;
+        }
+        const loaded_module* module = find_loaded_module(symbol_info.dli_fbase, resolved_trace->addr_);
+        bfd_vma addr = uintptr_t(resolved_trace->addr_) - module->load_bias;
+        const char* function = symbol_cache_.find_function(module->build_id, addr);
+        if (function != nullptr) {
+            ObjectCounters::add(counters, &ObjectCounters::symbol_cache_hits_);
+            resolved_trace->object_function_ = function;
+            return;
+        }
+        if (symbol_cache_.is_enabled()) {
+            ObjectCounters::add(counters, &ObjectCounters::symbol_cache_misses_);
+        }
+        bfd_file_object* file_obj = load_object(resolved_trace->object_filename_, symbol_info, counters);
+        if (file_obj == nullptr) {
+            return;
+        }
+        const char* function_name = find_function_in_index(file_obj, addr);
+        if (function_name != nullptr) {
+            resolved_trace->object_function_ = demangle(function_name);
+        }
+    }
+
+    /**
+     * @brief 在按地址排序的函数符号中查找地址所在的函数
+     *
+     * @param file_obj
+     * @param addr ELF 中的虚拟地址
+     * @return const char* 找不到时返回 nullptr
+     */
+    const char* find_function_in_index(bfd_file_object* file_obj, bfd_vma addr) {
+        build_function_index(file_obj);
+        auto it = std::upper_bound(file_obj->functions.begin(), file_obj->functions.end(), addr,
+            [](bfd_vma value, const function_symbol& function) { return value < function.addr; });
+        if (it == file_obj->functions.begin()) {
+            return nullptr;
+        }
+        --it;
+        return addr < it->end ? it->name : nullptr;
+    }
+
+    /**
+     * @brief 获取地址所在的已加载模块的 build-id 和加载偏移，没有 build-id 的模块也有正确的加载偏移，
+     * 只是 build-id 为空，不使用持久化的符号索引
+     *
+     * @param base_addr dladdr 返回的模块基址，用作缓存的 key
+     * @param addr
+     * @return const loaded_module*
+     */
+    const loaded_module* find_loaded_module(void* base_addr, void* addr) {
+        auto it = loaded_module_map_.find(base_addr);
+        if (it != loaded_module_map_.end()) {
+            return &it->second;
+        }
+        loaded_module& module = loaded_module_map_[base_addr];
+        module.load_bias = 0;
+        SymbolCache::find_loaded_module(addr, &module.build_id, &module.load_bias);
+        return &module;
+    }
+
+    /**
+     * @brief 从持久化的符号索引中查找已解析过的地址
+     *
+     * @param module
+     * @param symbol_info
+     * @param resolved_trace
+     * @return true
+     * @return false
+     */
+    bool find_in_symbol_cache(const loaded_module* module, const Dl_info& symbol_info,
+        ResolvedTrace* resolved_trace) {
+        CachedSymbol cached;
+        if (!symbol_cache_.find_line(module->build_id,
+            uintptr_t(resolved_trace->addr_) - module->load_bias, &cached)) {
+            return false;
+        }
+        if (cached.flags_ & CachedSymbol::FLAG_ADJUSTED_CALL_SITE) {
+            resolved_trace->addr_ = reinterpret_cast<void*>(uintptr_t(resolved_trace->addr_)-1);
+        }
+        resolved_trace->source_loc_.function_ = cached.function_;
+        resolved_trace->source_loc_.filename_ = cached.filename_;
+        resolved_trace->source_loc_.line_ = cached.line_;
+        if (!symbol_info.dli_sname) {
+            resolved_trace->object_function_ = resolved_trace->source_loc_.function_;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 从符号表中收集函数的地址范围，写入持久化的符号索引
+     *
+     * @param file_obj
+     */
+    void add_function_ranges(bfd_file_object* file_obj) {
+        build_function_index(file_obj);
+        std::vector<SymbolCache::FunctionRange> ranges;
+        ranges.reserve(file_obj->functions.size());
+        for (const auto& function : file_obj->functions) {
+            SymbolCache::FunctionRange range;
+            range.addr_ = function.addr;
+            range.size_ = function.end - function.addr;
+            range.function_ = demangle(function.name);
+            ranges.push_back(std::move(range));
+        }
+        symbol_cache_.add_function_ranges(file_obj->build_id, std::move(ranges));
+    }
+
+    /**
+     * @brief 从符号表中收集函数的地址范围，按地址排序
+     *
+     * @param file_obj
+     */
+    void build_function_index(bfd_file_object* file_obj) {
+        if (file_obj->is_function_index_built) {
+            return;
+        }
+        file_obj->is_function_index_built = true;
+        bfd* abfd = file_obj->debug_handle ? file_obj->debug_handle.get() : file_obj->handle.get();
+        asymbol** symtab = file_obj->debug_handle ? file_obj->debug_symtab.get()
+            : (file_obj->symtab ? file_obj->symtab.get() : file_obj->dynamic_symtab.get());
+        if (symtab == nullptr) {
+            return;
+        }
+        std::vector<function_symbol> functions;
+        // bfd 返回的符号表以 nullptr 结尾，end 暂存所在段的结束地址
+        for (asymbol** sym = symtab; *sym != nullptr; ++sym) {
+            asection* section = (*sym)->section;
+            if (((*sym)->flags & BSF_FUNCTION) == 0 || section == nullptr
+                || (bfd_get_section_flags(abfd, section) & SEC_ALLOC) == 0) {
+                continue;
+            }
+            function_symbol function;
+            function.addr = bfd_asymbol_value(*sym);
+            function.end = bfd_get_section_vma(abfd, section) + bfd_get_section_size(section);
+            function.name = bfd_asymbol_name(*sym);
+            functions.push_back(function);
+        }
+        std::sort(functions.begin(), functions.end(),
+            [](const function_symbol& a, const function_symbol& b) { return a.addr < b.addr; });
+
+        // 符号表中没有通用的函数大小，以下一个函数的起始地址作为结束
+        for (size_t i = 0; i < functions.size(); ++i) {
+            if (i > 0 && functions[i].addr == functions[i-1].addr) {
+                continue;
+            }
+            function_symbol function = functions[i];
+            for (size_t j = i + 1; j < functions.size(); ++j) {
+                if (functions[j].addr != function.addr) {
+                    function.end = std::min(function.end, functions[j].addr);
+                    break;
+                }
+            }
+            if (function.end > function.addr) {
+                file_obj->functions.push_back(function);
+            }
+        }
+        update_cache_bytes(file_obj);
+    }
+
     /**
      * @brief 获取符号所在文件信息
      * 
      * @param filename_object 
+     * @param counters
      * @return bfd_file_object* 
      */
-    bfd_file_object* load_object_with_bfd(const std::string& filename_object) {
-        if (!is_bfd_loaded_) {
-            bfd_init();
-            is_bfd_loaded_ = true;
-        }
-
+    bfd_file_object* load_object_with_bfd(const std::string& filename_object, ObjectCounters* counters) {
         auto it = file_obj_bfd_map_.find(filename_object);
         if (it != file_obj_bfd_map_.end()) {
-            return &it->second;
+            bfd_file_object* file_obj = &it->second;
+            // 加载失败的记录超过有效期后重新加载
+            if (file_obj->failed_time_ns == 0
+                || get_monotonic_ns() - file_obj->failed_time_ns < get_negative_ttl_ns()) {
+                ObjectCounters::add(counters, &ObjectCounters::object_cache_hits_);
+                lru_list_.splice(lru_list_.begin(), lru_list_, file_obj->lru_pos);
+                return file_obj;
+            }
+            evict_object(it, false);
         }
+        ObjectCounters::add(counters, &ObjectCounters::object_cache_misses_);
         bfd_file_object *r = &file_obj_bfd_map_[filename_object];
+        lru_list_.push_front(filename_object);
+        r->lru_pos = lru_list_.begin();
 
-        bfd_handle_t bfd_handle;
-        int fd = open(filename_object.c_str(), O_RDONLY);
-        bfd_handle.reset(bfd_fdopenr(filename_object.c_str(), "default", fd));
-        if (!bfd_handle) {
-            close(fd);
-            return r;
+        std::lock_guard<std::mutex> lock(get_load_mutex());
+        uint64_t load_begin_ns = get_monotonic_ns();
+        load_file_object(filename_object, r);
+        if (!r->handle) {
+            r->failed_time_ns = get_monotonic_ns();
+            failed_list_.push_back(filename_object);
+            r->failed_pos = std::prev(failed_list_.end());
         }
-        if (!bfd_check_format(bfd_handle.get(), bfd_object)) {
-            return r;
+        r->cache_fds = (r->handle ? 1 : 0) + (r->debug_handle ? 1 : 0);
+        cache_fds_ += r->cache_fds;
+        update_cache_bytes(r);
+        if (counters != nullptr) {
+            r->counters = counters;
+            ObjectCounters::add(counters, &ObjectCounters::load_time_ns_, get_monotonic_ns() - load_begin_ns);
+            counters->symtab_bytes_.fetch_add(static_cast<int64_t>(r->symtab_bytes), std::memory_order_relaxed);
+        }
+        return r;
+    }
+
+    /**
+     * @brief 重新计算 ELF 文件计入缓存的内存
+     *
+     * @param file_obj
+     */
+    void update_cache_bytes(bfd_file_object* file_obj) {
+        size_t bytes = file_obj->symtab_bytes + file_obj->functions.capacity() * sizeof(function_symbol);
+        cache_bytes_ = cache_bytes_ - file_obj->cache_bytes + bytes;
+        file_obj->cache_bytes = bytes;
+    }
+
+    /**
+     * @brief 按 LRU 淘汰 ELF 文件，直到满足缓存限制；删除过期和超出个数的加载失败记录
+     *
+     */
+    void trim_object_cache() {
+        while (!lru_list_.empty()
+            && ((object_cache_options_.max_bytes != 0 && cache_bytes_ > object_cache_options_.max_bytes)
+            || (object_cache_options_.max_fds != 0 && cache_fds_ > object_cache_options_.max_fds))) {
+            evict_object(file_obj_bfd_map_.find(lru_list_.back()), true);
         }
-        if ((bfd_get_file_flags(bfd_handle.get()) & HAS_SYMS) == 0) {
-            return r;
+        // 失败列表按失败时间排序，只需要检查队头
+        uint64_t now_ns = failed_list_.empty() ? 0 : get_monotonic_ns();
+        while (!failed_list_.empty()) {
+            auto it = file_obj_bfd_map_.find(failed_list_.front());
+            bool is_expired = now_ns - it->second.failed_time_ns >= get_negative_ttl_ns();
+            bool is_over_limit = object_cache_options_.max_failed != 0
+                && failed_list_.size() > object_cache_options_.max_failed;
+            if (!is_expired && !is_over_limit) {
+                break;
+            }
+            evict_object(it, is_over_limit);
+        }
+    }
+
+    uint64_t get_negative_ttl_ns() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            object_cache_options_.negative_ttl).count());
+    }
+
+    /**
+     * @brief 关闭 ELF 文件并释放符号表
+     *
+     * @param it
+     * @param is_eviction 是否是因为超出缓存限制而淘汰
+     */
+    void evict_object(std::unordered_map<std::string, bfd_file_object>::iterator it, bool is_eviction) {
+        bfd_file_object& file_obj = it->second;
+        if (file_obj.counters != nullptr) {
+            file_obj.counters->symtab_bytes_.fetch_sub(
+                static_cast<int64_t>(file_obj.symtab_bytes), std::memory_order_relaxed);
+            if (is_eviction) {
+                ObjectCounters::add(file_obj.counters, &ObjectCounters::object_evictions_);
+            }
         }
-        ssize_t symtab_storage_size = bfd_get_symtab_upper_bound(bfd_handle.get());
-        ssize_t dyn_symtab_storage_size = bfd_get_dynamic_symtab_upper_bound(bfd_handle.get());
-        if (symtab_storage_size <= 0 && dyn_symtab_storage_size <= 0) {
-            return r;
+        cache_bytes_ -= file_obj.cache_bytes;
+        cache_fds_ -= file_obj.cache_fds;
+        lru_list_.erase(file_obj.lru_pos);
+        if (file_obj.failed_time_ns != 0) {
+            failed_list_.erase(file_obj.failed_pos);
         }
+        file_obj_bfd_map_.erase(it);
+    }
+
+    /**
+     * @brief 初始化 bfd 库，libbfd 支持时设置全局锁，使多个线程可以同时使用各自的 bfd 对象
+     *
+     * @return true
+     */
+    static bool init_bfd() {
+        bfd_init();
+        if (bfd_thread_init != nullptr) {
+            bfd_thread_init(&lock_bfd, &unlock_bfd, nullptr);
+        }
+        return true;
+    }
+
+    static std::recursive_mutex& get_bfd_mutex() {
+        static std::recursive_mutex mutex;
+        return mutex;
+    }
+
+    static bool lock_bfd(void*) {
+        get_bfd_mutex().lock();
+        return true;
+    }
+
+    static bool unlock_bfd(void*) {
+        get_bfd_mutex().unlock();
+        return true;
+    }
+
+    /**
+     * @brief 打开 ELF 文件并读取符号表，调用时需要持有加载锁
+     *
+     * @param filename_object
+     * @param r
+     */
+    void load_file_object(const std::string& filename_object, bfd_file_object* r) {
+        // 多个 TraceResolver 可能在不同线程中同时加载，局部静态变量保证只初始化一次
+        static const bool is_bfd_loaded = init_bfd();
+        (void)is_bfd_loaded;
+
+        bfd_handle_t bfd_handle;
+        if (!open_object_with_bfd(filename_object, bfd_handle)) {
+            return;
+        }
+        load_debug_object(bfd_handle.get(), filename_object, r);
 
         bfd_symtab_t symtab, dynamic_symtab;
         ssize_t sym_count = 0, dyn_sym_count = 0;
-        if (symtab_storage_size > 0) {
-            symtab.reset(static_cast<bfd_symbol **>(malloc(static_cast<size_t>(symtab_storage_size))));
-            sym_count = bfd_canonicalize_symtab(bfd_handle.get(), symtab.get());
-        }
-        if (dyn_symtab_storage_size > 0) {
-            dynamic_symtab.reset(static_cast<bfd_symbol **>(malloc(static_cast<size_t>(dyn_symtab_storage_size))));
-            dyn_sym_count = bfd_canonicalize_dynamic_symtab(bfd_handle.get(), dynamic_symtab.get());
+        if ((bfd_get_file_flags(bfd_handle.get()) & HAS_SYMS) != 0) {
+            sym_count = load_symtab(bfd_handle.get(), symtab, false, &r->symtab_bytes);
         }
-        if (sym_count <= 0 && dyn_sym_count <= 0) {
-            return r;
+        dyn_sym_count = load_symtab(bfd_handle.get(), dynamic_symtab, true, &r->symtab_bytes);
+        if (sym_count <= 0 && dyn_sym_count <= 0 && !r->debug_handle) {
+            r->symtab_bytes = 0;
+            return;
         }
 
         r->handle = std::move(bfd_handle);
         r->symtab = std::move(symtab);
         r->dynamic_symtab = std::move(dynamic_symtab);
-        return r;
+        if (symbol_cache_.need_function_ranges(r->build_id)) {
+            add_function_ranges(r);
+        }
+    }
+
+    /**
+     * @brief 使用 bfd 打开 ELF 文件
+     *
+     * @param filename
+     * @param bfd_handle
+     * @return true
+     * @return false
+     */
+    static bool open_object_with_bfd(const std::string& filename, bfd_handle_t& bfd_handle) {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        // 使用 iovec 方式打开，读文件时直接 pread，不经过 bfd 全局的文件缓存（非线程安全），
+        // 这样不同线程各自持有的 bfd 可以并行解析
+        int* stream = new int(fd);
+        bfd_handle.reset(bfd_openr_iovec(filename.c_str(), "default", &iovec_open, stream,
+            &iovec_pread, &iovec_close, &iovec_stat));
+        if (!bfd_handle) {
+            close(fd);
+            delete stream;
+            return false;
+        }
+        if (!bfd_check_format(bfd_handle.get(), bfd_object)) {
+            bfd_handle.reset(nullptr);
+            return false;
+        }
+        return true;
+    }
+
+    static void* iovec_open(bfd*, void* open_closure) {
+        return open_closure;
+    }
+
+    static file_ptr iovec_pread(bfd*, void* stream, void* buf, file_ptr nbytes, file_ptr offset) {
+        int fd = *static_cast<int*>(stream);
+        file_ptr total = 0;
+        while (total < nbytes) {
+            ssize_t len = pread(fd, static_cast<char*>(buf) + total,
+                static_cast<size_t>(nbytes - total), offset + total);
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                break;
+            }
+            total += len;
+        }
+        return total;
+    }
+
+    static int iovec_close(bfd*, void* stream) {
+        int* fd = static_cast<int*>(stream);
+        int ret = close(*fd);
+        delete fd;
+        return ret;
+    }
+
+    static int iovec_stat(bfd*, void* stream, struct stat* sb) {
+        return fstat(*static_cast<int*>(stream), sb);
+    }
+
+    /**
+     * @brief bfd 的全局状态（初始化、格式识别时的 target 匹配）非线程安全，加载文件时需要加锁
+     *
+     * @return std::mutex&
+     */
+    static std::mutex& get_load_mutex() {
+        static std::mutex load_mutex;
+        return load_mutex;
+    }
+
+    /**
+     * @brief 读取符号表
+     *
+     * @param abfd
+     * @param symtab
+     * @param is_dynamic 是否读取动态符号表
+     * @param storage_bytes 累加符号表占用的内存
+     * @return ssize_t 符号的个数
+     */
+    static ssize_t load_symtab(bfd* abfd, bfd_symtab_t& symtab, bool is_dynamic, size_t* storage_bytes) {
+        ssize_t storage_size = is_dynamic ? bfd_get_dynamic_symtab_upper_bound(abfd)
+            : bfd_get_symtab_upper_bound(abfd);
+        if (storage_size <= 0) {
+            return 0;
+        }
+        symtab.reset(static_cast<bfd_symbol **>(malloc(static_cast<size_t>(storage_size))));
+        if (!symtab) {
+            return 0;
+        }
+        ssize_t sym_count = is_dynamic ? bfd_canonicalize_dynamic_symtab(abfd, symtab.get())
+            : bfd_canonicalize_symtab(abfd, symtab.get());
+        if (sym_count <= 0) {
+            symtab.reset(nullptr);
+        } else {
+            *storage_bytes += static_cast<size_t>(storage_size);
+        }
+        return sym_count;
+    }
+
+    /**
+     * @brief 读取段的全部内容
+     *
+     * @param abfd
+     * @param section_name
+     * @param contents
+     * @return true
+     * @return false
+     */
+    static bool read_section_contents(bfd* abfd, const char* section_name, std::vector<unsigned char>* contents) {
+        asection* section = bfd_get_section_by_name(abfd, section_name);
+        if (section == nullptr) {
+            return false;
+        }
+        bfd_size_type size = bfd_get_section_size(section);
+        if (size == 0) {
+            return false;
+        }
+        contents->resize(static_cast<size_t>(size));
+        return bfd_get_section_contents(abfd, section, &(*contents)[0], 0, size);
+    }
+
+    /**
+     * @brief 查找并加载分离的调试信息文件，先按 build-id 查找，再按 .gnu_debuglink 查找
+     *
+     * @param abfd 被调试的 ELF 文件
+     * @param filename_object
+     * @param file_obj
+     */
+    void load_debug_object(bfd* abfd, const std::string& filename_object, bfd_file_object* file_obj) {
+        std::vector<unsigned char> contents;
+        if (read_section_contents(abfd, ".note.gnu.build-id", &contents)) {
+            file_obj->build_id = DebugFileLocator::parse_build_id_note(&contents[0], contents.size());
+        }
+        // 没有 DWARF 信息时才需要分离的调试文件
+        if (bfd_get_section_by_name(abfd, ".debug_info") != nullptr) {
+            return;
+        }
+        std::vector<std::string> candidates;
+        std::string debug_filename = debug_file_locator_.find_by_build_id(file_obj->build_id);
+        if (!debug_filename.empty()) {
+            candidates.push_back(debug_filename);
+        }
+        std::string debuglink;
+        uint32_t crc = 0;
+        if (read_section_contents(abfd, ".gnu_debuglink", &contents)
+            && DebugFileLocator::parse_debuglink(&contents[0], contents.size(), &debuglink, &crc)) {
+            debug_filename = debug_file_locator_.find_by_debuglink(filename_object, debuglink, crc);
+            if (!debug_filename.empty()) {
+                candidates.push_back(debug_filename);
+            }
+        }
+        for (const auto& candidate : candidates) {
+            bfd_handle_t debug_handle;
+            if (!open_object_with_bfd(candidate, debug_handle)) {
+                continue;
+            }
+            bfd_symtab_t debug_symtab;
+            if (load_symtab(debug_handle.get(), debug_symtab, false, &file_obj->symtab_bytes) <= 0) {
+                continue;
+            }
+            file_obj->debug_handle = std::move(debug_handle);
+            file_obj->debug_symtab = std::move(debug_symtab);
+            return;
+        }
     }
 
     /**
@@ -234,12 +926,26 @@ private:
                 return;
             }
         }
+        if (!result->found && file_obj->debug_handle) {
+            // 调试文件中的段与原文件同名同地址，只是没有代码内容
+            asection* debug_section = bfd_get_section_by_name(file_obj->debug_handle.get(),
+                bfd_get_section_name(file_obj->handle.get(), section));
+            if (debug_section != nullptr) {
+                bfd_vma debug_sec_addr = bfd_get_section_vma(file_obj->debug_handle.get(), debug_section);
+                ObjectCounters::add(file_obj->counters, &ObjectCounters::find_nearest_line_calls_);
+                result->found = bfd_find_nearest_line(
+                    file_obj->debug_handle.get(), debug_section, file_obj->debug_symtab.get(),
+                    addr - debug_sec_addr, &result->filename, &result->funcname, &result->line);
+            }
+        }
         if (!result->found && file_obj->symtab) {
+            ObjectCounters::add(file_obj->counters, &ObjectCounters::find_nearest_line_calls_);
             result->found = bfd_find_nearest_line(
                 file_obj->handle.get(), section, file_obj->symtab.get(), addr - sec_addr,
                 &result->filename, &result->funcname, &result->line);
         }
         if (!result->found && file_obj->dynamic_symtab) {
+            ObjectCounters::add(file_obj->counters, &ObjectCounters::find_nearest_line_calls_);
             result->found = bfd_find_nearest_line(
                 file_obj->handle.get(), section, file_obj->dynamic_symtab.get(),
                 addr - sec_addr, &result->filename, &result->funcname, &result->line);
@@ -269,8 +975,17 @@ private:
     }
 
 private:
-    bool is_bfd_loaded_{false};
+    DebugFileLocator debug_file_locator_;
+    SymbolCache symbol_cache_;
+    std::unordered_map<void*, loaded_module> loaded_module_map_;
     std::unordered_map<std::string, bfd_file_object> file_obj_bfd_map_;
+    // 按最近使用排序的 ELF 文件名，队头为最近使用的
+    std::list<std::string> lru_list_;
+    // 按失败时间排序的加载失败的 ELF 文件名，队头为最早失败的
+    std::list<std::string> failed_list_;
+    ObjectCacheOptions object_cache_options_;
+    size_t cache_bytes_{0};
+    size_t cache_fds_{0};
 };
 
 }  // namespace stack_trace
@@ -0,0 +1,653 @@
+/**
+ * @file symbol_cache.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_SYMBOL_CACHE_H_
+#define COLLECT_SYMBOL_CACHE_H_
+
+#include <errno.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "collect/debug_file.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 符号索引文件的格式，所有地址都是减去模块加载偏移（load bias）之后的值，即 ELF 中的虚拟地址
+ *
+ * | SymbolIndexHeader | SymbolIndexRange[range_count_] | SymbolIndexLine[line_count_] | 字符串表 |
+ *
+ * range 来自符号表，按地址排序，记录函数的地址范围；line 来自 DWARF，按地址排序，记录已解析过的地址
+ */
+struct SymbolIndexHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t range_count_;
+    uint32_t line_count_;
+    uint32_t string_size_;
+};
+
+struct SymbolIndexRange {
+    uint64_t addr_;
+    uint64_t size_;
+    uint32_t function_;
+    uint32_t reserved_;
+};
+
+struct SymbolIndexLine {
+    uint64_t addr_;
+    uint32_t function_;
+    uint32_t filename_;
+    uint32_t line_;
+    uint32_t flags_;
+};
+
+/**
+ * @brief 从索引中查到的符号信息，字符串指向 mmap 的内存，在该模块的索引下一次写入之前有效
+ *
+ */
+struct CachedSymbol {
+    // 解析时使用了调用点地址减一
+    static const uint32_t FLAG_ADJUSTED_CALL_SITE = 0x1;
+
+    const char* function_{nullptr};
+    const char* filename_{nullptr};
+    uint32_t line_{0};
+    uint32_t flags_{0};
+};
+
+/**
+ * @brief 只读 mmap 的符号索引文件，多个进程通过 page cache 共享
+ *
+ */
+class SymbolIndex {
+public:
+    static const uint32_t VERSION = 1;
+
+    SymbolIndex() = default;
+    ~SymbolIndex() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+    SymbolIndex(const SymbolIndex&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+    SymbolIndex(SymbolIndex&&) = delete;
+    SymbolIndex& operator=(SymbolIndex&&) = delete;
+
+public:
+    /**
+     * @brief 打开索引文件，文件不存在或者格式、版本不匹配时返回 nullptr
+     *
+     * @param filename
+     * @return std::unique_ptr<SymbolIndex>
+     */
+    static std::unique_ptr<SymbolIndex> open_file(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(SymbolIndexHeader)) {
+            close(fd);
+            return nullptr;
+        }
+        size_t size = static_cast<size_t>(file_stat.st_size);
+        void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        std::unique_ptr<SymbolIndex> index(new SymbolIndex());
+        index->data_ = static_cast<const char*>(data);
+        index->size_ = size;
+        if (!index->check_format()) {
+            return nullptr;
+        }
+        return index;
+    }
+
+    /**
+     * @brief 查找已解析过的地址
+     *
+     * @param addr
+     * @param symbol
+     * @return true
+     * @return false
+     */
+    bool find_line(uint64_t addr, CachedSymbol* symbol) const {
+        const SymbolIndexLine* begin = lines();
+        const SymbolIndexLine* end = begin + header()->line_count_;
+        const SymbolIndexLine* it = std::lower_bound(begin, end, addr,
+            [](const SymbolIndexLine& line, uint64_t value) { return line.addr_ < value; });
+        if (it == end || it->addr_ != addr) {
+            return false;
+        }
+        symbol->function_ = get_string(it->function_);
+        symbol->filename_ = get_string(it->filename_);
+        symbol->line_ = it->line_;
+        symbol->flags_ = it->flags_;
+        return true;
+    }
+
+    /**
+     * @brief 查找地址所在的函数
+     *
+     * @param addr
+     * @return const char* 找不到时返回 nullptr
+     */
+    const char* find_function(uint64_t addr) const {
+        const SymbolIndexRange* begin = ranges();
+        const SymbolIndexRange* end = begin + header()->range_count_;
+        const SymbolIndexRange* it = std::upper_bound(begin, end, addr,
+            [](uint64_t value, const SymbolIndexRange& range) { return value < range.addr_; });
+        if (it == begin) {
+            return nullptr;
+        }
+        --it;
+        if (addr >= it->addr_ + it->size_) {
+            return nullptr;
+        }
+        return get_string(it->function_);
+    }
+
+    const SymbolIndexHeader* header() const {
+        return reinterpret_cast<const SymbolIndexHeader*>(data_);
+    }
+
+    const SymbolIndexRange* ranges() const {
+        return reinterpret_cast<const SymbolIndexRange*>(data_ + sizeof(SymbolIndexHeader));
+    }
+
+    const SymbolIndexLine* lines() const {
+        return reinterpret_cast<const SymbolIndexLine*>(ranges() + header()->range_count_);
+    }
+
+    const char* get_string(uint32_t offset) const {
+        return strings() + offset;
+    }
+
+private:
+    const char* strings() const {
+        return reinterpret_cast<const char*>(lines() + header()->line_count_);
+    }
+
+    bool check_format() const {
+        const SymbolIndexHeader* h = header();
+        if (memcmp(h->magic_, "STSYMIDX", sizeof(h->magic_)) != 0 || h->version_ != VERSION) {
+            return false;
+        }
+        uint64_t expect_size = sizeof(SymbolIndexHeader)
+            + static_cast<uint64_t>(h->range_count_) * sizeof(SymbolIndexRange)
+            + static_cast<uint64_t>(h->line_count_) * sizeof(SymbolIndexLine) + h->string_size_;
+        // 字符串表必须以 '\0' 结尾，避免读越界
+        if (expect_size != size_ || h->string_size_ == 0 || data_[size_ - 1] != '\0') {
+            return false;
+        }
+        // 缓存目录可能被多个进程共享，文件被截断或篡改时，越界的字符串偏移会导致每个 mmap 它的进程读越界，
+        // 加载时检查一次，之后的查找不再检查
+        const SymbolIndexRange* range_begin = ranges();
+        for (uint32_t i = 0; i < h->range_count_; ++i) {
+            if (range_begin[i].function_ >= h->string_size_) {
+                return false;
+            }
+        }
+        const SymbolIndexLine* line_begin = lines();
+        for (uint32_t i = 0; i < h->line_count_; ++i) {
+            if (line_begin[i].function_ >= h->string_size_ || line_begin[i].filename_ >= h->string_size_) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    const char* data_{nullptr};
+    size_t size_{0};
+};
+
+/**
+ * @brief 以 build-id 为 key 的持久化符号索引缓存
+ *
+ * 首次加载某个模块时立即写入其函数范围，新解析的地址每攒够 FLUSH_LINE_COUNT 个（或 flush 时）写入一次，
+ * 文件为 <cache_dir>/<build_id>.idx，之后的进程直接 mmap 索引文件并二分查找。写入时在 <build_id>.idx.lock 上加 flock，合并已有的内容后
+ * 先写临时文件再 rename，多个进程并发写入也不会丢失对方的内容
+ */
+class SymbolCache {
+public:
+    struct FunctionRange {
+        uint64_t addr_;
+        uint64_t size_;
+        std::string function_;
+    };
+
+public:
+    // 一个模块攒够这么多新解析的地址后写入索引文件
+    static const size_t FLUSH_LINE_COUNT = 64;
+
+public:
+    SymbolCache() {
+        const char* cache_dir = getenv("STACK_TRACE_CACHE_DIR");
+        if (cache_dir != nullptr) {
+            cache_dir_ = cache_dir;
+        }
+    }
+    ~SymbolCache() = default;
+    SymbolCache(const SymbolCache&) = delete;
+    SymbolCache& operator=(const SymbolCache&) = delete;
+    SymbolCache(SymbolCache&&) = delete;
+    SymbolCache& operator=(SymbolCache&&) = delete;
+
+public:
+    /**
+     * @brief 设置缓存目录，为空表示关闭缓存。默认取环境变量 STACK_TRACE_CACHE_DIR
+     *
+     * @param cache_dir
+     */
+    void set_cache_dir(const std::string& cache_dir) {
+        cache_dir_ = cache_dir;
+        index_map_.clear();
+        // 未写入的记录属于原来的目录，不带到新的目录中
+        pending_map_.clear();
+    }
+
+    const std::string& get_cache_dir() const {
+        return cache_dir_;
+    }
+
+    bool is_enabled() const {
+        return !cache_dir_.empty();
+    }
+
+    /**
+     * @brief 获取模块的索引，没有索引文件时返回 nullptr
+     *
+     * @param build_id
+     * @return const SymbolIndex*
+     */
+    const SymbolIndex* get_index(const std::string& build_id) {
+        if (!is_enabled() || build_id.empty()) {
+            return nullptr;
+        }
+        auto it = index_map_.find(build_id);
+        if (it == index_map_.end()) {
+            it = index_map_.emplace(build_id, SymbolIndex::open_file(get_index_filename(build_id))).first;
+        }
+        return it->second.get();
+    }
+
+    /**
+     * @brief 查找已解析过的地址
+     *
+     * @param build_id
+     * @param addr 减去模块加载偏移之后的地址
+     * @param symbol
+     * @return true
+     * @return false
+     */
+    bool find_line(const std::string& build_id, uint64_t addr, CachedSymbol* symbol) {
+        const SymbolIndex* index = get_index(build_id);
+        return index != nullptr && index->find_line(addr, symbol);
+    }
+
+    /**
+     * @brief 查找地址所在的函数
+     *
+     * @param build_id
+     * @param addr 减去模块加载偏移之后的地址
+     * @return const char* 找不到时返回 nullptr
+     */
+    const char* find_function(const std::string& build_id, uint64_t addr) {
+        const SymbolIndex* index = get_index(build_id);
+        return index != nullptr ? index->find_function(addr) : nullptr;
+    }
+
+    /**
+     * @brief 是否需要记录模块的函数范围，已有索引或者已经记录过时不需要
+     *
+     * @param build_id
+     * @return true
+     * @return false
+     */
+    bool need_function_ranges(const std::string& build_id) {
+        if (!is_enabled() || build_id.empty()) {
+            return false;
+        }
+        const SymbolIndex* index = get_index(build_id);
+        if (index != nullptr && index->header()->range_count_ > 0) {
+            return false;
+        }
+        auto it = pending_map_.find(build_id);
+        return it == pending_map_.end() || it->second.ranges_.empty();
+    }
+
+    /**
+     * @brief 记录模块的函数范围，并立即写入索引文件，之后的进程不需要再加载符号表
+     *
+     * @param build_id
+     * @param ranges
+     */
+    void add_function_ranges(const std::string& build_id, std::vector<FunctionRange>&& ranges) {
+        if (!is_enabled() || build_id.empty()) {
+            return;
+        }
+        pending_map_[build_id].ranges_ = std::move(ranges);
+        flush(build_id);
+    }
+
+    /**
+     * @brief 记录解析过的地址
+     *
+     * @param build_id
+     * @param addr 减去模块加载偏移之后的地址
+     * @param function
+     * @param filename
+     * @param line
+     * @param flags
+     */
+    void add_line(const std::string& build_id, uint64_t addr, const std::string& function,
+        const std::string& filename, uint32_t line, uint32_t flags) {
+        if (!is_enabled() || build_id.empty()) {
+            return;
+        }
+        PendingIndex& pending_index = pending_map_[build_id];
+        PendingLine& pending = pending_index.lines_[addr];
+        pending.function_ = function;
+        pending.filename_ = filename;
+        pending.line_ = line;
+        pending.flags_ = flags;
+        // 长期运行的进程可能一直不析构解析器（或被直接杀掉），攒够一批就写入
+        if (pending_index.lines_.size() >= FLUSH_LINE_COUNT) {
+            flush(build_id);
+        }
+    }
+
+    /**
+     * @brief 把新记录的信息与已有的索引文件合并后写回，并重新 mmap
+     *
+     */
+    void flush() {
+        while (!pending_map_.empty()) {
+            flush(pending_map_.begin()->first);
+        }
+    }
+
+    /**
+     * @brief 只写入一个模块新记录的信息
+     *
+     * @param build_id
+     */
+    void flush(const std::string& build_id) {
+        auto it = pending_map_.find(build_id);
+        if (it == pending_map_.end()) {
+            return;
+        }
+        if (is_enabled()) {
+            mkdir(cache_dir_.c_str(), 0755);
+            write_index(build_id, it->second);
+            index_map_.erase(build_id);
+        }
+        pending_map_.erase(it);
+    }
+
+    /**
+     * @brief 获取当前进程中已加载模块的 build-id 和加载偏移，直接读内存中的 PT_NOTE，不需要读文件
+     *
+     * 加载偏移与 build-id 无关，没有 build-id（未使用 --build-id 链接）的模块同样会设置，
+     * 只是不能使用持久化的符号索引
+     *
+     * @param addr 模块中的任意地址
+     * @param build_id 十六进制形式的 build-id，没有时为空
+     * @param load_bias 模块的加载偏移，索引中的地址都是减去它之后的值
+     * @return true
+     * @return false 地址不在任何已加载的模块中
+     */
+    static bool find_loaded_module(const void* addr, std::string* build_id, uintptr_t* load_bias) {
+        LoadedModuleContext context;
+        context.addr_ = reinterpret_cast<uintptr_t>(addr);
+        if (dl_iterate_phdr(&find_loaded_module_callback, &context) == 0) {
+            return false;
+        }
+        *build_id = context.build_id_;
+        *load_bias = context.load_bias_;
+        return true;
+    }
+
+private:
+    struct PendingLine {
+        std::string function_;
+        std::string filename_;
+        uint32_t line_{0};
+        uint32_t flags_{0};
+    };
+    struct LoadedModuleContext {
+        uintptr_t addr_{0};
+        uintptr_t load_bias_{0};
+        std::string build_id_;
+    };
+    struct PendingIndex {
+        std::vector<FunctionRange> ranges_;
+        std::map<uint64_t, PendingLine> lines_;
+    };
+
+    /**
+     * @brief 构造字符串表，相同的字符串只存一份
+     *
+     */
+    class StringTable {
+    public:
+        StringTable() : data_(1, '\0') {}
+
+        uint32_t add(const char* str) {
+            if (str == nullptr || *str == '\0') {
+                return 0;
+            }
+            auto it = offset_map_.find(str);
+            if (it != offset_map_.end()) {
+                return it->second;
+            }
+            uint32_t offset = static_cast<uint32_t>(data_.size());
+            data_.append(str, strlen(str) + 1);
+            offset_map_.emplace(str, offset);
+            return offset;
+        }
+
+        const std::string& data() const {
+            return data_;
+        }
+
+    private:
+        std::string data_;
+        std::unordered_map<std::string, uint32_t> offset_map_;
+    };
+
+    std::string get_index_filename(const std::string& build_id) const {
+        return cache_dir_ + "/" + build_id + ".idx";
+    }
+
+    /**
+     * @brief 合并并写入索引文件
+     *
+     * @param build_id
+     * @param pending
+     * @return true
+     * @return false
+     */
+    bool write_index(const std::string& build_id, const PendingIndex& pending) {
+        std::string filename = get_index_filename(build_id);
+        // 读取、合并、rename 在同一个锁内完成，否则两个进程同时写入同一个 build-id 时会丢失对方的内容。
+        // 锁在单独的文件上，索引文件本身会被 rename 替换
+        int lock_fd = open((filename + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock_fd < 0) {
+            return false;
+        }
+        while (flock(lock_fd, LOCK_EX) != 0) {
+            if (errno != EINTR) {
+                close(lock_fd);
+                return false;
+            }
+        }
+        bool is_written = write_index_locked(filename, pending);
+        flock(lock_fd, LOCK_UN);
+        close(lock_fd);
+        return is_written;
+    }
+
+    /**
+     * @brief 在持有锁时合并并写入索引文件
+     *
+     * @param filename
+     * @param pending
+     * @return true
+     * @return false
+     */
+    bool write_index_locked(const std::string& filename, const PendingIndex& pending) {
+        // 重新打开，合并其他进程在此期间写入的内容
+        std::unique_ptr<SymbolIndex> old_index = SymbolIndex::open_file(filename);
+        StringTable string_table;
+        std::vector<SymbolIndexRange> ranges;
+        std::vector<SymbolIndexLine> lines;
+
+        if (old_index != nullptr && old_index->header()->range_count_ > 0) {
+            const SymbolIndexRange* old_ranges = old_index->ranges();
+            for (uint32_t i = 0; i < old_index->header()->range_count_; ++i) {
+                SymbolIndexRange range = old_ranges[i];
+                range.function_ = string_table.add(old_index->get_string(old_ranges[i].function_));
+                ranges.push_back(range);
+            }
+        } else {
+            for (const auto& pending_range : pending.ranges_) {
+                SymbolIndexRange range;
+                range.addr_ = pending_range.addr_;
+                range.size_ = pending_range.size_;
+                range.function_ = string_table.add(pending_range.function_.c_str());
+                range.reserved_ = 0;
+                ranges.push_back(range);
+            }
+            std::sort(ranges.begin(), ranges.end(),
+                [](const SymbolIndexRange& a, const SymbolIndexRange& b) { return a.addr_ < b.addr_; });
+        }
+
+        // 两边都是有序的，归并即可，相同地址以新解析的为准
+        const SymbolIndexLine* old_lines = old_index != nullptr ? old_index->lines() : nullptr;
+        uint32_t old_count = old_index != nullptr ? old_index->header()->line_count_ : 0;
+        uint32_t old_idx = 0;
+        auto new_it = pending.lines_.begin();
+        while (old_idx < old_count || new_it != pending.lines_.end()) {
+            SymbolIndexLine line;
+            if (new_it == pending.lines_.end()
+                || (old_idx < old_count && old_lines[old_idx].addr_ < new_it->first)) {
+                line = old_lines[old_idx];
+                line.function_ = string_table.add(old_index->get_string(old_lines[old_idx].function_));
+                line.filename_ = string_table.add(old_index->get_string(old_lines[old_idx].filename_));
+                ++old_idx;
+            } else {
+                if (old_idx < old_count && old_lines[old_idx].addr_ == new_it->first) {
+                    ++old_idx;
+                }
+                line.addr_ = new_it->first;
+                line.function_ = string_table.add(new_it->second.function_.c_str());
+                line.filename_ = string_table.add(new_it->second.filename_.c_str());
+                line.line_ = new_it->second.line_;
+                line.flags_ = new_it->second.flags_;
+                ++new_it;
+            }
+            lines.push_back(line);
+        }
+
+        SymbolIndexHeader header;
+        memcpy(header.magic_, "STSYMIDX", sizeof(header.magic_));
+        header.version_ = SymbolIndex::VERSION;
+        header.range_count_ = static_cast<uint32_t>(ranges.size());
+        header.line_count_ = static_cast<uint32_t>(lines.size());
+        header.string_size_ = static_cast<uint32_t>(string_table.data().size());
+
+        // 临时文件名带上线程 ID，保证并发写入时互不干扰，rename 是原子的
+        std::string tmp_filename = filename + ".tmp." + std::to_string(getpid())
+            + "." + std::to_string(syscall(SYS_gettid));
+        FILE* fp = fopen(tmp_filename.c_str(), "wb");
+        if (fp == nullptr) {
+            return false;
+        }
+        bool is_ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+        if (is_ok && !ranges.empty()) {
+            is_ok = fwrite(&ranges[0], sizeof(SymbolIndexRange), ranges.size(), fp) == ranges.size();
+        }
+        if (is_ok && !lines.empty()) {
+            is_ok = fwrite(&lines[0], sizeof(SymbolIndexLine), lines.size(), fp) == lines.size();
+        }
+        if (is_ok) {
+            is_ok = fwrite(string_table.data().data(), 1, string_table.data().size(), fp)
+                == string_table.data().size();
+        }
+        is_ok = (fclose(fp) == 0) && is_ok;
+        if (!is_ok || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            unlink(tmp_filename.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static int find_loaded_module_callback(struct dl_phdr_info* info, size_t, void* data) {
+        auto context = static_cast<LoadedModuleContext*>(data);
+        bool is_contained = false;
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+            uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+            if (phdr.p_type == PT_LOAD && context->addr_ >= start && context->addr_ < start + phdr.p_memsz) {
+                is_contained = true;
+                break;
+            }
+        }
+        if (!is_contained) {
+            return 0;
+        }
+        context->load_bias_ = info->dlpi_addr;
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_NOTE) {
+                continue;
+            }
+            context->build_id_ = DebugFileLocator::parse_build_id_note(
+                reinterpret_cast<const unsigned char*>(info->dlpi_addr + phdr.p_vaddr), phdr.p_memsz);
+            if (!context->build_id_.empty()) {
+                break;
+            }
+        }
+        return 1;
+    }
+
+private:
+    // 缓存目录，为空表示关闭缓存
+    std::string cache_dir_;
+    // build-id 到已 mmap 的索引，值为 nullptr 表示没有索引文件
+    std::unordered_map<std::string, std::unique_ptr<SymbolIndex>> index_map_;
+    // 尚未写入文件的信息
+    std::unordered_map<std::string, PendingIndex> pending_map_;
+};
+
+}  // namespace stack_trace
+
+#endif  // COLLECT_SYMBOL_CACHE_H_
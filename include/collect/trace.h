@@ -18,6 +18,9 @@
 #include <execinfo.h>
 #include <vector>
 #include "collect/resolver_base.h"
+#include "collect/trace_types.h"
+#include "collect/unwind_cfi.h"
+#include "common/stats.h"
 
 namespace stack_trace {
 
@@ -45,10 +48,24 @@ public:
         if (depth == 0) {
             return 0;
         }
+        StatsRegistry& stats = StatsRegistry::instance();
+        uint64_t begin_ns = stats.is_enabled() ? get_monotonic_ns() : 0;
         stack_trace_vec_.resize(depth + 1);
-        size_t trace_cnt = backtrace(&stack_trace_vec_[0], stack_trace_vec_.size());
+        size_t trace_cnt = 0;
+#if defined(__x86_64__)
+        if (unwind_backend_ == UnwindBackend::CFI) {
+            trace_cnt = CFIUnwinder::instance().unwind(&stack_trace_vec_[0], stack_trace_vec_.size());
+        } else {
+            trace_cnt = backtrace(&stack_trace_vec_[0], stack_trace_vec_.size());
+        }
+#else
+        trace_cnt = backtrace(&stack_trace_vec_[0], stack_trace_vec_.size());
+#endif
         stack_trace_vec_.resize(trace_cnt);
         set_skip_count(1);
+        if (begin_ns != 0) {
+            stats.get_capture_latency().record(get_monotonic_ns() - begin_ns);
+        }
         return get_size();
     }
 
@@ -107,6 +124,24 @@ public:
         return skip_;
     }
 
+    /**
+     * @brief 设置栈回溯的实现方式
+     *
+     * @param backend
+     */
+    void set_unwind_backend(UnwindBackend backend) {
+        unwind_backend_ = backend;
+    }
+
+    /**
+     * @brief 获取栈回溯的实现方式
+     *
+     * @return UnwindBackend
+     */
+    UnwindBackend get_unwind_backend() const {
+        return unwind_backend_;
+    }
+
     /**
      * @brief 获取线程 ID
      * 
@@ -128,6 +163,7 @@ private:
 private:
     size_t thread_id_{0};
     size_t skip_{0};
+    UnwindBackend unwind_backend_{UnwindBackend::BACKTRACE};
     std::vector<void*> stack_trace_vec_;
 };
 
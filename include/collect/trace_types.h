@@ -0,0 +1,43 @@
+/**
+ * @file trace_types.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_TRACE_TYPES_H_
+#define COLLECT_TRACE_TYPES_H_
+
+namespace stack_trace {
+
+/**
+ * @brief 栈帧的解析程度，越往后开销越大
+ *
+ */
+enum class ResolveLevel {
+    // 只输出地址和所在模块及模块内偏移，不读取任何文件
+    RAW = 0,
+    // 只使用 ELF 的符号表（.symtab/.dynsym）解析函数名，不读取 DWARF
+    SYMBOL,
+    // 使用 DWARF 解析文件名和行号
+    FULL,
+};
+
+/**
+ * @brief 栈回溯的实现方式
+ *
+ */
+enum class UnwindBackend {
+    // glibc 的 backtrace
+    BACKTRACE = 0,
+    // 基于 .eh_frame 的 CFI 回溯，缓存每个 PC 的回溯规则，仅支持 x86_64，其他平台退化为 BACKTRACE
+    CFI,
+};
+
+}  // namespace stack_trace
+
+#endif  // COLLECT_TRACE_TYPES_H_
@@ -0,0 +1,1120 @@
+/**
+ * @file unwind_cfi.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COLLECT_UNWIND_CFI_H_
+#define COLLECT_UNWIND_CFI_H_
+
+#if defined(__x86_64__)
+
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <ucontext.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace stack_trace {
+
+/**
+ * @brief 栈回溯需要的寄存器
+ *
+ */
+struct UnwindRegisters {
+    uintptr_t rip{0};
+    uintptr_t rsp{0};
+    uintptr_t rbp{0};
+};
+
+/**
+ * @brief 编译后的单个 PC 的回溯规则：CFA = rsp/rbp + cfa_offset，返回地址在 CFA + ra_offset，
+ * rbp 保存在 CFA + rbp_offset
+ *
+ */
+struct UnwindRule {
+    enum Kind : uint8_t {
+        INVALID = 0,
+        CFA_RSP,
+        CFA_RBP,
+        // 信号处理函数的返回跳板（__restore_rt），寄存器从栈上的 ucontext 中恢复
+        SIGNAL_FRAME,
+        // 返回地址未定义，已经到达最外层的栈帧
+        END_OF_STACK,
+    };
+
+    Kind kind{INVALID};
+    bool is_rbp_saved{false};
+    int16_t rbp_offset{0};
+    int32_t ra_offset{0};
+    int64_t cfa_offset{0};
+};
+
+/**
+ * @brief 无锁的回溯规则缓存，以 PC 为 key 的开放寻址哈希表
+ *
+ * 写入时先把 key 从 0 抢占为 BUSY，写入规则后再发布 key；读取时读规则前后各读一次 key，不一致则视为未命中。
+ * 表满时不再插入，规则仍可正常计算，只是不会被缓存
+ */
+class UnwindRuleCache {
+public:
+    explicit UnwindRuleCache(size_t capacity = 4096) {
+        capacity_ = 16;
+        while (capacity_ < capacity) {
+            capacity_ <<= 1;
+        }
+        slots_.reset(new Slot[capacity_]);
+        clear();
+    }
+    UnwindRuleCache(const UnwindRuleCache&) = delete;
+    UnwindRuleCache& operator=(const UnwindRuleCache&) = delete;
+
+public:
+    bool find(uintptr_t pc, UnwindRule* rule) const {
+        for (size_t i = 0; i < MAX_PROBE; ++i) {
+            const Slot& slot = slots_[(hash(pc) + i) & (capacity_ - 1)];
+            uintptr_t key = slot.key.load(std::memory_order_acquire);
+            if (key == EMPTY_KEY) {
+                return false;
+            }
+            if (key != pc) {
+                continue;
+            }
+            uint64_t lo = slot.rule_lo.load(std::memory_order_relaxed);
+            uint64_t hi = slot.rule_hi.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.key.load(std::memory_order_relaxed) != key) {
+                return false;
+            }
+            unpack(lo, hi, rule);
+            return true;
+        }
+        return false;
+    }
+
+    void insert(uintptr_t pc, const UnwindRule& rule) {
+        for (size_t i = 0; i < MAX_PROBE; ++i) {
+            Slot& slot = slots_[(hash(pc) + i) & (capacity_ - 1)];
+            uintptr_t key = slot.key.load(std::memory_order_relaxed);
+            if (key == pc || key == BUSY_KEY) {
+                return;
+            }
+            if (key != EMPTY_KEY || !slot.key.compare_exchange_strong(key, BUSY_KEY, std::memory_order_acq_rel)) {
+                continue;
+            }
+            uint64_t lo, hi;
+            pack(rule, &lo, &hi);
+            slot.rule_lo.store(lo, std::memory_order_relaxed);
+            slot.rule_hi.store(hi, std::memory_order_relaxed);
+            slot.key.store(pc, std::memory_order_release);
+            return;
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < capacity_; ++i) {
+            slots_[i].key.store(EMPTY_KEY, std::memory_order_release);
+        }
+    }
+
+private:
+    static const uintptr_t EMPTY_KEY = 0;
+    static const uintptr_t BUSY_KEY = 1;
+    static const size_t MAX_PROBE = 16;
+
+    struct Slot {
+        std::atomic<uintptr_t> key;
+        std::atomic<uint64_t> rule_lo;
+        std::atomic<uint64_t> rule_hi;
+    };
+
+    static size_t hash(uintptr_t pc) {
+        return static_cast<size_t>((pc * 0x9e3779b97f4a7c15ULL) >> 32);
+    }
+
+    static void pack(const UnwindRule& rule, uint64_t* lo, uint64_t* hi) {
+        *lo = static_cast<uint64_t>(rule.kind)
+            | (static_cast<uint64_t>(rule.is_rbp_saved) << 8)
+            | (static_cast<uint64_t>(static_cast<uint16_t>(rule.rbp_offset)) << 16)
+            | (static_cast<uint64_t>(static_cast<uint32_t>(rule.ra_offset)) << 32);
+        *hi = static_cast<uint64_t>(rule.cfa_offset);
+    }
+
+    static void unpack(uint64_t lo, uint64_t hi, UnwindRule* rule) {
+        rule->kind = static_cast<UnwindRule::Kind>(lo & 0xff);
+        rule->is_rbp_saved = ((lo >> 8) & 0xff) != 0;
+        rule->rbp_offset = static_cast<int16_t>(static_cast<uint16_t>(lo >> 16));
+        rule->ra_offset = static_cast<int32_t>(static_cast<uint32_t>(lo >> 32));
+        rule->cfa_offset = static_cast<int64_t>(hi);
+    }
+
+private:
+    size_t capacity_{0};
+    std::unique_ptr<Slot[]> slots_;
+};
+
+/**
+ * @brief 基于 .eh_frame_hdr/.eh_frame 的栈回溯，不依赖帧指针
+ *
+ * 对每个返回地址，通过 .eh_frame_hdr 二分查找 FDE，执行 CIE 和 FDE 中的 CFA 指令直到该地址，
+ * 把得到的 CFA/返回地址/rbp 规则编译成 UnwindRule 缓存起来，之后每帧只需要一次哈希查找和几次内存读取。
+ * 找不到 FDE 或者规则无法表示（如 DW_CFA_def_cfa_expression）时退化为帧指针回溯
+ *
+ * 回溯当前进程时，栈上的读取限制在当前线程的栈和信号备用栈之内，超出范围时回溯结束，
+ * 规则错误（如退化为帧指针时 rbp 并不是帧指针）不会读到非法内存
+ *
+ * 注意：规则缓存未命中时会调用 dl_iterate_phdr，线程第一次回溯时会调用 pthread_getattr_np，均非异步信号安全。
+ * 在信号处理函数中使用前，应先在该线程的正常上下文中回溯一次以预热缓存
+ */
+class CFIUnwinder {
+public:
+    // 单个栈帧的最大大小，用于检查回溯是否出错
+    static const uintptr_t MAX_FRAME_SIZE = 16 << 20;
+
+public:
+    static CFIUnwinder& instance() {
+        static CFIUnwinder unwinder;
+        return unwinder;
+    }
+    CFIUnwinder(const CFIUnwinder&) = delete;
+    CFIUnwinder& operator=(const CFIUnwinder&) = delete;
+
+public:
+    /**
+     * @brief 从调用者开始回溯，语义与 backtrace 一致：buffer[0] 为本函数返回到调用者的地址
+     *
+     * @param buffer
+     * @param size
+     * @return size_t 回溯到的栈帧个数
+     */
+    __attribute__((noinline))
+    size_t unwind(void** buffer, size_t size) {
+        UnwindRegisters regs;
+        __asm__ volatile(
+            "lea 0(%%rip), %0\n\t"
+            "mov %%rsp, %1\n\t"
+            "mov %%rbp, %2\n\t"
+            : "=r"(regs.rip), "=r"(regs.rsp), "=r"(regs.rbp));
+        // 先跳过本函数自身的栈帧
+        UnwindRule rule;
+        if (!find_rule(regs.rip, true, &rule) || !step(rule, &regs, &read_local_word)) {
+            return 0;
+        }
+        return unwind_from(regs, false, buffer, size);
+    }
+
+    /**
+     * @brief 从给定的寄存器开始回溯
+     *
+     * @param regs
+     * @param is_exact_pc regs.rip 是否是精确的指令地址（如信号中断处），否则视为返回地址
+     * @param buffer
+     * @param size
+     * @return size_t 回溯到的栈帧个数，包括 regs.rip 本身
+     */
+    size_t unwind_from(UnwindRegisters regs, bool is_exact_pc, void** buffer, size_t size) {
+        return unwind_from(regs, is_exact_pc, buffer, size, &read_local_word);
+    }
+
+    /**
+     * @brief 从给定的寄存器开始回溯，通过 read_word 读取栈，如读取在信号处理函数中拷贝出来的栈
+     *
+     * @tparam ReadWord bool(uintptr_t addr, uintptr_t* value)
+     * @param regs
+     * @param is_exact_pc
+     * @param buffer
+     * @param size
+     * @param read_word
+     * @return size_t
+     */
+    template <typename ReadWord>
+    size_t unwind_from(UnwindRegisters regs, bool is_exact_pc, void** buffer, size_t size, ReadWord read_word) {
+        size_t count = 0;
+        while (count < size && regs.rip != 0) {
+            buffer[count++] = reinterpret_cast<void*>(regs.rip);
+            UnwindRule rule;
+            if (!find_rule(regs.rip, is_exact_pc, &rule)) {
+                break;
+            }
+            is_exact_pc = (rule.kind == UnwindRule::SIGNAL_FRAME);
+            if (!step(rule, &regs, read_word)) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief 从信号处理函数的 ucontext 开始回溯
+     *
+     * @param ucontext
+     * @param buffer
+     * @param size
+     * @return size_t
+     */
+    size_t unwind_from(const ucontext_t* ucontext, void** buffer, size_t size) {
+        UnwindRegisters regs;
+        regs.rip = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RIP]);
+        regs.rsp = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RSP]);
+        regs.rbp = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RBP]);
+        return unwind_from(regs, true, buffer, size);
+    }
+
+    /**
+     * @brief 执行栈帧的回溯规则，得到调用者的寄存器
+     *
+     * @tparam ReadWord bool(uintptr_t addr, uintptr_t* value)，读取栈上的一个字，离线回溯时可读取拷贝出来的栈
+     * @param rule
+     * @param regs
+     * @param read_word
+     * @return true
+     * @return false
+     */
+    template <typename ReadWord>
+    static bool step(const UnwindRule& rule, UnwindRegisters* regs, ReadWord read_word) {
+        if (rule.kind == UnwindRule::SIGNAL_FRAME) {
+            // __restore_rt 执行时 rsp 指向内核压栈的 ucontext
+            uintptr_t gregs = regs->rsp + offsetof(ucontext_t, uc_mcontext.gregs);
+            uintptr_t rip, rsp, rbp;
+            if (!read_word(gregs + REG_RIP * sizeof(greg_t), &rip)
+                || !read_word(gregs + REG_RSP * sizeof(greg_t), &rsp)
+                || !read_word(gregs + REG_RBP * sizeof(greg_t), &rbp)) {
+                return false;
+            }
+            regs->rip = rip;
+            regs->rsp = rsp;
+            regs->rbp = rbp;
+            return true;
+        }
+        if (rule.kind != UnwindRule::CFA_RSP && rule.kind != UnwindRule::CFA_RBP) {
+            return false;
+        }
+        uintptr_t cfa = (rule.kind == UnwindRule::CFA_RSP ? regs->rsp : regs->rbp) + rule.cfa_offset;
+        // 栈向低地址增长，调用者的 CFA 必须在当前栈顶之上，且不能相差太远，避免读到非法内存
+        if (cfa <= regs->rsp || cfa - regs->rsp > MAX_FRAME_SIZE || (cfa & 0x7) != 0) {
+            return false;
+        }
+        uintptr_t ra, rbp = regs->rbp;
+        if (!read_word(cfa + rule.ra_offset, &ra)
+            || (rule.is_rbp_saved && !read_word(cfa + rule.rbp_offset, &rbp))) {
+            return false;
+        }
+        regs->rbp = rbp;
+        regs->rsp = cfa;
+        regs->rip = ra;
+        return ra != 0;
+    }
+
+    /**
+     * @brief 查找 PC 所在的 FDE，执行其中的 CFA 指令并编译成回溯规则
+     *
+     * 只通过指针访问 .eh_frame_hdr 和 .eh_frame，离线回溯时可传入从 ELF 文件读出的段，
+     * 此时 pc 需要换算成该段在本进程中的地址
+     *
+     * @param eh_frame_hdr
+     * @param pc
+     * @param rule
+     * @return true
+     * @return false 没有 FDE 或规则无法表示
+     */
+    static bool compile_fde_rule(const uint8_t* eh_frame_hdr, uintptr_t pc, UnwindRule* rule) {
+        cfa_state state;
+        const uint8_t* fde = find_fde(eh_frame_hdr, pc);
+        return fde != nullptr && execute_fde(fde, pc, &state) && to_rule(state, rule);
+    }
+
+    /**
+     * @brief 帧指针的回溯规则：CFA = rbp + 16，返回地址在 CFA - 8，rbp 在 CFA - 16
+     *
+     * @param rule
+     */
+    static void set_frame_pointer_rule(UnwindRule* rule) {
+        rule->kind = UnwindRule::CFA_RBP;
+        rule->cfa_offset = 16;
+        rule->ra_offset = -8;
+        rule->is_rbp_saved = true;
+        rule->rbp_offset = -16;
+    }
+
+    /**
+     * @brief 清空缓存，dlclose 之后应调用
+     *
+     */
+    void invalidate() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        modules_.clear();
+        rule_cache_.clear();
+    }
+
+private:
+    CFIUnwinder() = default;
+
+    struct module_info {
+        uintptr_t begin;
+        uintptr_t end;
+        uintptr_t eh_frame_hdr;
+    };
+
+    // 线程栈和信号备用栈的范围，只有平凡成员，可作为 thread_local 在信号处理函数中访问
+    struct stack_bounds {
+        bool is_init;
+        uintptr_t stack_begin;
+        uintptr_t stack_end;
+        uintptr_t alt_stack_begin;
+        uintptr_t alt_stack_end;
+
+        bool contains(uintptr_t addr) const {
+            return (addr >= stack_begin && addr <= stack_end - sizeof(uintptr_t))
+                || (addr >= alt_stack_begin && alt_stack_end - alt_stack_begin >= sizeof(uintptr_t)
+                    && addr <= alt_stack_end - sizeof(uintptr_t));
+        }
+    };
+
+    // CFA 指令执行过程中单个寄存器的规则
+    struct reg_rule {
+        enum Type : uint8_t { SAME = 0, UNDEFINED, OFFSET, UNSUPPORTED };
+        Type type{SAME};
+        int64_t offset{0};
+    };
+
+    // CFA 指令执行的状态，只跟踪回溯需要的寄存器
+    struct cfa_state {
+        uint64_t cfa_reg{DWARF_RSP};
+        int64_t cfa_offset{0};
+        bool is_cfa_supported{true};
+        reg_rule rbp;
+        reg_rule ra;
+    };
+
+    struct cie_info {
+        uint64_t code_align{1};
+        int64_t data_align{1};
+        uint64_t ra_reg{DWARF_RA};
+        uint8_t fde_encoding{0};
+        bool has_augmentation_data{false};
+        const uint8_t* instructions{nullptr};
+        const uint8_t* end{nullptr};
+    };
+
+    static const uint64_t DWARF_RBP = 6;
+    static const uint64_t DWARF_RSP = 7;
+    static const uint64_t DWARF_RA = 16;
+    static const size_t MAX_REMEMBER_DEPTH = 8;
+
+    /**
+     * @brief 获取 PC 的回溯规则，优先查缓存
+     *
+     * @param pc
+     * @param is_exact_pc 为 false 时 pc 是返回地址，按 pc - 1 查找，因为 call 可能是函数的最后一条指令
+     * @param rule
+     * @return true
+     * @return false
+     */
+    bool find_rule(uintptr_t pc, bool is_exact_pc, UnwindRule* rule) {
+        uintptr_t lookup_pc = is_exact_pc ? pc : pc - 1;
+        if (rule_cache_.find(lookup_pc, rule)) {
+            return true;
+        }
+        compile_rule(pc, lookup_pc, rule);
+        rule_cache_.insert(lookup_pc, *rule);
+        return true;
+    }
+
+    /**
+     * @brief 计算 PC 的回溯规则
+     *
+     * @param pc 实际的地址，用于识别信号跳板
+     * @param lookup_pc 用于查找 FDE 的地址
+     * @param rule
+     */
+    void compile_rule(uintptr_t pc, uintptr_t lookup_pc, UnwindRule* rule) {
+        if (is_signal_trampoline(pc)) {
+            rule->kind = UnwindRule::SIGNAL_FRAME;
+            return;
+        }
+        module_info module;
+        if (find_module(lookup_pc, &module) && module.eh_frame_hdr != 0
+            && compile_fde_rule(reinterpret_cast<const uint8_t*>(module.eh_frame_hdr), lookup_pc, rule)) {
+            return;
+        }
+        // 没有 FDE 或规则无法表示时退化为帧指针
+        set_frame_pointer_rule(rule);
+    }
+
+    /**
+     * @brief 读取当前线程栈上的一个字，地址不在线程栈或信号备用栈中时读取失败
+     *
+     * @param addr
+     * @param value
+     * @return true
+     * @return false
+     */
+    static bool read_local_word(uintptr_t addr, uintptr_t* value) {
+        stack_bounds& bounds = get_stack_bounds();
+        if (!bounds.contains(addr)) {
+            // 备用栈可能在第一次回溯之后才设置，重新获取一次，sigaltstack 是异步信号安全的
+            stack_t alt_stack;
+            if (sigaltstack(nullptr, &alt_stack) != 0 || (alt_stack.ss_flags & SS_DISABLE) != 0) {
+                return false;
+            }
+            bounds.alt_stack_begin = reinterpret_cast<uintptr_t>(alt_stack.ss_sp);
+            bounds.alt_stack_end = bounds.alt_stack_begin + alt_stack.ss_size;
+            if (!bounds.contains(addr)) {
+                return false;
+            }
+        }
+        *value = *reinterpret_cast<const uintptr_t*>(addr);
+        return true;
+    }
+
+    /**
+     * @brief 获取当前线程的栈范围，每个线程只获取一次
+     *
+     * @return stack_bounds&
+     */
+    static stack_bounds& get_stack_bounds() {
+        // 平凡类型的 thread_local 不需要动态初始化，信号处理函数中访问不会分配内存
+        static thread_local stack_bounds bounds;
+        if (bounds.is_init) {
+            return bounds;
+        }
+        pthread_attr_t attr;
+        void* stack_addr = nullptr;
+        size_t stack_size = 0;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) != 0) {
+                stack_size = 0;
+            }
+            pthread_attr_destroy(&attr);
+        }
+        if (stack_size != 0) {
+            bounds.stack_begin = reinterpret_cast<uintptr_t>(stack_addr);
+            bounds.stack_end = bounds.stack_begin + stack_size;
+        } else {
+            // 获取不到时不限制范围
+            bounds.stack_begin = 0;
+            bounds.stack_end = UINTPTR_MAX;
+        }
+        stack_t alt_stack;
+        if (sigaltstack(nullptr, &alt_stack) == 0 && (alt_stack.ss_flags & SS_DISABLE) == 0) {
+            bounds.alt_stack_begin = reinterpret_cast<uintptr_t>(alt_stack.ss_sp);
+            bounds.alt_stack_end = bounds.alt_stack_begin + alt_stack.ss_size;
+        }
+        bounds.is_init = true;
+        return bounds;
+    }
+
+    static bool to_rule(const cfa_state& state, UnwindRule* rule) {
+        if (state.ra.type == reg_rule::UNDEFINED) {
+            rule->kind = UnwindRule::END_OF_STACK;
+            return true;
+        }
+        if (!state.is_cfa_supported || state.ra.type != reg_rule::OFFSET
+            || (state.cfa_reg != DWARF_RSP && state.cfa_reg != DWARF_RBP)
+            || state.rbp.type == reg_rule::UNSUPPORTED
+            || state.rbp.offset < INT16_MIN || state.rbp.offset > INT16_MAX
+            || state.ra.offset < INT32_MIN || state.ra.offset > INT32_MAX) {
+            return false;
+        }
+        rule->kind = (state.cfa_reg == DWARF_RSP) ? UnwindRule::CFA_RSP : UnwindRule::CFA_RBP;
+        rule->cfa_offset = state.cfa_offset;
+        rule->ra_offset = static_cast<int32_t>(state.ra.offset);
+        rule->is_rbp_saved = (state.rbp.type == reg_rule::OFFSET);
+        rule->rbp_offset = static_cast<int16_t>(state.rbp.offset);
+        return true;
+    }
+
+    /**
+     * @brief 识别 glibc 的 __restore_rt：mov $0xf, %rax; syscall
+     *
+     * @param pc
+     * @return true
+     * @return false
+     */
+    bool is_signal_trampoline(uintptr_t pc) {
+        static const uint8_t restore_rt_code[] = {0x48, 0xc7, 0xc0, 0x0f, 0x00, 0x00, 0x00, 0x0f, 0x05};
+        module_info module;
+        if (!find_module(pc, &module) || pc + sizeof(restore_rt_code) > module.end) {
+            return false;
+        }
+        return memcmp(reinterpret_cast<const void*>(pc), restore_rt_code, sizeof(restore_rt_code)) == 0;
+    }
+
+    /**
+     * @brief 查找 PC 所在的模块，找不到时刷新模块列表（可能有新的 dlopen）
+     *
+     * @param pc
+     * @param module
+     * @return true
+     * @return false
+     */
+    bool find_module(uintptr_t pc, module_info* module) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const module_info* found = find_module_locked(pc);
+        if (found == nullptr) {
+            modules_.clear();
+            dl_iterate_phdr(&collect_module_callback, &modules_);
+            std::sort(modules_.begin(), modules_.end(),
+                [](const module_info& a, const module_info& b) { return a.begin < b.begin; });
+            found = find_module_locked(pc);
+        }
+        if (found == nullptr) {
+            return false;
+        }
+        *module = *found;
+        return true;
+    }
+
+    const module_info* find_module_locked(uintptr_t pc) const {
+        auto it = std::upper_bound(modules_.begin(), modules_.end(), pc,
+            [](uintptr_t value, const module_info& module) { return value < module.begin; });
+        if (it == modules_.begin() || pc >= (it - 1)->end) {
+            return nullptr;
+        }
+        return &*(it - 1);
+    }
+
+    static int collect_module_callback(struct dl_phdr_info* info, size_t, void* data) {
+        std::vector<module_info>* modules = static_cast<std::vector<module_info>*>(data);
+        uintptr_t eh_frame_hdr = 0;
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            if (info->dlpi_phdr[i].p_type == PT_GNU_EH_FRAME) {
+                eh_frame_hdr = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+            }
+        }
+        // 每个可执行段单独记录，模块内不同段之间的空洞不会被误认为属于该模块
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_LOAD || (phdr.p_flags & PF_X) == 0) {
+                continue;
+            }
+            module_info module;
+            module.begin = info->dlpi_addr + phdr.p_vaddr;
+            module.end = module.begin + phdr.p_memsz;
+            module.eh_frame_hdr = eh_frame_hdr;
+            modules->push_back(module);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief 通过 .eh_frame_hdr 的二分查找表定位 FDE
+     *
+     * @param hdr
+     * @param pc
+     * @return const uint8_t* 找不到时返回 nullptr
+     */
+    static const uint8_t* find_fde(const uint8_t* hdr, uintptr_t pc) {
+        // version, eh_frame_ptr_enc, fde_count_enc, table_enc
+        if (hdr[0] != 1 || hdr[3] != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+            return nullptr;
+        }
+        const uint8_t* p = hdr + 4;
+        uintptr_t hdr_addr = reinterpret_cast<uintptr_t>(hdr);
+        read_encoded(&p, hdr[1], hdr_addr);
+        uint64_t fde_count = read_encoded(&p, hdr[2], hdr_addr);
+        if (fde_count == 0) {
+            return nullptr;
+        }
+        struct table_entry {
+            int32_t initial_loc;
+            int32_t fde;
+        };
+        const table_entry* table = reinterpret_cast<const table_entry*>(p);
+        intptr_t target = static_cast<intptr_t>(pc - hdr_addr);
+        size_t low = 0, high = static_cast<size_t>(fde_count);
+        while (low + 1 < high) {
+            size_t mid = (low + high) / 2;
+            if (table[mid].initial_loc <= target) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        if (table[low].initial_loc > target) {
+            return nullptr;
+        }
+        return hdr + table[low].fde;
+    }
+
+    /**
+     * @brief 解析 FDE 和对应的 CIE，执行 CFA 指令直到 pc 所在的行
+     *
+     * @param fde
+     * @param pc
+     * @param state
+     * @return true pc 在该 FDE 的范围内且指令都能识别
+     * @return false
+     */
+    static bool execute_fde(const uint8_t* fde, uintptr_t pc, cfa_state* state) {
+        const uint8_t* p = fde;
+        const uint8_t* fde_end = nullptr;
+        if (!read_length(&p, &fde_end)) {
+            return false;
+        }
+        const uint8_t* cie_pointer_pos = p;
+        uint32_t cie_offset;
+        memcpy(&cie_offset, p, 4);
+        p += 4;
+        if (cie_offset == 0) {
+            // 是 CIE 不是 FDE
+            return false;
+        }
+        cie_info cie;
+        if (!parse_cie(cie_pointer_pos - cie_offset, &cie)) {
+            return false;
+        }
+        uintptr_t pc_begin = read_encoded(&p, cie.fde_encoding, 0);
+        uintptr_t pc_range = read_encoded(&p, cie.fde_encoding & 0x0f, 0);
+        if (pc < pc_begin || pc >= pc_begin + pc_range) {
+            return false;
+        }
+        if (cie.has_augmentation_data) {
+            p += read_uleb128(&p);
+        }
+        cfa_state initial_state;
+        if (!execute_instructions(cie, cie.instructions, cie.end, UINTPTR_MAX, 0, nullptr, &initial_state)) {
+            return false;
+        }
+        *state = initial_state;
+        return execute_instructions(cie, p, fde_end, pc, pc_begin, &initial_state, state);
+    }
+
+    static bool parse_cie(const uint8_t* cie_addr, cie_info* cie) {
+        const uint8_t* p = cie_addr;
+        const uint8_t* cie_end = nullptr;
+        if (!read_length(&p, &cie_end)) {
+            return false;
+        }
+        uint32_t cie_id;
+        memcpy(&cie_id, p, 4);
+        p += 4;
+        uint8_t version = *p++;
+        if (cie_id != 0 || (version != 1 && version != 3)) {
+            return false;
+        }
+        const char* augmentation = reinterpret_cast<const char*>(p);
+        p += strlen(augmentation) + 1;
+        if (augmentation[0] == 'e' && augmentation[1] == 'h') {
+            p += sizeof(void*);
+            augmentation += 2;
+        }
+        cie->code_align = read_uleb128(&p);
+        cie->data_align = read_sleb128(&p);
+        cie->ra_reg = (version == 1) ? *p++ : read_uleb128(&p);
+        if (augmentation[0] == 'z') {
+            cie->has_augmentation_data = true;
+            uint64_t length = read_uleb128(&p);
+            const uint8_t* data_end = p + length;
+            for (const char* aug = augmentation + 1; *aug != '\0'; ++aug) {
+                if (*aug == 'R') {
+                    cie->fde_encoding = *p++;
+                } else if (*aug == 'L') {
+                    ++p;
+                } else if (*aug == 'P') {
+                    uint8_t encoding = *p++;
+                    // 只需要跳过，不解引用
+                    read_encoded(&p, static_cast<uint8_t>(encoding & ~DW_EH_PE_indirect), 0);
+                } else if (*aug != 'S' && *aug != 'B' && *aug != 'G') {
+                    break;
+                }
+            }
+            p = data_end;
+        }
+        cie->instructions = p;
+        cie->end = cie_end;
+        return true;
+    }
+
+    /**
+     * @brief 执行 CFA 指令
+     *
+     * @param cie
+     * @param p 指令起始
+     * @param end 指令结束
+     * @param target_pc 执行到该地址所在的行为止
+     * @param loc 当前行的起始地址
+     * @param initial_state CIE 初始指令执行后的状态，DW_CFA_restore 使用
+     * @param state
+     * @return true
+     * @return false
+     */
+    static bool execute_instructions(const cie_info& cie, const uint8_t* p, const uint8_t* end,
+        uintptr_t target_pc, uintptr_t loc, const cfa_state* initial_state, cfa_state* state) {
+        cfa_state remember_stack[MAX_REMEMBER_DEPTH];
+        size_t remember_depth = 0;
+        while (p < end) {
+            uint8_t opcode = *p++;
+            uint8_t high = opcode & 0xc0;
+            uint8_t low = opcode & 0x3f;
+            uintptr_t delta = 0;
+            if (high == DW_CFA_advance_loc) {
+                delta = low * cie.code_align;
+            } else if (high == DW_CFA_offset) {
+                set_offset_rule(state, low, static_cast<int64_t>(read_uleb128(&p)) * cie.data_align);
+                continue;
+            } else if (high == DW_CFA_restore) {
+                restore_rule(state, initial_state, low);
+                continue;
+            } else {
+                switch (opcode) {
+                case DW_CFA_nop:
+                    break;
+                case DW_CFA_set_loc:
+                    delta = read_encoded(&p, cie.fde_encoding, 0) - loc;
+                    break;
+                case DW_CFA_advance_loc1:
+                    delta = *p * cie.code_align;
+                    p += 1;
+                    break;
+                case DW_CFA_advance_loc2: {
+                    uint16_t value;
+                    memcpy(&value, p, 2);
+                    p += 2;
+                    delta = value * cie.code_align;
+                    break;
+                }
+                case DW_CFA_advance_loc4: {
+                    uint32_t value;
+                    memcpy(&value, p, 4);
+                    p += 4;
+                    delta = value * cie.code_align;
+                    break;
+                }
+                case DW_CFA_offset_extended: {
+                    uint64_t reg = read_uleb128(&p);
+                    set_offset_rule(state, reg, static_cast<int64_t>(read_uleb128(&p)) * cie.data_align);
+                    break;
+                }
+                case DW_CFA_offset_extended_sf: {
+                    uint64_t reg = read_uleb128(&p);
+                    set_offset_rule(state, reg, read_sleb128(&p) * cie.data_align);
+                    break;
+                }
+                case DW_CFA_GNU_negative_offset_extended: {
+                    uint64_t reg = read_uleb128(&p);
+                    set_offset_rule(state, reg, -static_cast<int64_t>(read_uleb128(&p)) * cie.data_align);
+                    break;
+                }
+                case DW_CFA_restore_extended:
+                    restore_rule(state, initial_state, read_uleb128(&p));
+                    break;
+                case DW_CFA_undefined:
+                    set_rule(state, read_uleb128(&p), reg_rule::UNDEFINED);
+                    break;
+                case DW_CFA_same_value:
+                    set_rule(state, read_uleb128(&p), reg_rule::SAME);
+                    break;
+                case DW_CFA_register:
+                    set_rule(state, read_uleb128(&p), reg_rule::UNSUPPORTED);
+                    read_uleb128(&p);
+                    break;
+                case DW_CFA_remember_state:
+                    if (remember_depth >= MAX_REMEMBER_DEPTH) {
+                        return false;
+                    }
+                    remember_stack[remember_depth++] = *state;
+                    break;
+                case DW_CFA_restore_state:
+                    if (remember_depth == 0) {
+                        return false;
+                    }
+                    *state = remember_stack[--remember_depth];
+                    break;
+                case DW_CFA_def_cfa:
+                    state->cfa_reg = read_uleb128(&p);
+                    state->cfa_offset = static_cast<int64_t>(read_uleb128(&p));
+                    state->is_cfa_supported = true;
+                    break;
+                case DW_CFA_def_cfa_sf:
+                    state->cfa_reg = read_uleb128(&p);
+                    state->cfa_offset = read_sleb128(&p) * cie.data_align;
+                    state->is_cfa_supported = true;
+                    break;
+                case DW_CFA_def_cfa_register:
+                    state->cfa_reg = read_uleb128(&p);
+                    break;
+                case DW_CFA_def_cfa_offset:
+                    state->cfa_offset = static_cast<int64_t>(read_uleb128(&p));
+                    break;
+                case DW_CFA_def_cfa_offset_sf:
+                    state->cfa_offset = read_sleb128(&p) * cie.data_align;
+                    break;
+                case DW_CFA_def_cfa_expression:
+                    state->is_cfa_supported = false;
+                    p += read_uleb128(&p);
+                    break;
+                case DW_CFA_expression:
+                case DW_CFA_val_expression: {
+                    set_rule(state, read_uleb128(&p), reg_rule::UNSUPPORTED);
+                    p += read_uleb128(&p);
+                    break;
+                }
+                case DW_CFA_val_offset:
+                case DW_CFA_val_offset_sf: {
+                    uint64_t reg = read_uleb128(&p);
+                    if (opcode == DW_CFA_val_offset) {
+                        read_uleb128(&p);
+                    } else {
+                        read_sleb128(&p);
+                    }
+                    set_rule(state, reg, reg_rule::UNSUPPORTED);
+                    break;
+                }
+                case DW_CFA_GNU_args_size:
+                    read_uleb128(&p);
+                    break;
+                default:
+                    return false;
+                }
+            }
+            if (delta != 0) {
+                if (loc + delta > target_pc) {
+                    return true;
+                }
+                loc += delta;
+            }
+        }
+        return true;
+    }
+
+    static void set_offset_rule(cfa_state* state, uint64_t reg, int64_t offset) {
+        reg_rule* rule = get_reg_rule(state, reg);
+        if (rule != nullptr) {
+            rule->type = reg_rule::OFFSET;
+            rule->offset = offset;
+        }
+    }
+
+    static void set_rule(cfa_state* state, uint64_t reg, reg_rule::Type type) {
+        reg_rule* rule = get_reg_rule(state, reg);
+        if (rule != nullptr) {
+            rule->type = type;
+        }
+    }
+
+    static void restore_rule(cfa_state* state, const cfa_state* initial_state, uint64_t reg) {
+        reg_rule* rule = get_reg_rule(state, reg);
+        if (rule == nullptr) {
+            return;
+        }
+        if (initial_state == nullptr) {
+            *rule = reg_rule();
+        } else {
+            *rule = (reg == DWARF_RBP) ? initial_state->rbp : initial_state->ra;
+        }
+    }
+
+    static reg_rule* get_reg_rule(cfa_state* state, uint64_t reg) {
+        if (reg == DWARF_RBP) {
+            return &state->rbp;
+        }
+        if (reg == DWARF_RA) {
+            return &state->ra;
+        }
+        return nullptr;
+    }
+
+    static bool read_length(const uint8_t** p, const uint8_t** end) {
+        uint32_t length;
+        memcpy(&length, *p, 4);
+        *p += 4;
+        if (length == 0) {
+            return false;
+        }
+        if (length == 0xffffffff) {
+            uint64_t length64;
+            memcpy(&length64, *p, 8);
+            *p += 8;
+            *end = *p + length64;
+        } else {
+            *end = *p + length;
+        }
+        return true;
+    }
+
+    static uint64_t read_uleb128(const uint8_t** p) {
+        uint64_t result = 0;
+        unsigned shift = 0;
+        uint8_t byte;
+        do {
+            byte = *(*p)++;
+            if (shift < 64) {
+                result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+        } while (byte & 0x80);
+        return result;
+    }
+
+    static int64_t read_sleb128(const uint8_t** p) {
+        int64_t result = 0;
+        unsigned shift = 0;
+        uint8_t byte;
+        do {
+            byte = *(*p)++;
+            if (shift < 64) {
+                result |= static_cast<int64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+        } while (byte & 0x80);
+        if (shift < 64 && (byte & 0x40)) {
+            result |= -(static_cast<int64_t>(1) << shift);
+        }
+        return result;
+    }
+
+    /**
+     * @brief 读取 DW_EH_PE_* 编码的指针
+     *
+     * @param p
+     * @param encoding
+     * @param data_base DW_EH_PE_datarel 的基址
+     * @return uintptr_t
+     */
+    static uintptr_t read_encoded(const uint8_t** p, uint8_t encoding, uintptr_t data_base) {
+        if (encoding == DW_EH_PE_omit) {
+            return 0;
+        }
+        uintptr_t pos = reinterpret_cast<uintptr_t>(*p);
+        uintptr_t value = 0;
+        switch (encoding & 0x0f) {
+        case DW_EH_PE_absptr:
+            memcpy(&value, *p, sizeof(value));
+            *p += sizeof(value);
+            break;
+        case DW_EH_PE_uleb128:
+            value = static_cast<uintptr_t>(read_uleb128(p));
+            break;
+        case DW_EH_PE_sleb128:
+            value = static_cast<uintptr_t>(read_sleb128(p));
+            break;
+        case DW_EH_PE_udata2: {
+            uint16_t v;
+            memcpy(&v, *p, 2);
+            *p += 2;
+            value = v;
+            break;
+        }
+        case DW_EH_PE_sdata2: {
+            int16_t v;
+            memcpy(&v, *p, 2);
+            *p += 2;
+            value = static_cast<uintptr_t>(static_cast<intptr_t>(v));
+            break;
+        }
+        case DW_EH_PE_udata4: {
+            uint32_t v;
+            memcpy(&v, *p, 4);
+            *p += 4;
+            value = v;
+            break;
+        }
+        case DW_EH_PE_sdata4: {
+            int32_t v;
+            memcpy(&v, *p, 4);
+            *p += 4;
+            value = static_cast<uintptr_t>(static_cast<intptr_t>(v));
+            break;
+        }
+        case DW_EH_PE_udata8:
+        case DW_EH_PE_sdata8:
+            memcpy(&value, *p, 8);
+            *p += 8;
+            break;
+        default:
+            return 0;
+        }
+        if (value == 0) {
+            return 0;
+        }
+        switch (encoding & 0x70) {
+        case DW_EH_PE_pcrel:
+            value += pos;
+            break;
+        case DW_EH_PE_datarel:
+            value += data_base;
+            break;
+        default:
+            break;
+        }
+        if (encoding & DW_EH_PE_indirect) {
+            value = *reinterpret_cast<const uintptr_t*>(value);
+        }
+        return value;
+    }
+
+private:
+    // DWARF 中指针的编码方式
+    enum : uint8_t {
+        DW_EH_PE_absptr = 0x00,
+        DW_EH_PE_uleb128 = 0x01,
+        DW_EH_PE_udata2 = 0x02,
+        DW_EH_PE_udata4 = 0x03,
+        DW_EH_PE_udata8 = 0x04,
+        DW_EH_PE_sleb128 = 0x09,
+        DW_EH_PE_sdata2 = 0x0a,
+        DW_EH_PE_sdata4 = 0x0b,
+        DW_EH_PE_sdata8 = 0x0c,
+        DW_EH_PE_pcrel = 0x10,
+        DW_EH_PE_datarel = 0x30,
+        DW_EH_PE_indirect = 0x80,
+        DW_EH_PE_omit = 0xff,
+    };
+
+    // CFA 指令
+    enum : uint8_t {
+        DW_CFA_nop = 0x00,
+        DW_CFA_set_loc = 0x01,
+        DW_CFA_advance_loc1 = 0x02,
+        DW_CFA_advance_loc2 = 0x03,
+        DW_CFA_advance_loc4 = 0x04,
+        DW_CFA_offset_extended = 0x05,
+        DW_CFA_restore_extended = 0x06,
+        DW_CFA_undefined = 0x07,
+        DW_CFA_same_value = 0x08,
+        DW_CFA_register = 0x09,
+        DW_CFA_remember_state = 0x0a,
+        DW_CFA_restore_state = 0x0b,
+        DW_CFA_def_cfa = 0x0c,
+        DW_CFA_def_cfa_register = 0x0d,
+        DW_CFA_def_cfa_offset = 0x0e,
+        DW_CFA_def_cfa_expression = 0x0f,
+        DW_CFA_expression = 0x10,
+        DW_CFA_offset_extended_sf = 0x11,
+        DW_CFA_def_cfa_sf = 0x12,
+        DW_CFA_def_cfa_offset_sf = 0x13,
+        DW_CFA_val_offset = 0x14,
+        DW_CFA_val_offset_sf = 0x15,
+        DW_CFA_val_expression = 0x16,
+        DW_CFA_GNU_args_size = 0x2e,
+        DW_CFA_GNU_negative_offset_extended = 0x2f,
+        DW_CFA_advance_loc = 0x40,
+        DW_CFA_offset = 0x80,
+        DW_CFA_restore = 0xc0,
+    };
+
+private:
+    std::mutex mutex_;
+    // 按起始地址排序的可执行段
+    std::vector<module_info> modules_;
+    UnwindRuleCache rule_cache_;
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // COLLECT_UNWIND_CFI_H_
@@ -37,16 +37,29 @@ public:
     }
     int_type overflow(int_type ch) override {
         if (traits_type::not_eof(ch) && fputc(ch, sink_) != EOF) {
+            ++written_size_;
             return ch;
         }
         return traits_type::eof();
     }
     std::streamsize xsputn(const char_type* s, std::streamsize count) override {
-        return static_cast<std::streamsize>(fwrite(s, sizeof(*s), static_cast<size_t>(count), sink_));
+        size_t len = fwrite(s, sizeof(*s), static_cast<size_t>(count), sink_);
+        written_size_ += len;
+        return static_cast<std::streamsize>(len);
+    }
+
+    /**
+     * @brief 获取已写入的字节数
+     *
+     * @return size_t
+     */
+    size_t get_written_size() const {
+        return written_size_;
     }
 
 private:
     FILE* sink_{nullptr};
+    size_t written_size_{0};
     std::vector<char> buf_;
 };
 
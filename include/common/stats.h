@@ -0,0 +1,387 @@
+/**
+ * @file stats.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COMMON_STATS_H_
+#define COMMON_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace stack_trace {
+
+/**
+ * @brief 获取单调时钟的纳秒数
+ *
+ * @return uint64_t
+ */
+inline uint64_t get_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/**
+ * @brief 延迟直方图的快照
+ *
+ */
+struct LatencySnapshot {
+    uint64_t count_{0};
+    uint64_t total_ns_{0};
+    uint64_t max_ns_{0};
+    // 第 i 个桶统计 [2^(i-1), 2^i) 纳秒的次数，第 0 个桶统计 0 纳秒
+    std::vector<uint64_t> buckets_;
+
+    /**
+     * @brief 估算分位数，返回所在桶的上界
+     *
+     * @param ratio 0 到 1 之间
+     * @return uint64_t 纳秒
+     */
+    uint64_t get_percentile_ns(double ratio) const {
+        uint64_t target = static_cast<uint64_t>(static_cast<double>(count_) * ratio);
+        uint64_t accumulated = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            accumulated += buckets_[i];
+            if (accumulated > target) {
+                return i == 0 ? 0 : (1ULL << i) - 1;
+            }
+        }
+        return max_ns_;
+    }
+};
+
+/**
+ * @brief 以 2 的幂分桶的延迟直方图，记录时只有几次 relaxed 的原子操作
+ *
+ */
+class LatencyHistogram {
+public:
+    static const size_t BUCKET_COUNT = 64;
+
+    LatencyHistogram() {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            buckets_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+public:
+    void record(uint64_t ns) {
+        size_t idx = 0;
+        if (ns != 0) {
+            idx = static_cast<size_t>(64 - __builtin_clzll(ns));
+            if (idx >= BUCKET_COUNT) {
+                idx = BUCKET_COUNT - 1;
+            }
+        }
+        buckets_[idx].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+        while (ns > max_ns && !max_ns_.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {}
+    }
+
+    LatencySnapshot snapshot() const {
+        LatencySnapshot snap;
+        snap.count_ = count_.load(std::memory_order_relaxed);
+        snap.total_ns_ = total_ns_.load(std::memory_order_relaxed);
+        snap.max_ns_ = max_ns_.load(std::memory_order_relaxed);
+        snap.buckets_.resize(BUCKET_COUNT);
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            snap.buckets_[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[BUCKET_COUNT];
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> total_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+};
+
+/**
+ * @brief 单个 ELF 文件的解析开销统计
+ *
+ */
+struct ObjectStatsSnapshot {
+    std::string object_filename_;
+    // 加载文件（打开 bfd、读取符号表）的累计耗时
+    uint64_t load_time_ns_{0};
+    // 当前持有的符号表内存
+    uint64_t symtab_bytes_{0};
+    uint64_t find_nearest_line_calls_{0};
+    // 已打开文件的缓存
+    uint64_t object_cache_hits_{0};
+    uint64_t object_cache_misses_{0};
+    // 超出缓存限制而被淘汰的次数
+    uint64_t object_evictions_{0};
+    // 持久化的符号索引缓存
+    uint64_t symbol_cache_hits_{0};
+    uint64_t symbol_cache_misses_{0};
+    uint64_t dladdr_calls_{0};
+    uint64_t stat_calls_{0};
+};
+
+/**
+ * @brief 单个 ELF 文件的计数器，多个解析器共享，使用 relaxed 的原子操作
+ *
+ */
+struct ObjectCounters {
+    std::atomic<uint64_t> load_time_ns_{0};
+    std::atomic<int64_t> symtab_bytes_{0};
+    std::atomic<uint64_t> find_nearest_line_calls_{0};
+    std::atomic<uint64_t> object_cache_hits_{0};
+    std::atomic<uint64_t> object_cache_misses_{0};
+    std::atomic<uint64_t> object_evictions_{0};
+    std::atomic<uint64_t> symbol_cache_hits_{0};
+    std::atomic<uint64_t> symbol_cache_misses_{0};
+    std::atomic<uint64_t> dladdr_calls_{0};
+    std::atomic<uint64_t> stat_calls_{0};
+
+    /**
+     * @brief 累加计数器，counters 为空（关闭统计）时什么也不做
+     *
+     * @param counters
+     * @param counter 成员指针，如 &ObjectCounters::dladdr_calls_
+     * @param value
+     */
+    static void add(ObjectCounters* counters, std::atomic<uint64_t> ObjectCounters::*counter, uint64_t value = 1) {
+        if (counters != nullptr) {
+            (counters->*counter).fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * @brief 统计信息的快照
+ *
+ */
+struct StatsSnapshot {
+    std::vector<ObjectStatsSnapshot> objects_;
+    // StackTraceManager::load_trace 的耗时
+    LatencySnapshot capture_latency_;
+    // Printer 输出一次堆栈的耗时（包括解析）
+    LatencySnapshot print_latency_;
+    // Printer 输出的字节数
+    uint64_t print_bytes_{0};
+};
+
+/**
+ * @brief 全局的统计信息，用于观察解析器在线上的开销，定位异常的 ELF 文件、调整缓存大小
+ *
+ */
+class StatsRegistry {
+public:
+    typedef std::function<void(const StatsSnapshot&)> dump_callback_t;
+
+public:
+    static StatsRegistry& instance() {
+        static StatsRegistry registry;
+        return registry;
+    }
+    ~StatsRegistry() {
+        stop_periodic_dump();
+    }
+    StatsRegistry(const StatsRegistry&) = delete;
+    StatsRegistry& operator=(const StatsRegistry&) = delete;
+    StatsRegistry(StatsRegistry&&) = delete;
+    StatsRegistry& operator=(StatsRegistry&&) = delete;
+
+public:
+    /**
+     * @brief 开启或关闭统计，默认关闭，也可以设置环境变量 STACK_TRACE_STATS=1 开启
+     *
+     * @param is_enabled
+     */
+    void set_enabled(bool is_enabled) {
+        is_enabled_.store(is_enabled, std::memory_order_relaxed);
+    }
+
+    bool is_enabled() const {
+        return is_enabled_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 获取 ELF 文件的计数器，不存在时创建，返回的指针一直有效
+     *
+     * @param object_filename
+     * @return ObjectCounters*
+     */
+    ObjectCounters* get_object_counters(const std::string& object_filename) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_ptr<ObjectCounters>& counters = object_counters_map_[object_filename];
+        if (counters == nullptr) {
+            counters.reset(new ObjectCounters());
+        }
+        return counters.get();
+    }
+
+    LatencyHistogram& get_capture_latency() {
+        return capture_latency_;
+    }
+
+    LatencyHistogram& get_print_latency() {
+        return print_latency_;
+    }
+
+    void add_print_bytes(uint64_t bytes) {
+        print_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 获取当前的统计信息
+     *
+     * @return StatsSnapshot
+     */
+    StatsSnapshot snapshot() {
+        StatsSnapshot snap;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& item : object_counters_map_) {
+                const ObjectCounters& counters = *item.second;
+                ObjectStatsSnapshot object;
+                object.object_filename_ = item.first;
+                object.load_time_ns_ = counters.load_time_ns_.load(std::memory_order_relaxed);
+                int64_t symtab_bytes = counters.symtab_bytes_.load(std::memory_order_relaxed);
+                object.symtab_bytes_ = symtab_bytes > 0 ? static_cast<uint64_t>(symtab_bytes) : 0;
+                object.find_nearest_line_calls_ = counters.find_nearest_line_calls_.load(std::memory_order_relaxed);
+                object.object_cache_hits_ = counters.object_cache_hits_.load(std::memory_order_relaxed);
+                object.object_cache_misses_ = counters.object_cache_misses_.load(std::memory_order_relaxed);
+                object.object_evictions_ = counters.object_evictions_.load(std::memory_order_relaxed);
+                object.symbol_cache_hits_ = counters.symbol_cache_hits_.load(std::memory_order_relaxed);
+                object.symbol_cache_misses_ = counters.symbol_cache_misses_.load(std::memory_order_relaxed);
+                object.dladdr_calls_ = counters.dladdr_calls_.load(std::memory_order_relaxed);
+                object.stat_calls_ = counters.stat_calls_.load(std::memory_order_relaxed);
+                snap.objects_.push_back(object);
+            }
+        }
+        snap.capture_latency_ = capture_latency_.snapshot();
+        snap.print_latency_ = print_latency_.snapshot();
+        snap.print_bytes_ = print_bytes_.load(std::memory_order_relaxed);
+        return snap;
+    }
+
+    /**
+     * @brief 以文本形式输出统计信息
+     *
+     * @param snap
+     * @param os
+     */
+    static void format(const StatsSnapshot& snap, std::ostream& os) {
+        os << "Stack trace stats:\n";
+        format_latency(os, "capture", snap.capture_latency_);
+        format_latency(os, "print", snap.print_latency_);
+        os << "  print bytes: " << snap.print_bytes_ << "\n";
+        for (const auto& object : snap.objects_) {
+            os << "  object \"" << object.object_filename_ << "\": load " << object.load_time_ns_ / 1000
+                << "us, symtab " << object.symtab_bytes_ << " bytes, find_nearest_line "
+                << object.find_nearest_line_calls_ << ", object cache " << object.object_cache_hits_ << "/"
+                << object.object_cache_misses_ << " (hit/miss), evictions " << object.object_evictions_
+                << ", symbol cache " << object.symbol_cache_hits_
+                << "/" << object.symbol_cache_misses_ << " (hit/miss), dladdr " << object.dladdr_calls_
+                << ", stat " << object.stat_calls_ << "\n";
+        }
+    }
+
+    /**
+     * @brief 开启定时输出，每隔 interval 调用一次 callback，重复调用会替换之前的设置
+     *
+     * @param interval
+     * @param callback 为空时输出到 stderr
+     */
+    void start_periodic_dump(std::chrono::milliseconds interval, dump_callback_t callback = dump_callback_t()) {
+        stop_periodic_dump();
+        if (!callback) {
+            callback = [](const StatsSnapshot& snap) {
+                std::ostringstream oss;
+                format(snap, oss);
+                fputs(oss.str().c_str(), stderr);
+            };
+        }
+        std::lock_guard<std::mutex> lock(dump_mutex_);
+        is_dump_stopped_ = false;
+        dump_thread_ = std::thread([this, interval, callback] {
+            std::unique_lock<std::mutex> dump_lock(dump_mutex_);
+            while (!dump_cv_.wait_for(dump_lock, interval, [this] { return is_dump_stopped_; })) {
+                dump_lock.unlock();
+                callback(snapshot());
+                dump_lock.lock();
+            }
+        });
+    }
+
+    /**
+     * @brief 停止定时输出
+     *
+     */
+    void stop_periodic_dump() {
+        {
+            std::lock_guard<std::mutex> lock(dump_mutex_);
+            is_dump_stopped_ = true;
+        }
+        dump_cv_.notify_all();
+        if (dump_thread_.joinable()) {
+            dump_thread_.join();
+        }
+    }
+
+private:
+    StatsRegistry() {
+        const char* stats = getenv("STACK_TRACE_STATS");
+        if (stats != nullptr && *stats != '\0' && strcmp(stats, "0") != 0) {
+            is_enabled_.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    static void format_latency(std::ostream& os, const char* name, const LatencySnapshot& latency) {
+        os << "  " << name << " latency: count " << latency.count_;
+        if (latency.count_ > 0) {
+            os << ", avg " << latency.total_ns_ / latency.count_ << "ns, p50 <= "
+                << latency.get_percentile_ns(0.5) << "ns, p99 <= " << latency.get_percentile_ns(0.99)
+                << "ns, max " << latency.max_ns_ << "ns";
+        }
+        os << "\n";
+    }
+
+private:
+    std::atomic<bool> is_enabled_{false};
+    std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<ObjectCounters>> object_counters_map_;
+    LatencyHistogram capture_latency_;
+    LatencyHistogram print_latency_;
+    std::atomic<uint64_t> print_bytes_{0};
+
+    std::mutex dump_mutex_;
+    std::condition_variable dump_cv_;
+    std::thread dump_thread_;
+    bool is_dump_stopped_{true};
+};
+
+}  // namespace stack_trace
+
+#endif  // COMMON_STATS_H_
@@ -0,0 +1,175 @@
+/**
+ * @file thread_pool.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef COMMON_THREAD_POOL_H_
+#define COMMON_THREAD_POOL_H_
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace stack_trace {
+namespace utils {
+
+/**
+ * @brief 任务窃取的线程池
+ *
+ * 每个线程有自己的任务队列，从队尾取自己的任务，自己的队列为空时从其他线程的队头窃取。
+ * 任务的参数为执行它的线程下标，便于任务使用线程私有的状态
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(size_t)> task_t;
+
+public:
+    explicit ThreadPool(size_t thread_count) {
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+        for (size_t i = 0; i < thread_count; ++i) {
+            queues_.emplace_back(new WorkQueue());
+        }
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads_.emplace_back(&ThreadPool::run, this, i);
+        }
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_stopped_ = true;
+        }
+        task_cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+public:
+    /**
+     * @brief 提交任务
+     *
+     * @param task
+     * @param hint 优先放入哪个线程的队列，相关的任务放到同一个线程可以复用线程私有的状态
+     */
+    void submit(task_t task, size_t hint) {
+        // 先计数再入队，保证任务被取走时计数已经增加
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++queued_count_;
+            ++pending_count_;
+        }
+        WorkQueue& queue = *queues_[hint % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex_);
+            queue.tasks_.push_back(std::move(task));
+        }
+        task_cv_.notify_one();
+    }
+
+    /**
+     * @brief 等待已提交的任务全部执行完成
+     *
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return pending_count_ == 0; });
+    }
+
+    /**
+     * @brief 获取线程个数
+     *
+     * @return size_t
+     */
+    size_t get_thread_count() const {
+        return threads_.size();
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex_;
+        std::deque<task_t> tasks_;
+    };
+
+    void run(size_t idx) {
+        for (;;) {
+            task_t task;
+            if (pop_task(idx, &task)) {
+                task(idx);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_count_ == 0) {
+                    done_cv_.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_cv_.wait(lock, [this] { return is_stopped_ || queued_count_ > 0; });
+            if (is_stopped_ && queued_count_ == 0) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief 先从自己队列的队尾取任务，取不到再从其他队列的队头窃取
+     *
+     * @param idx
+     * @param task
+     * @return true
+     * @return false
+     */
+    bool pop_task(size_t idx, task_t* task) {
+        for (size_t i = 0; i < queues_.size(); ++i) {
+            WorkQueue& queue = *queues_[(idx + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex_);
+            if (queue.tasks_.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                *task = std::move(queue.tasks_.back());
+                queue.tasks_.pop_back();
+            } else {
+                *task = std::move(queue.tasks_.front());
+                queue.tasks_.pop_front();
+            }
+            std::lock_guard<std::mutex> count_lock(mutex_);
+            --queued_count_;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable task_cv_;
+    std::condition_variable done_cv_;
+    // 在队列中尚未被取走的任务数
+    size_t queued_count_{0};
+    // 尚未执行完成的任务数
+    size_t pending_count_{0};
+    bool is_stopped_{false};
+};
+
+}  // namespace utils
+}  // namespace stack_trace
+
+#endif  // COMMON_THREAD_POOL_H_
@@ -152,7 +152,7 @@ private:
  * @param func_name 
  * @return std::string 
  */
-std::string demangle(const char* func_name) {
+inline std::string demangle(const char* func_name) {
     // 将编译器生成的 C++ 符号转换成人类可读的形式
     // __mangled_name 表示要转换的函数名称，以 '\0' 结尾
     // __output_buffer 是用 malloc 分配的 length 字节的内存区域，用于存储转换后的函数名字。
@@ -0,0 +1,482 @@
+/**
+ * @file latency_scope.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef MONITOR_LATENCY_SCOPE_H_
+#define MONITOR_LATENCY_SCOPE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "collect/trace.h"
+#include "common/stats.h"
+#include "printer/printer.h"
+
+namespace stack_trace {
+
+class LatencySite;
+
+/**
+ * @brief 一次超时的作用域
+ *
+ */
+struct LatencyReport {
+    std::string site_name_;
+    uint64_t elapsed_ns_{0};
+    uint64_t threshold_ns_{0};
+    size_t thread_id_{0};
+    // 作用域结束时的栈帧地址，第一个为包含该作用域的函数
+    std::vector<void*> frames_;
+    // 最慢的子作用域，需要 LatencyMonitor::set_nested_threshold 开启，没有时 child_site_name_ 为空
+    std::string child_site_name_;
+    uint64_t child_elapsed_ns_{0};
+    std::vector<void*> child_frames_;
+};
+
+/**
+ * @brief 按调用点和栈聚合的超时延迟
+ *
+ */
+struct LatencyStackSnapshot {
+    std::string site_name_;
+    std::vector<void*> frames_;
+    LatencySnapshot latency_;
+};
+
+/**
+ * @brief 超时作用域的配置、上报和聚合
+ *
+ */
+class LatencyMonitor {
+public:
+    using reporter_t = std::function<void(const LatencyReport&)>;
+
+public:
+    static LatencyMonitor& instance() {
+        static LatencyMonitor monitor;
+        return monitor;
+    }
+    LatencyMonitor(const LatencyMonitor&) = delete;
+    LatencyMonitor& operator=(const LatencyMonitor&) = delete;
+    LatencyMonitor(LatencyMonitor&&) = delete;
+    LatencyMonitor& operator=(LatencyMonitor&&) = delete;
+
+public:
+    /**
+     * @brief 设置超时的上报函数，在超时线程中同步调用，应尽快返回
+     *
+     * @param reporter
+     */
+    void set_reporter(reporter_t reporter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reporter_ = std::move(reporter);
+    }
+
+    /**
+     * @brief 按名字修改调用点的阈值，对之后注册的同名调用点同样生效
+     *
+     * @param site_name
+     * @param threshold
+     */
+    void set_threshold(const std::string& site_name, std::chrono::nanoseconds threshold);
+
+    /**
+     * @brief 设置子作用域记录栈的最小耗时，为 0 时不记录子作用域
+     *
+     * 子作用域未超时、但耗时超过该值并且比父作用域中已记录的子作用域都慢时，会抓取一次栈，
+     * 父作用域超时后随报告一起上报
+     *
+     * @param threshold
+     */
+    void set_nested_threshold(std::chrono::nanoseconds threshold) {
+        get_nested_threshold_storage().store(static_cast<uint64_t>(threshold.count()), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 获取子作用域记录栈的最小耗时，不需要先获取单例，每个作用域析构时都会读取
+     *
+     * @return uint64_t 为 0 时不记录子作用域
+     */
+    static uint64_t get_nested_threshold_ns() {
+        return get_nested_threshold_storage().load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置抓取栈的深度
+     *
+     * @param depth
+     */
+    void set_max_depth(size_t depth) {
+        max_depth_.store(depth, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置抓取栈的实现方式
+     *
+     * @param backend
+     */
+    void set_unwind_backend(UnwindBackend backend) {
+        unwind_backend_.store(backend, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置聚合的栈的个数上限，超出后新的栈只上报不聚合
+     *
+     * @param max_stacks
+     */
+    void set_max_stacks(size_t max_stacks) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_stacks_ = max_stacks;
+    }
+
+    /**
+     * @brief 获取每个栈的超时延迟直方图，按总耗时从大到小排序
+     *
+     * @return std::vector<LatencyStackSnapshot>
+     */
+    std::vector<LatencyStackSnapshot> snapshot() const {
+        std::vector<LatencyStackSnapshot> snaps;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& item : stacks_) {
+                LatencyStackSnapshot snap;
+                snap.site_name_ = item.second->site_name;
+                snap.frames_ = item.first.frames;
+                snap.latency_ = item.second->histogram.snapshot();
+                snaps.push_back(std::move(snap));
+            }
+        }
+        std::sort(snaps.begin(), snaps.end(), [](const LatencyStackSnapshot& a, const LatencyStackSnapshot& b) {
+            return a.latency_.total_ns_ > b.latency_.total_ns_;
+        });
+        return snaps;
+    }
+
+    /**
+     * @brief 清空聚合的数据
+     *
+     */
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stacks_.clear();
+    }
+
+    /**
+     * @brief 输出聚合的数据，每个栈一段
+     *
+     * @param snaps
+     * @param printer 用于解析和输出栈帧
+     * @param os
+     */
+    static void format(const std::vector<LatencyStackSnapshot>& snaps, Printer& printer, std::ostream& os) {
+        for (const auto& snap : snaps) {
+            const LatencySnapshot& latency = snap.latency_;
+            os << "Slow scope \"" << snap.site_name_ << "\": count " << latency.count_
+                << ", total " << latency.total_ns_ / 1000 << " us"
+                << ", p50 " << std::min(latency.get_percentile_ns(0.5), latency.max_ns_) / 1000 << " us"
+                << ", p99 " << std::min(latency.get_percentile_ns(0.99), latency.max_ns_) / 1000 << " us"
+                << ", max " << latency.max_ns_ / 1000 << " us\n";
+            printer.print(0, resolve_frames(snap.frames_, printer.get_resolver()), os);
+            os << "\n";
+        }
+    }
+
+    /**
+     * @brief 解析栈帧地址
+     *
+     * @param frames
+     * @param resolver
+     * @return std::vector<ResolvedTrace>
+     */
+    static std::vector<ResolvedTrace> resolve_frames(const std::vector<void*>& frames, TraceResolver& resolver) {
+        std::vector<ResolvedTrace> resolved_traces;
+        resolved_traces.reserve(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            Trace trace;
+            trace.addr_ = frames[i];
+            trace.idx_ = i;
+            resolved_traces.push_back(resolver.resolve(trace));
+        }
+        return resolved_traces;
+    }
+
+private:
+    friend class LatencySite;
+    friend class LatencyScope;
+
+    LatencyMonitor() = default;
+
+    struct stack_key {
+        const LatencySite* site;
+        std::vector<void*> frames;
+
+        bool operator==(const stack_key& other) const {
+            return site == other.site && frames == other.frames;
+        }
+    };
+
+    struct stack_key_hash {
+        size_t operator()(const stack_key& key) const {
+            size_t hash = std::hash<const void*>()(key.site);
+            for (void* frame : key.frames) {
+                hash = hash * 31 + std::hash<void*>()(frame);
+            }
+            return hash;
+        }
+    };
+
+    struct stack_entry {
+        std::string site_name;
+        LatencyHistogram histogram;
+    };
+
+    void register_site(LatencySite* site);
+    void unregister_site(LatencySite* site);
+
+    /**
+     * @brief 抓取调用者的栈，跳过 skip 个栈帧
+     *
+     * @param skip
+     * @param frames
+     */
+    __attribute__((noinline))
+    void capture(size_t skip, std::vector<void*>* frames) {
+        StackTraceManager st;
+        st.set_unwind_backend(unwind_backend_.load(std::memory_order_relaxed));
+        st.load_trace(max_depth_.load(std::memory_order_relaxed) + skip + 1);
+        // load_trace 已跳过自身，再跳过本函数
+        st.set_skip_count(st.get_skip_count() + skip + 1);
+        frames->assign(st.begin(), st.begin() + st.get_size());
+        if (frames->size() > max_depth_.load(std::memory_order_relaxed)) {
+            frames->resize(max_depth_.load(std::memory_order_relaxed));
+        }
+    }
+
+    /**
+     * @brief 聚合并上报一次超时
+     *
+     * @param site
+     * @param report
+     */
+    void report(const LatencySite* site, const LatencyReport& report) {
+        reporter_t reporter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reporter = reporter_;
+            stack_key key{site, report.frames_};
+            auto it = stacks_.find(key);
+            if (it == stacks_.end() && stacks_.size() < max_stacks_) {
+                std::unique_ptr<stack_entry> entry(new stack_entry());
+                entry->site_name = report.site_name_;
+                it = stacks_.emplace(std::move(key), std::move(entry)).first;
+            }
+            if (it != stacks_.end()) {
+                it->second->histogram.record(report.elapsed_ns_);
+            }
+        }
+        if (reporter) {
+            reporter(report);
+        }
+    }
+
+    static std::atomic<uint64_t>& get_nested_threshold_storage() {
+        // 常量初始化，访问时没有局部静态变量的初始化检查
+        static std::atomic<uint64_t> nested_threshold_ns{0};
+        return nested_threshold_ns;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    reporter_t reporter_;
+    std::vector<LatencySite*> sites_;
+    // 通过 set_threshold 修改过的阈值
+    std::unordered_map<std::string, uint64_t> thresholds_;
+    std::unordered_map<stack_key, std::unique_ptr<stack_entry>, stack_key_hash> stacks_;
+    size_t max_stacks_{1024};
+    std::atomic<size_t> max_depth_{32};
+    std::atomic<UnwindBackend> unwind_backend_{UnwindBackend::BACKTRACE};
+};
+
+/**
+ * @brief 调用点，通常为静态变量，每个调用点有自己的阈值
+ *
+ */
+class LatencySite {
+public:
+    explicit LatencySite(const char* name, std::chrono::nanoseconds threshold = std::chrono::milliseconds(100))
+        : name_(name), threshold_ns_(static_cast<uint64_t>(threshold.count())) {
+        LatencyMonitor::instance().register_site(this);
+    }
+    ~LatencySite() {
+        LatencyMonitor::instance().unregister_site(this);
+    }
+    LatencySite(const LatencySite&) = delete;
+    LatencySite& operator=(const LatencySite&) = delete;
+    LatencySite(LatencySite&&) = delete;
+    LatencySite& operator=(LatencySite&&) = delete;
+
+public:
+    const char* get_name() const {
+        return name_;
+    }
+
+    uint64_t get_threshold_ns() const {
+        return threshold_ns_.load(std::memory_order_relaxed);
+    }
+
+    void set_threshold(std::chrono::nanoseconds threshold) {
+        threshold_ns_.store(static_cast<uint64_t>(threshold.count()), std::memory_order_relaxed);
+    }
+
+private:
+    const char* name_;
+    std::atomic<uint64_t> threshold_ns_;
+};
+
+/**
+ * @brief 作用域耗时超过调用点的阈值时抓取栈并上报
+ *
+ * 未超时的作用域只有构造和析构时的两次时钟读取，一个 thread_local 指针的保存和恢复，以及嵌套时子作用域阈值的一次读取；
+ * 抓栈、聚合和上报都只在超时（或开启了子作用域记录且子作用域足够慢）时发生
+ */
+class LatencyScope {
+public:
+    explicit LatencyScope(const LatencySite& site)
+        : site_(site), parent_(get_current()), begin_ns_(get_monotonic_ns()) {
+        get_current() = this;
+    }
+    // 必须内联到包含作用域的函数中，慢路径抓到的第一个栈帧才是该函数（-O0 时也是如此）
+    __attribute__((always_inline)) ~LatencyScope() {
+        uint64_t elapsed_ns = get_monotonic_ns() - begin_ns_;
+        get_current() = parent_;
+        if (elapsed_ns >= site_.get_threshold_ns()) {
+            on_slow(elapsed_ns);
+        } else if (parent_ != nullptr && elapsed_ns > parent_->slowest_child_ns_) {
+            // 未开启子作用域记录或未达到记录的阈值时不进入慢路径
+            uint64_t nested_threshold_ns = LatencyMonitor::get_nested_threshold_ns();
+            if (nested_threshold_ns != 0 && elapsed_ns >= nested_threshold_ns) {
+                on_slow_child(elapsed_ns);
+            }
+        }
+    }
+    LatencyScope(const LatencyScope&) = delete;
+    LatencyScope& operator=(const LatencyScope&) = delete;
+    LatencyScope(LatencyScope&&) = delete;
+    LatencyScope& operator=(LatencyScope&&) = delete;
+
+private:
+    struct child_capture {
+        const LatencySite* site;
+        uint64_t elapsed_ns;
+        std::vector<void*> frames;
+    };
+
+    static LatencyScope*& get_current() {
+        static thread_local LatencyScope* current = nullptr;
+        return current;
+    }
+
+    __attribute__((noinline))
+    void on_slow(uint64_t elapsed_ns) {
+        LatencyMonitor& monitor = LatencyMonitor::instance();
+        LatencyReport report;
+        report.site_name_ = site_.get_name();
+        report.elapsed_ns_ = elapsed_ns;
+        report.threshold_ns_ = site_.get_threshold_ns();
+        report.thread_id_ = static_cast<size_t>(syscall(SYS_gettid));
+        monitor.capture(1, &report.frames_);
+        if (slowest_child_) {
+            report.child_site_name_ = slowest_child_->site->get_name();
+            report.child_elapsed_ns_ = slowest_child_->elapsed_ns;
+            report.child_frames_ = std::move(slowest_child_->frames);
+        }
+        monitor.report(&site_, report);
+        // 超时的子作用域同样算作父作用域的慢子作用域
+        if (parent_ != nullptr && elapsed_ns > parent_->slowest_child_ns_
+            && monitor.get_nested_threshold_ns() != 0) {
+            parent_->set_slowest_child(&site_, elapsed_ns, std::move(report.frames_));
+        }
+    }
+
+    __attribute__((noinline))
+    void on_slow_child(uint64_t elapsed_ns) {
+        LatencyMonitor& monitor = LatencyMonitor::instance();
+        std::vector<void*> frames;
+        monitor.capture(1, &frames);
+        parent_->set_slowest_child(&site_, elapsed_ns, std::move(frames));
+    }
+
+    void set_slowest_child(const LatencySite* site, uint64_t elapsed_ns, std::vector<void*> frames) {
+        if (!slowest_child_) {
+            slowest_child_.reset(new child_capture());
+        }
+        slowest_child_->site = site;
+        slowest_child_->elapsed_ns = elapsed_ns;
+        slowest_child_->frames = std::move(frames);
+        slowest_child_ns_ = elapsed_ns;
+    }
+
+private:
+    const LatencySite& site_;
+    LatencyScope* parent_;
+    uint64_t begin_ns_;
+    uint64_t slowest_child_ns_{0};
+    std::unique_ptr<child_capture> slowest_child_;
+};
+
+inline void LatencyMonitor::set_threshold(const std::string& site_name, std::chrono::nanoseconds threshold) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    thresholds_[site_name] = static_cast<uint64_t>(threshold.count());
+    for (LatencySite* site : sites_) {
+        if (site_name == site->get_name()) {
+            site->set_threshold(threshold);
+        }
+    }
+}
+
+inline void LatencyMonitor::register_site(LatencySite* site) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sites_.push_back(site);
+    auto it = thresholds_.find(site->get_name());
+    if (it != thresholds_.end()) {
+        site->set_threshold(std::chrono::nanoseconds(it->second));
+    }
+}
+
+inline void LatencyMonitor::unregister_site(LatencySite* site) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sites_.erase(std::remove(sites_.begin(), sites_.end(), site), sites_.end());
+}
+
+}  // namespace stack_trace
+
+/**
+ * @brief 在当前作用域定义一个调用点和超时作用域，阈值可以通过 LatencyMonitor::set_threshold 按名字修改
+ *
+ */
+#define STACK_TRACE_LATENCY_CONCAT_IMPL(a, b) a##b
+#define STACK_TRACE_LATENCY_CONCAT(a, b) STACK_TRACE_LATENCY_CONCAT_IMPL(a, b)
+#define STACK_TRACE_LATENCY_SCOPE(name, threshold) \
+    static ::stack_trace::LatencySite STACK_TRACE_LATENCY_CONCAT(stack_trace_latency_site_, __LINE__)( \
+        name, threshold); \
+    ::stack_trace::LatencyScope STACK_TRACE_LATENCY_CONCAT(stack_trace_latency_scope_, __LINE__)( \
+        STACK_TRACE_LATENCY_CONCAT(stack_trace_latency_site_, __LINE__))
+
+#endif  // MONITOR_LATENCY_SCOPE_H_
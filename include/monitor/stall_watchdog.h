@@ -0,0 +1,659 @@
+/**
+ * @file stall_watchdog.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef MONITOR_STALL_WATCHDOG_H_
+#define MONITOR_STALL_WATCHDOG_H_
+
+#if defined(__x86_64__)
+
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "collect/unwind_cfi.h"
+#include "common/stats.h"
+#include "monitor/latency_scope.h"
+#include "printer/printer.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 看门狗的配置
+ *
+ */
+struct StallWatchdogOptions {
+    // 检查心跳的间隔，决定了发现停顿的精度
+    std::chrono::milliseconds check_interval{10};
+    // 停顿期间抓栈的间隔
+    std::chrono::milliseconds sample_interval{10};
+    // 一次停顿最多抓栈的次数，达到后不再抓栈并立即上报，之后这次停顿不再上报
+    size_t max_samples{100};
+    size_t max_depth{64};
+    // 信号处理函数中从栈顶拷贝的字节数，回溯只能还原这个范围内的栈帧
+    size_t stack_window{32 * 1024};
+    // 通知线程抓栈的信号，为 0 时使用 SIGRTMIN + 2
+    int signal{0};
+};
+
+/**
+ * @brief 停顿期间多次抓到的同一个栈
+ *
+ */
+struct StallStack {
+    // 调用者相同、只有正在执行的指令不同的栈合并为一个，第一个为第一次抓到时正在执行的指令
+    std::vector<void*> frames_;
+    size_t count_{0};
+};
+
+/**
+ * @brief 一次停顿
+ *
+ */
+struct StallReport {
+    std::string thread_name_;
+    size_t thread_id_{0};
+    uint64_t timeout_ns_{0};
+    // 从最后一次心跳到发现恢复（未恢复时为到上报时）的时间
+    uint64_t duration_ns_{0};
+    bool is_recovered_{false};
+    size_t sample_count_{0};
+    // 上一次的抓栈信号还没有被处理（如线程在不可中断的睡眠中）而跳过的次数
+    size_t missed_sample_count_{0};
+    // 停顿开始时或最后一次跳过抓栈时 /proc 中线程的状态（如 R、S、D）和阻塞的内核函数，读取不到时为空
+    char thread_state_{0};
+    std::string wchan_;
+    // 按抓到的次数从多到少排序，一次都没有抓到时为空
+    std::vector<StallStack> stacks_;
+};
+
+class StallWatchdog;
+
+/**
+ * @brief 被看门狗监控的线程，由 StallWatchdog::register_thread 创建
+ *
+ * 心跳只由所属线程调用，是一次对普通成员的加法和一次 relaxed 的原子写入
+ */
+class WatchedThread {
+public:
+    WatchedThread(const WatchedThread&) = delete;
+    WatchedThread& operator=(const WatchedThread&) = delete;
+    WatchedThread(WatchedThread&&) = delete;
+    WatchedThread& operator=(WatchedThread&&) = delete;
+
+public:
+    /**
+     * @brief 心跳，在事件循环的每一轮中调用
+     *
+     */
+    void heartbeat() {
+        sequence_ += 2;
+        beat_.store(sequence_, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 进入空闲（如阻塞在 epoll_wait 中），空闲期间不算作停顿，下一次 heartbeat 时结束空闲
+     *
+     */
+    void begin_idle() {
+        beat_.store(sequence_ | 1, std::memory_order_relaxed);
+    }
+
+    const std::string& get_name() const {
+        return name_;
+    }
+
+    size_t get_thread_id() const {
+        return static_cast<size_t>(tid_);
+    }
+
+private:
+    friend class StallWatchdog;
+
+    WatchedThread(const std::string& name, uint64_t timeout_ns, size_t stack_window)
+        : name_(name), timeout_ns_(timeout_ns), stack_(new uint8_t[stack_window]), stack_window_(stack_window) {}
+
+    // 抓栈请求的状态，由看门狗和信号处理函数通过 CAS 交接
+    enum CaptureState : uint32_t {
+        IDLE = 0,
+        REQUESTED,
+        CAPTURING,
+        CAPTURED,
+    };
+
+    // 所属线程写，看门狗读
+    std::atomic<uint64_t> beat_{0};
+    // 只由所属线程访问
+    uint64_t sequence_{0};
+
+    std::string name_;
+    uint64_t timeout_ns_;
+    pid_t tid_{0};
+    uintptr_t stack_begin_{0};
+    uintptr_t stack_end_{0};
+
+    // 信号处理函数写入的现场，状态为 CAPTURED 之后看门狗才读取
+    std::atomic<uint32_t> capture_state_{IDLE};
+    UnwindRegisters regs_;
+    uintptr_t stack_copy_begin_{0};
+    size_t stack_copy_size_{0};
+    std::unique_ptr<uint8_t[]> stack_;
+    size_t stack_window_;
+
+    // 以下只由看门狗在锁内访问
+    // 停顿结束时信号处理函数正在拷贝，拷贝的结果属于已经结束的停顿，取回时丢弃
+    bool is_capture_stale_{false};
+    uint64_t last_beat_{0};
+    uint64_t last_change_ns_{0};
+    bool is_stalled_{false};
+    bool is_reported_{false};
+    uint64_t last_sample_ns_{0};
+    StallReport report_;
+};
+
+/**
+ * @brief 线程停顿的看门狗
+ *
+ * 被监控的线程注册后在循环中调用 heartbeat；监控线程发现心跳超过阈值没有变化时，用信号通知停顿的线程，
+ * 在信号处理函数中只拷贝寄存器和栈顶内存（不加锁、不分配内存），监控线程不等待，在下一次检查时在拷贝上按 CFI 回溯。
+ * 停顿期间按间隔重复抓栈，上一次的信号还没有被处理时不再发送；线程恢复后把聚合的栈和停顿时长一起上报。
+ * 线程在不可中断的睡眠中（如读写磁盘、缺页）时抓不到栈，报告中只有停顿时长和 /proc 中线程的状态。
+ *
+ * 信号以 SA_RESTART 安装，但 epoll_wait、poll、nanosleep 等系统调用被信号打断后仍会返回 EINTR，
+ * 线程可能阻塞在这些调用中时，应在调用前使用 begin_idle
+ */
+class StallWatchdog {
+public:
+    using reporter_t = std::function<void(const StallReport&)>;
+
+public:
+    static StallWatchdog& instance() {
+        static StallWatchdog watchdog;
+        return watchdog;
+    }
+    StallWatchdog(const StallWatchdog&) = delete;
+    StallWatchdog& operator=(const StallWatchdog&) = delete;
+    StallWatchdog(StallWatchdog&&) = delete;
+    StallWatchdog& operator=(StallWatchdog&&) = delete;
+
+public:
+    /**
+     * @brief 安装信号处理函数并启动监控线程
+     *
+     * @param options
+     * @return true
+     * @return false 已经启动或信号安装失败
+     */
+    bool start(const StallWatchdogOptions& options = StallWatchdogOptions()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_running_) {
+            return false;
+        }
+        options_ = options;
+        int signo = options_.signal != 0 ? options_.signal : SIGRTMIN + 2;
+        // 信号处理函数安装后不再卸载：停顿结束时撤回的请求，其信号可能在之后才送达，卸载后会按默认行为终止进程
+        if (signo != signal_) {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            action.sa_sigaction = &signal_handler;
+            if (sigaction(signo, &action, nullptr) != 0) {
+                return false;
+            }
+            signal_ = signo;
+        }
+        uint64_t now_ns = get_monotonic_ns();
+        for (auto& thread : threads_) {
+            reset_stall(thread.get(), now_ns);
+        }
+        is_running_ = true;
+        monitor_thread_ = std::thread(&StallWatchdog::monitor_loop, this);
+        return true;
+    }
+
+    /**
+     * @brief 停止监控线程，仍在停顿中的线程以未恢复的状态上报
+     *
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!is_running_) {
+                return;
+            }
+            is_running_ = false;
+        }
+        cond_.notify_all();
+        monitor_thread_.join();
+        std::vector<StallReport> reports;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t now_ns = get_monotonic_ns();
+            for (auto& thread : threads_) {
+                finish_stall(thread.get(), now_ns, false, &reports);
+            }
+        }
+        deliver(reports);
+    }
+
+    /**
+     * @brief 设置停顿的上报函数，在监控线程中调用
+     *
+     * @param reporter
+     */
+    void set_reporter(reporter_t reporter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reporter_ = std::move(reporter);
+    }
+
+    /**
+     * @brief 注册当前线程，必须在被监控的线程中调用
+     *
+     * @param name
+     * @param timeout 超过这个时间没有心跳视为停顿
+     * @return WatchedThread* 由看门狗持有，unregister_thread 之前一直有效
+     */
+    WatchedThread* register_thread(const std::string& name,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+        uintptr_t stack_begin = 0;
+        uintptr_t stack_end = 0;
+        get_stack_range(&stack_begin, &stack_end);
+        WatchedThread* result = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::unique_ptr<WatchedThread> thread(new WatchedThread(name,
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count()),
+                options_.stack_window));
+            thread->tid_ = static_cast<pid_t>(syscall(SYS_gettid));
+            thread->stack_begin_ = stack_begin;
+            thread->stack_end_ = stack_end;
+            result = thread.get();
+            reset_stall(result, get_monotonic_ns());
+            // 信号处理函数通过线程局部变量找到自己，这里先访问一次，避免在信号处理函数中分配 TLS
+            get_current() = result;
+            threads_.push_back(std::move(thread));
+        }
+        return result;
+    }
+
+    /**
+     * @brief 取消注册，必须在被监控的线程中调用
+     *
+     * @param thread
+     */
+    void unregister_thread(WatchedThread* thread) {
+        std::vector<StallReport> reports;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = std::find_if(threads_.begin(), threads_.end(),
+                [thread](const std::unique_ptr<WatchedThread>& item) { return item.get() == thread; });
+            if (it == threads_.end()) {
+                return;
+            }
+            // 能调用到这里说明线程已经恢复
+            finish_stall(thread, get_monotonic_ns(), true, &reports);
+            get_current() = nullptr;
+            threads_.erase(it);
+        }
+        deliver(reports);
+    }
+
+    /**
+     * @brief 输出一次停顿
+     *
+     * @param report
+     * @param printer 用于解析和输出栈帧
+     * @param os
+     */
+    static void format(const StallReport& report, Printer& printer, std::ostream& os) {
+        os << "Thread \"" << report.thread_name_ << "\" (" << report.thread_id_ << ") stalled for "
+            << report.duration_ns_ / 1000000 << " ms" << (report.is_recovered_ ? "" : " (not recovered)")
+            << ", timeout " << report.timeout_ns_ / 1000000 << " ms, " << report.sample_count_ << " samples\n";
+        if (report.missed_sample_count_ != 0 || report.stacks_.empty()) {
+            os << report.missed_sample_count_ << " samples missed, thread state "
+                << (report.thread_state_ != 0 ? std::string(1, report.thread_state_) : std::string("unknown"));
+            if (!report.wchan_.empty()) {
+                os << ", wchan " << report.wchan_;
+            }
+            os << "\n";
+        }
+        for (const auto& stack : report.stacks_) {
+            os << stack.count_ << "/" << report.sample_count_ << " samples:\n";
+            printer.print(0, LatencyMonitor::resolve_frames(stack.frames_, printer.get_resolver()), os);
+        }
+    }
+
+private:
+    StallWatchdog() = default;
+
+    static WatchedThread*& get_current() {
+        static thread_local WatchedThread* current = nullptr;
+        return current;
+    }
+
+    /**
+     * @brief 获取当前线程的栈的地址范围，信号处理函数只在这个范围内拷贝
+     *
+     * @param begin
+     * @param end
+     */
+    static void get_stack_range(uintptr_t* begin, uintptr_t* end) {
+        *begin = 0;
+        *end = 0;
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return;
+        }
+        void* addr = nullptr;
+        size_t size = 0;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+            *begin = reinterpret_cast<uintptr_t>(addr);
+            *end = *begin + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    /**
+     * @brief 在停顿的线程中执行，只拷贝寄存器和栈顶内存；栈指针不在线程栈内时（如协程的栈）只保存寄存器
+     *
+     */
+    static void signal_handler(int, siginfo_t*, void* context) {
+        WatchedThread* thread = get_current();
+        if (thread == nullptr) {
+            return;
+        }
+        uint32_t expected = WatchedThread::REQUESTED;
+        if (!thread->capture_state_.compare_exchange_strong(expected, WatchedThread::CAPTURING,
+            std::memory_order_acquire)) {
+            return;
+        }
+        const ucontext_t* ucontext = static_cast<const ucontext_t*>(context);
+        thread->regs_.rip = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RIP]);
+        thread->regs_.rsp = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RSP]);
+        thread->regs_.rbp = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RBP]);
+        uintptr_t rsp = thread->regs_.rsp & ~uintptr_t(7);
+        thread->stack_copy_begin_ = rsp;
+        thread->stack_copy_size_ = 0;
+        if (rsp >= thread->stack_begin_ && rsp < thread->stack_end_) {
+            size_t size = std::min<size_t>(thread->stack_window_, thread->stack_end_ - rsp);
+            memcpy(thread->stack_.get(), reinterpret_cast<const void*>(rsp), size);
+            thread->stack_copy_size_ = size;
+        }
+        thread->capture_state_.store(WatchedThread::CAPTURED, std::memory_order_release);
+    }
+
+    void monitor_loop() {
+        uint64_t tick_ms = static_cast<uint64_t>(std::max<int64_t>(1,
+            std::min(options_.check_interval, options_.sample_interval).count()));
+        std::vector<StallReport> reports;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::milliseconds(tick_ms), [this] { return !is_running_; });
+                if (!is_running_) {
+                    break;
+                }
+                uint64_t now_ns = get_monotonic_ns();
+                for (auto& thread : threads_) {
+                    check(thread.get(), now_ns, &reports);
+                }
+            }
+            deliver(reports);
+            reports.clear();
+        }
+    }
+
+    /**
+     * @brief 检查一个线程的心跳，停顿中取回上一次抓到的栈并按间隔发起抓栈，恢复后生成报告
+     *
+     * @param thread
+     * @param now_ns
+     * @param reports
+     */
+    void check(WatchedThread* thread, uint64_t now_ns, std::vector<StallReport>* reports) {
+        uint64_t beat = thread->beat_.load(std::memory_order_relaxed);
+        if (beat != thread->last_beat_) {
+            finish_stall(thread, now_ns, true, reports);
+            thread->last_beat_ = beat;
+            thread->last_change_ns_ = now_ns;
+            return;
+        }
+        // 空闲中的线程不算作停顿，从空闲结束时重新计时
+        if ((beat & 1) != 0) {
+            thread->last_change_ns_ = now_ns;
+            return;
+        }
+        if (now_ns - thread->last_change_ns_ < thread->timeout_ns_ || thread->is_reported_) {
+            return;
+        }
+        if (!thread->is_stalled_) {
+            thread->is_stalled_ = true;
+            thread->last_sample_ns_ = 0;
+            thread->report_ = StallReport();
+            thread->report_.thread_name_ = thread->name_;
+            thread->report_.thread_id_ = static_cast<size_t>(thread->tid_);
+            thread->report_.timeout_ns_ = thread->timeout_ns_;
+            read_thread_state(thread->tid_, &thread->report_);
+        }
+        collect_sample(thread);
+        uint64_t sample_interval_ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(options_.sample_interval).count());
+        if (thread->last_sample_ns_ == 0 || now_ns - thread->last_sample_ns_ >= sample_interval_ns) {
+            thread->last_sample_ns_ = now_ns;
+            request_sample(thread);
+        }
+        const StallReport& report = thread->report_;
+        if (report.sample_count_ + report.missed_sample_count_ >= options_.max_samples) {
+            // 长时间不恢复（如死锁）时不再等待，先上报已有的栈
+            reports->push_back(take_report(thread, now_ns, false));
+            thread->is_reported_ = true;
+        }
+    }
+
+    /**
+     * @brief 通知线程抓栈，不等待，结果在之后的检查中由 collect_sample 取回。
+     * 上一次的信号还没有被处理时不再发送，记录一次跳过和线程当前的状态
+     *
+     * @param thread
+     */
+    void request_sample(WatchedThread* thread) {
+        uint32_t expected = WatchedThread::IDLE;
+        if (!thread->capture_state_.compare_exchange_strong(expected, WatchedThread::REQUESTED,
+            std::memory_order_acq_rel)) {
+            if (expected == WatchedThread::REQUESTED) {
+                ++thread->report_.missed_sample_count_;
+                read_thread_state(thread->tid_, &thread->report_);
+            }
+            return;
+        }
+        if (syscall(SYS_tgkill, getpid(), thread->tid_, signal_) != 0) {
+            thread->capture_state_.store(WatchedThread::IDLE, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 取回信号处理函数拷贝的现场，回溯后按调用者聚合
+     *
+     * @param thread
+     */
+    void collect_sample(WatchedThread* thread) {
+        if (thread->capture_state_.load(std::memory_order_acquire) != WatchedThread::CAPTURED) {
+            return;
+        }
+        if (thread->is_capture_stale_) {
+            thread->is_capture_stale_ = false;
+            thread->capture_state_.store(WatchedThread::IDLE, std::memory_order_relaxed);
+            return;
+        }
+        std::vector<void*> frames(options_.max_depth);
+        const uint8_t* stack = thread->stack_.get();
+        uintptr_t stack_begin = thread->stack_copy_begin_;
+        size_t stack_size = thread->stack_copy_size_;
+        auto read_word = [stack, stack_begin, stack_size](uintptr_t addr, uintptr_t* value) {
+            if (addr < stack_begin || addr - stack_begin + sizeof(uintptr_t) > stack_size) {
+                return false;
+            }
+            memcpy(value, stack + (addr - stack_begin), sizeof(uintptr_t));
+            return true;
+        };
+        size_t count = CFIUnwinder::instance().unwind_from(thread->regs_, true, frames.data(), frames.size(),
+            read_word);
+        thread->capture_state_.store(WatchedThread::IDLE, std::memory_order_relaxed);
+        frames.resize(count);
+        StallReport& report = thread->report_;
+        ++report.sample_count_;
+        // 循环中停顿时每次抓到的指令几乎都不同，只比较调用者，否则同一处停顿会分散成很多个栈
+        auto it = std::find_if(report.stacks_.begin(), report.stacks_.end(), [&frames](const StallStack& stack) {
+            return !stack.frames_.empty() && !frames.empty() && stack.frames_.size() == frames.size()
+                && std::equal(frames.begin() + 1, frames.end(), stack.frames_.begin() + 1);
+        });
+        if (it != report.stacks_.end()) {
+            ++it->count_;
+        } else {
+            StallStack stall_stack;
+            stall_stack.frames_ = std::move(frames);
+            stall_stack.count_ = 1;
+            report.stacks_.push_back(std::move(stall_stack));
+        }
+    }
+
+    /**
+     * @brief 撤回还没有被处理的抓栈请求，停顿结束时调用，避免上一次停顿的现场算入下一次停顿
+     *
+     * @param thread
+     */
+    static void cancel_sample(WatchedThread* thread) {
+        uint32_t expected = WatchedThread::REQUESTED;
+        // 撤回之后送达的信号，处理函数看到 IDLE 直接返回
+        if (thread->capture_state_.compare_exchange_strong(expected, WatchedThread::IDLE,
+            std::memory_order_acq_rel)) {
+            return;
+        }
+        if (expected == WatchedThread::CAPTURED) {
+            thread->capture_state_.store(WatchedThread::IDLE, std::memory_order_relaxed);
+        } else if (expected == WatchedThread::CAPTURING) {
+            thread->is_capture_stale_ = true;
+        }
+    }
+
+    /**
+     * @brief 读取 /proc 中线程的状态和阻塞的内核函数，用于抓不到栈的停顿
+     *
+     * @param tid
+     * @param report
+     */
+    static void read_thread_state(pid_t tid, StallReport* report) {
+        std::string task_dir = "/proc/self/task/" + std::to_string(tid);
+        std::ifstream stat_file(task_dir + "/stat");
+        std::string stat;
+        if (std::getline(stat_file, stat)) {
+            // 线程名中可能有空格和括号，状态在最后一个右括号之后
+            size_t pos = stat.rfind(')');
+            if (pos != std::string::npos && pos + 2 < stat.size()) {
+                report->thread_state_ = stat[pos + 2];
+            }
+        }
+        // 没有权限时内核返回 0
+        std::ifstream wchan_file(task_dir + "/wchan");
+        std::string wchan;
+        if (std::getline(wchan_file, wchan) && !wchan.empty() && wchan != "0") {
+            report->wchan_ = wchan;
+        }
+    }
+
+    /**
+     * @brief 结束一次停顿，还没有上报时生成报告，一次都没有抓到栈也上报
+     *
+     * @param thread
+     * @param now_ns
+     * @param is_recovered
+     * @param reports
+     */
+    void finish_stall(WatchedThread* thread, uint64_t now_ns, bool is_recovered, std::vector<StallReport>* reports) {
+        if (thread->is_stalled_ && !thread->is_reported_) {
+            reports->push_back(take_report(thread, now_ns, is_recovered));
+        }
+        cancel_sample(thread);
+        thread->report_ = StallReport();
+        thread->is_stalled_ = false;
+        thread->is_reported_ = false;
+    }
+
+    static StallReport take_report(WatchedThread* thread, uint64_t now_ns, bool is_recovered) {
+        StallReport report = std::move(thread->report_);
+        thread->report_ = StallReport();
+        report.duration_ns_ = now_ns - thread->last_change_ns_;
+        report.is_recovered_ = is_recovered;
+        std::sort(report.stacks_.begin(), report.stacks_.end(),
+            [](const StallStack& a, const StallStack& b) { return a.count_ > b.count_; });
+        return report;
+    }
+
+    static void reset_stall(WatchedThread* thread, uint64_t now_ns) {
+        thread->last_beat_ = thread->beat_.load(std::memory_order_relaxed);
+        thread->last_change_ns_ = now_ns;
+        thread->is_stalled_ = false;
+        thread->is_reported_ = false;
+        thread->report_ = StallReport();
+        cancel_sample(thread);
+    }
+
+    void deliver(const std::vector<StallReport>& reports) {
+        if (reports.empty()) {
+            return;
+        }
+        reporter_t reporter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reporter = reporter_;
+        }
+        if (!reporter) {
+            return;
+        }
+        for (const auto& report : reports) {
+            reporter(report);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    StallWatchdogOptions options_;
+    // 已安装处理函数的信号
+    int signal_{0};
+    bool is_running_{false};
+    std::thread monitor_thread_;
+    reporter_t reporter_;
+    std::vector<std::unique_ptr<WatchedThread>> threads_;
+};
+
+}  // namespace stack_trace
+
+#endif  // defined(__x86_64__)
+
+#endif  // MONITOR_STALL_WATCHDOG_H_
@@ -0,0 +1,562 @@
+/**
+ * @file flame_graph.h
+ * @author noahyzhang
+ * @brief
+ * @version 0.1
+ * @date 2023-06-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef OUTPUT_FLAME_GRAPH_H_
+#define OUTPUT_FLAME_GRAPH_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "collect/resolver.h"
+#include "collect/resolver_base.h"
+
+namespace stack_trace {
+
+/**
+ * @brief 火焰图的输出配置
+ *
+ */
+struct FlameGraphOptions {
+    std::string title{"Flame Graph"};
+    // 样本的单位，显示在每个栈帧的提示中
+    std::string count_name{"samples"};
+    size_t width{1200};
+    size_t frame_height{16};
+    // 宽度小于该像素的栈帧不输出，控制文件大小
+    double min_width{0.1};
+    // 倒置的火焰图（冰柱图），根在上方；输出后也可以在页面中切换
+    bool is_icicle{false};
+};
+
+/**
+ * @brief 火焰图：把栈合并成一棵前缀树，输出为可交互的独立 SVG（搜索、缩放、冰柱图、差分着色）
+ *
+ * 输入可以是 folded 格式（每行 "a;b;c 123"，根在前），也可以直接在进程内添加栈帧地址；
+ * 每一行读入后立即合并进树中，不保存样本，百万级的样本只占用与不同栈帧个数成正比的内存。
+ * 添加了基线（baseline）样本时为差分火焰图：宽度为当前样本，颜色表示相对基线的增减，红色增加，蓝色减少
+ */
+class FlameGraph {
+public:
+    FlameGraph() {
+        node root;
+        root.name = intern("all");
+        nodes_.push_back(root);
+    }
+    ~FlameGraph() = default;
+    FlameGraph(const FlameGraph&) = delete;
+    FlameGraph& operator=(const FlameGraph&) = delete;
+    FlameGraph(FlameGraph&&) = delete;
+    FlameGraph& operator=(FlameGraph&&) = delete;
+
+public:
+    /**
+     * @brief 添加一个栈
+     *
+     * @param frames 栈帧名，根在前
+     * @param count 样本数
+     * @param is_baseline 是否为差分的基线样本
+     */
+    void add_stack(const std::vector<std::string>& frames, uint64_t count, bool is_baseline = false) {
+        uint32_t idx = 0;
+        add_count(idx, count, is_baseline);
+        for (const auto& frame : frames) {
+            idx = get_child(idx, intern(frame));
+            add_count(idx, count, is_baseline);
+        }
+    }
+
+    /**
+     * @brief 添加一行 folded 格式的栈，支持 "stack count" 和差分的 "stack baseline_count count" 两种格式
+     *
+     * @param line
+     * @param is_baseline 单个计数时，计数是否为基线样本
+     * @return true
+     * @return false 格式错误
+     */
+    bool add_folded(const std::string& line, bool is_baseline = false) {
+        size_t end = line.find_last_not_of(" \t\r");
+        if (end == std::string::npos) {
+            return false;
+        }
+        size_t pos = line.find_last_of(" \t", end);
+        uint64_t count = 0;
+        if (pos == std::string::npos || !parse_count(line, pos + 1, end + 1, &count)) {
+            return false;
+        }
+        size_t stack_end = line.find_last_not_of(" \t", pos);
+        size_t base_pos = stack_end == std::string::npos ? std::string::npos : line.find_last_of(" \t", stack_end);
+        uint64_t base_count = 0;
+        bool is_diff = base_pos != std::string::npos && parse_count(line, base_pos + 1, stack_end + 1, &base_count);
+        if (is_diff) {
+            stack_end = line.find_last_not_of(" \t", base_pos);
+        }
+        if (stack_end == std::string::npos) {
+            return false;
+        }
+        uint32_t idx = 0;
+        add_counts(idx, is_diff, count, base_count, is_baseline);
+        // 输入通常是排过序的，相邻的行有很长的公共前缀，与上一行相同的部分直接复用节点，不用查哈希表
+        size_t depth = 0;
+        bool is_prefix = true;
+        for (size_t begin = 0; begin <= stack_end;) {
+            size_t sep = line.find(';', begin);
+            if (sep == std::string::npos || sep > stack_end) {
+                sep = stack_end + 1;
+            }
+            if (sep > begin) {
+                size_t len = sep - begin;
+                is_prefix = is_prefix && depth < prev_frames_.size()
+                    && prev_frames_[depth].compare(0, std::string::npos, line, begin, len) == 0;
+                if (is_prefix) {
+                    idx = prev_nodes_[depth];
+                } else {
+                    if (depth == prev_frames_.size()) {
+                        prev_frames_.emplace_back();
+                        prev_nodes_.emplace_back();
+                    }
+                    prev_frames_[depth].assign(line, begin, len);
+                    idx = get_child(idx, intern(prev_frames_[depth]));
+                    prev_nodes_[depth] = idx;
+                }
+                add_counts(idx, is_diff, count, base_count, is_baseline);
+                ++depth;
+            }
+            begin = sep + 1;
+        }
+        prev_frames_.resize(depth);
+        prev_nodes_.resize(depth);
+        return true;
+    }
+
+    /**
+     * @brief 逐行读取 folded 格式的输入并合并
+     *
+     * @param is
+     * @param is_baseline
+     * @return size_t 格式错误而被忽略的行数
+     */
+    size_t read_folded(std::istream& is, bool is_baseline = false) {
+        size_t error_count = 0;
+        std::string line;
+        while (std::getline(is, line)) {
+            if (!line.empty() && !add_folded(line, is_baseline)) {
+                ++error_count;
+            }
+        }
+        return error_count;
+    }
+
+    /**
+     * @brief 在进程内添加栈帧地址，每个不同的地址只解析一次
+     *
+     * @param frames 栈帧地址，叶子在前（与 StackTraceManager 的顺序一致）
+     * @param count
+     * @param resolver
+     * @param is_baseline
+     */
+    void add_frames(const std::vector<void*>& frames, uint64_t count, TraceResolver& resolver,
+        bool is_baseline = false) {
+        uint32_t idx = 0;
+        add_count(idx, count, is_baseline);
+        for (size_t i = frames.size(); i > 0; --i) {
+            idx = get_child(idx, intern_address(frames[i-1], resolver));
+            add_count(idx, count, is_baseline);
+        }
+    }
+
+    /**
+     * @brief 在进程内添加抓取到的栈，如 StackTraceManager
+     *
+     * @tparam ST
+     * @param st
+     * @param resolver
+     */
+    template <typename ST>
+    void add_stacktrace(const ST& st, TraceResolver& resolver) {
+        std::vector<void*> frames;
+        for (size_t i = 0; i < st.get_size(); ++i) {
+            frames.push_back(st[i].addr_);
+        }
+        add_frames(frames, 1, resolver);
+    }
+
+    /**
+     * @brief 获取栈帧在火焰图中的名字：函数名，没有符号时为 "模块名+0x偏移"
+     *
+     * @param resolved_trace
+     * @return std::string
+     */
+    static std::string get_frame_name(const ResolvedTrace& resolved_trace) {
+        if (!resolved_trace.source_loc_.function_.empty()) {
+            return resolved_trace.source_loc_.function_;
+        }
+        if (!resolved_trace.object_function_.empty()) {
+            return resolved_trace.object_function_;
+        }
+        std::ostringstream oss;
+        const std::string& object = resolved_trace.object_filename_;
+        size_t pos = object.rfind('/');
+        oss << (pos == std::string::npos ? object : object.substr(pos + 1)) << "+0x" << std::hex
+            << (uintptr_t(resolved_trace.addr_) - uintptr_t(resolved_trace.object_base_));
+        return oss.str();
+    }
+
+    /**
+     * @brief 获取样本总数
+     *
+     * @return uint64_t
+     */
+    uint64_t get_total() const {
+        return nodes_[0].value;
+    }
+
+    /**
+     * @brief 获取前缀树的节点个数
+     *
+     * @return size_t
+     */
+    size_t get_node_count() const {
+        return nodes_.size();
+    }
+
+    /**
+     * @brief 输出为 SVG，浏览器打开即可交互
+     *
+     * @param os
+     * @param options
+     */
+    void write_svg(std::ostream& os, const FlameGraphOptions& options = FlameGraphOptions()) const {
+        std::vector<std::vector<uint32_t>> children = get_sorted_children();
+        uint64_t total = std::max<uint64_t>(get_total(), 1);
+        double min_value = options.min_width * static_cast<double>(total) / static_cast<double>(options.width);
+        std::vector<layout_frame> frames;
+        size_t max_depth = 0;
+        layout(children, 0, 0, 0, min_value, &frames, &max_depth);
+
+        const size_t top = 50, bottom = 30;
+        size_t height = top + (max_depth + 1) * options.frame_height + bottom;
+        bool is_diff = nodes_[0].base_value != 0;
+        os << "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+           << "<svg version=\"1.1\" width=\"" << options.width << "\" height=\"" << height
+           << "\" onload=\"init(evt)\" viewBox=\"0 0 " << options.width << " " << height
+           << "\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+           << "<style type=\"text/css\">text { font-family: Verdana; font-size: 12px; fill: rgb(0,0,0); }"
+           << " .f:hover { stroke: black; stroke-width: 0.5; cursor: pointer; }"
+           << " .button { cursor: pointer; } .button:hover { fill: rgb(0,0,160); }</style>\n"
+           << "<rect x=\"0\" y=\"0\" width=\"100%\" height=\"100%\" fill=\"rgb(248,248,248)\"/>\n"
+           << "<text x=\"" << options.width / 2 << "\" y=\"24\" text-anchor=\"middle\" style=\"font-size: 17px\">"
+           << escape(options.title) << "</text>\n"
+           << "<text id=\"unzoom\" class=\"button\" x=\"10\" y=\"24\" style=\"opacity: 0\">Reset Zoom</text>\n"
+           << "<text id=\"icicle\" class=\"button\" x=\"" << options.width - 230 << "\" y=\"24\">"
+           << (options.is_icicle ? "Flame" : "Icicle") << "</text>\n"
+           << "<text id=\"search\" class=\"button\" x=\"" << options.width - 110 << "\" y=\"24\">Search</text>\n"
+           << "<text id=\"matched\" x=\"" << options.width - 110 << "\" y=\"" << height - 10 << "\"></text>\n"
+           << "<text id=\"details\" x=\"10\" y=\"" << height - 10 << "\"> </text>\n"
+           << "<g id=\"frames\">\n";
+        std::streamsize precision = os.precision(10);
+        for (const auto& frame : frames) {
+            const node& n = nodes_[frame.idx];
+            const std::string& name = names_[n.name];
+            os << "<g class=\"f\" data-x=\"" << frame.x / static_cast<double>(total) << "\" data-w=\""
+               << static_cast<double>(n.value) / static_cast<double>(total) << "\" data-d=\"" << frame.depth << "\">"
+               << "<title>" << escape(name) << " (" << n.value << " " << escape(options.count_name) << ", "
+               << format_percent(n.value, total);
+            if (is_diff) {
+                os << ", baseline " << n.base_value;
+            }
+            os << ")</title><rect height=\"" << options.frame_height - 1 << "\" rx=\"2\" fill=\""
+               << (is_diff ? get_diff_color(n) : get_color(name)) << "\"/><text></text></g>\n";
+        }
+        os.precision(precision);
+        os << "</g>\n";
+        write_script(os, options, max_depth, top);
+        os << "</svg>\n";
+    }
+
+private:
+    struct node {
+        uint32_t name{0};
+        uint64_t value{0};
+        uint64_t base_value{0};
+    };
+
+    struct layout_frame {
+        uint32_t idx;
+        size_t depth;
+        double x;
+    };
+
+    uint32_t intern(const std::string& name) {
+        auto it = name_ids_.find(name);
+        if (it != name_ids_.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(names_.size());
+        names_.push_back(name);
+        name_ids_.emplace(name, id);
+        return id;
+    }
+
+    uint32_t intern_address(void* addr, TraceResolver& resolver) {
+        auto it = address_ids_.find(addr);
+        if (it != address_ids_.end()) {
+            return it->second;
+        }
+        Trace trace;
+        trace.addr_ = addr;
+        uint32_t id = intern(get_frame_name(resolver.resolve(trace)));
+        address_ids_.emplace(addr, id);
+        return id;
+    }
+
+    uint32_t get_child(uint32_t parent, uint32_t name) {
+        uint64_t key = (static_cast<uint64_t>(parent) << 32) | name;
+        auto it = children_.find(key);
+        if (it != children_.end()) {
+            return it->second;
+        }
+        uint32_t idx = static_cast<uint32_t>(nodes_.size());
+        node child;
+        child.name = name;
+        nodes_.push_back(child);
+        children_.emplace(key, idx);
+        return idx;
+    }
+
+    void add_count(uint32_t idx, uint64_t count, bool is_baseline) {
+        (is_baseline ? nodes_[idx].base_value : nodes_[idx].value) += count;
+    }
+
+    void add_counts(uint32_t idx, bool is_diff, uint64_t count, uint64_t base_count, bool is_baseline) {
+        if (is_diff) {
+            nodes_[idx].value += count;
+            nodes_[idx].base_value += base_count;
+        } else {
+            add_count(idx, count, is_baseline);
+        }
+    }
+
+    static bool parse_count(const std::string& line, size_t begin, size_t end, uint64_t* count) {
+        if (begin >= end) {
+            return false;
+        }
+        uint64_t value = 0;
+        for (size_t i = begin; i < end; ++i) {
+            if (line[i] < '0' || line[i] > '9') {
+                return false;
+            }
+            value = value * 10 + static_cast<uint64_t>(line[i] - '0');
+        }
+        *count = value;
+        return true;
+    }
+
+    /**
+     * @brief 获取每个节点的子节点，按名字排序，与 flamegraph.pl 的顺序一致
+     *
+     * @return std::vector<std::vector<uint32_t>>
+     */
+    std::vector<std::vector<uint32_t>> get_sorted_children() const {
+        std::vector<std::vector<uint32_t>> children(nodes_.size());
+        for (const auto& item : children_) {
+            children[item.first >> 32].push_back(item.second);
+        }
+        for (auto& list : children) {
+            std::sort(list.begin(), list.end(), [this](uint32_t a, uint32_t b) {
+                return names_[nodes_[a].name] < names_[nodes_[b].name];
+            });
+        }
+        return children;
+    }
+
+    void layout(const std::vector<std::vector<uint32_t>>& children, uint32_t idx, size_t depth, double x,
+        double min_value, std::vector<layout_frame>* frames, size_t* max_depth) const {
+        // 用显式的栈代替递归，栈很深时也不会溢出
+        std::vector<layout_frame> pending;
+        pending.push_back(layout_frame{idx, depth, x});
+        while (!pending.empty()) {
+            layout_frame frame = pending.back();
+            pending.pop_back();
+            frames->push_back(frame);
+            *max_depth = std::max(*max_depth, frame.depth);
+            double child_x = frame.x;
+            for (uint32_t child : children[frame.idx]) {
+                double value = static_cast<double>(nodes_[child].value);
+                if (value >= min_value && value > 0) {
+                    pending.push_back(layout_frame{child, frame.depth + 1, child_x});
+                }
+                child_x += value;
+            }
+        }
+    }
+
+    static std::string escape(const std::string& s) {
+        std::string res;
+        res.reserve(s.size());
+        for (char c : s) {
+            switch (c) {
+            case '&': res += "&amp;"; break;
+            case '<': res += "&lt;"; break;
+            case '>': res += "&gt;"; break;
+            case '"': res += "&quot;"; break;
+            default: res += c; break;
+            }
+        }
+        return res;
+    }
+
+    static std::string format_percent(uint64_t value, uint64_t total) {
+        std::ostringstream oss;
+        oss.setf(std::ios::fixed);
+        oss.precision(2);
+        oss << 100.0 * static_cast<double>(value) / static_cast<double>(total) << "%";
+        return oss.str();
+    }
+
+    /**
+     * @brief 按名字哈希出暖色，同名的栈帧颜色相同
+     *
+     * @param name
+     * @return std::string
+     */
+    static std::string get_color(const std::string& name) {
+        uint32_t hash = 2166136261U;
+        for (char c : name) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 16777619U;
+        }
+        std::ostringstream oss;
+        oss << "rgb(" << 205 + hash % 50 << "," << (hash >> 8) % 230 << "," << (hash >> 16) % 55 << ")";
+        return oss.str();
+    }
+
+    /**
+     * @brief 差分着色：按占比的变化着色，增加为红色，减少为蓝色，颜色越深变化越大
+     *
+     * @param n
+     * @return std::string
+     */
+    std::string get_diff_color(const node& n) const {
+        double ratio = static_cast<double>(n.value) / static_cast<double>(std::max<uint64_t>(nodes_[0].value, 1));
+        double base_ratio = static_cast<double>(n.base_value)
+            / static_cast<double>(std::max<uint64_t>(nodes_[0].base_value, 1));
+        double delta = ratio - base_ratio;
+        double scale = std::max(ratio, base_ratio);
+        int intensity = scale > 0 ? static_cast<int>(210 * std::min(1.0, std::abs(delta) / scale)) : 0;
+        std::ostringstream oss;
+        if (delta > 0) {
+            oss << "rgb(255," << 255 - intensity << "," << 255 - intensity << ")";
+        } else {
+            oss << "rgb(" << 255 - intensity << "," << 255 - intensity << ",255)";
+        }
+        return oss.str();
+    }
+
+    static void write_script(std::ostream& os, const FlameGraphOptions& options, size_t max_depth, size_t top) {
+        os << "<script type=\"text/ecmascript\"><![CDATA[\n"
+           << "var W = " << options.width << ", FH = " << options.frame_height << ", TOP = " << top
+           << ", DEPTH = " << max_depth << ", icicle = " << (options.is_icicle ? "true" : "false") << ";\n"
+           << R"JS(var frames, zoom = {x: 0, w: 1, d: 0}, pattern = null;
+function $(id) { return document.getElementById(id); }
+function attr(g, name) { return parseFloat(g.getAttribute(name)); }
+function name_of(g) { var t = g.firstChild.textContent; return t.substring(0, t.lastIndexOf(" (")); }
+function init(evt) {
+    frames = Array.prototype.slice.call(document.querySelectorAll("g.f"));
+    frames.forEach(function(g) {
+        var rect = g.childNodes[1];
+        rect.setAttribute("data-fill", rect.getAttribute("fill"));
+        g.onclick = function() { zoom_to(g); };
+        g.onmouseover = function() { $("details").textContent = g.firstChild.textContent; };
+        g.onmouseout = function() { $("details").textContent = " "; };
+    });
+    $("unzoom").onclick = function() { zoom = {x: 0, w: 1, d: 0}; $("unzoom").style.opacity = 0; render(); };
+    $("icicle").onclick = function() { icicle = !icicle; $("icicle").textContent = icicle ? "Flame" : "Icicle"; render(); };
+    $("search").onclick = search_prompt;
+    window.addEventListener("keydown", function(e) {
+        if (e.keyCode === 114 || ((e.ctrlKey || e.metaKey) && e.keyCode === 70)) { e.preventDefault(); search_prompt(); }
+    });
+    render();
+}
+function zoom_to(g) {
+    zoom = {x: attr(g, "data-x"), w: attr(g, "data-w"), d: attr(g, "data-d")};
+    $("unzoom").style.opacity = 1;
+    render();
+}
+function render() {
+    var eps = 1e-7;
+    frames.forEach(function(g) {
+        var x = attr(g, "data-x"), w = attr(g, "data-w"), d = attr(g, "data-d"), px, pw;
+        if (x >= zoom.x - eps && x + w <= zoom.x + zoom.w + eps && d >= zoom.d) {
+            px = (x - zoom.x) / zoom.w * W; pw = w / zoom.w * W; g.style.opacity = 1;
+        } else if (d < zoom.d && x <= zoom.x + eps && x + w >= zoom.x + zoom.w - eps) {
+            px = 0; pw = W; g.style.opacity = 0.5;
+        } else {
+            pw = 0;
+        }
+        if (pw < 0.1) { g.style.display = "none"; return; }
+        g.style.display = "";
+        var y = icicle ? TOP + d * FH : TOP + (DEPTH - d) * FH;
+        var rect = g.childNodes[1], text = g.childNodes[2];
+        rect.setAttribute("x", px); rect.setAttribute("y", y); rect.setAttribute("width", pw);
+        text.setAttribute("x", px + 3); text.setAttribute("y", y + FH - 5);
+        var name = name_of(g), chars = Math.floor((pw - 6) / 7);
+        text.textContent = chars < 3 ? "" : (name.length <= chars ? name : name.substring(0, chars - 2) + "..");
+    });
+    highlight();
+}
+function search_prompt() {
+    var term = prompt("Search (regular expression)", pattern ? pattern.source : "");
+    if (term === null) { return; }
+    pattern = term ? new RegExp(term) : null;
+    highlight();
+}
+function highlight() {
+    var matches = [];
+    frames.forEach(function(g) {
+        var rect = g.childNodes[1], matched = pattern !== null && pattern.test(name_of(g));
+        rect.setAttribute("fill", matched ? "rgb(230,0,230)" : rect.getAttribute("data-fill"));
+        if (matched && g.style.display !== "none") { matches.push([attr(g, "data-x"), attr(g, "data-w")]); }
+    });
+    if (pattern === null) { $("matched").textContent = ""; return; }
+    matches.sort(function(a, b) { return a[0] - b[0]; });
+    var sum = 0, end = -1;
+    matches.forEach(function(m) {
+        var lo = Math.max(m[0], zoom.x, end), hi = Math.min(m[0] + m[1], zoom.x + zoom.w);
+        if (hi > lo) { sum += hi - lo; }
+        end = Math.max(end, m[0] + m[1]);
+    });
+    $("matched").textContent = "Matched: " + (100 * sum / zoom.w).toFixed(1) + "%";
+}
+)JS"
+           << "]]></script>\n";
+    }
+
+private:
+    std::vector<node> nodes_;
+    // (父节点 << 32 | 名字) 到子节点的映射
+    std::unordered_map<uint64_t, uint32_t> children_;
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, uint32_t> name_ids_;
+    std::unordered_map<void*, uint32_t> address_ids_;
+    // 上一行 folded 栈的各层栈帧名及对应的节点
+    std::vector<std::string> prev_frames_;
+    std::vector<uint32_t> prev_nodes_;
+};
+
+}  // namespace stack_trace
+
+#endif  // OUTPUT_FLAME_GRAPH_H_
@@ -18,6 +18,7 @@
 #include "collect/resolver.h"
 #include "collect/resolver_base.h"
 #include "common/file_stream.h"
+#include "common/stats.h"
 
 namespace stack_trace {
 
@@ -28,7 +29,10 @@ namespace stack_trace {
 class Printer {
 public:
     Printer() = default;
-    explicit Printer(bool is_address, bool is_object, bool is_reverse) {}
+    explicit Printer(bool is_address, bool is_object, bool is_reverse, ResolveLevel level = ResolveLevel::FULL)
+        : is_address_(is_address), is_object_(is_object), is_reverse_(is_reverse) {
+        resolver_.set_resolve_level(level);
+    }
     ~Printer() = default;
     Printer(const Printer&) = delete;
     Printer& operator=(const Printer&) = delete;
@@ -48,7 +52,13 @@ public:
     FILE* print(const ST& st, FILE* fp = stderr) {
         utils::CFileStreamBuf out_buf(fp);
         std::ostream os(&out_buf);
+        StatsRegistry& stats = StatsRegistry::instance();
+        uint64_t begin_ns = stats.is_enabled() ? get_monotonic_ns() : 0;
         print_stacktrace(st, os);
+        if (begin_ns != 0) {
+            stats.get_print_latency().record(get_monotonic_ns() - begin_ns);
+            stats.add_print_bytes(out_buf.get_written_size());
+        }
         return fp;
     }
 
@@ -62,10 +72,61 @@ public:
      */
     template <typename ST>
     std::ostream& print(const ST& st, std::ostream& os) {
+        StatsRegistry& stats = StatsRegistry::instance();
+        uint64_t begin_ns = stats.is_enabled() ? get_monotonic_ns() : 0;
+        std::streampos begin_pos = begin_ns != 0 ? os.tellp() : std::streampos(-1);
         print_stacktrace(st, os);
+        if (begin_ns != 0) {
+            stats.get_print_latency().record(get_monotonic_ns() - begin_ns);
+            // 不支持定位的流（如 std::cout）无法统计字节数
+            std::streampos end_pos = os.tellp();
+            if (begin_pos != std::streampos(-1) && end_pos != std::streampos(-1)) {
+                stats.add_print_bytes(static_cast<uint64_t>(end_pos - begin_pos));
+            }
+        }
+        return os;
+    }
+
+    /**
+     * @brief 输出已解析好的栈帧，如其他进程的堆栈
+     *
+     * @param thread_id
+     * @param traces 按调用顺序排列的栈帧，idx_ 为栈帧序号
+     * @param os
+     * @return std::ostream&
+     */
+    std::ostream& print(size_t thread_id, const std::vector<ResolvedTrace>& traces, std::ostream& os) {
+        print_header(os, thread_id);
+        if (is_reverse_) {
+            for (size_t trace_idx = traces.size(); trace_idx > 0; --trace_idx) {
+                print_trace(os, traces[trace_idx-1]);
+            }
+        } else {
+            for (const auto& trace : traces) {
+                print_trace(os, trace);
+            }
+        }
         return os;
     }
 
+    /**
+     * @brief 设置栈帧的解析程度，RAW 和 SYMBOL 级别不会读取 DWARF，适合大量输出堆栈的场景
+     *
+     * @param level
+     */
+    void set_resolve_level(ResolveLevel level) {
+        resolver_.set_resolve_level(level);
+    }
+
+    /**
+     * @brief 获取解析栈帧的对象，用于配置解析行为
+     *
+     * @return TraceResolver&
+     */
+    TraceResolver& get_resolver() {
+        return resolver_;
+    }
+
 private:
     /**
      * @brief 输出堆栈信息
@@ -113,8 +174,17 @@ private:
         os << "#" << std::left << std::setw(2) << trace.idx_ << std::right;
         bool already_indented = true;
         if (!trace.source_loc_.filename_.size() || is_object_) {
-            os << "   Object \"" << trace.object_filename_ << "\", at " << trace.addr_
-            << ", in " << trace.object_function_ << "\n";
+            os << "   Object \"" << trace.object_filename_ << "\"";
+            if (is_address_) {
+                os << ", at " << trace.addr_;
+            }
+            os << ", in ";
+            if (trace.object_function_.size() || !trace.is_object_found_) {
+                os << trace.object_function_;
+            } else {
+                print_object_offset(os, trace);
+            }
+            os << "\n";
             already_indented = false;
         }
         if (trace.source_loc_.filename_.size()) {
@@ -125,6 +195,18 @@ private:
         }
     }
 
+    /**
+     * @brief 输出模块名及模块内的偏移，形如 libc.so.6+0x29d90，可直接用于 addr2line
+     *
+     * @param os
+     * @param trace
+     */
+    void print_object_offset(std::ostream& os, const ResolvedTrace& trace) {
+        size_t pos = trace.object_filename_.rfind('/');
+        os << (pos == std::string::npos ? trace.object_filename_ : trace.object_filename_.substr(pos + 1))
+            << "+0x" << std::hex << (uintptr_t(trace.addr_) - uintptr_t(trace.object_base_)) << std::dec;
+    }
+
     /**
      * @brief 输出文件信息
      * 
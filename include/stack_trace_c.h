@@ -0,0 +1,91 @@
+/**
+ * @file stack_trace_c.h
+ * @author noahyzhang
+ * @brief libstack_trace 的 C 接口，供 C 及其他语言通过 FFI 调用
+ * @version 0.1
+ * @date 2023-06-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef STACK_TRACE_C_H_
+#define STACK_TRACE_C_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define STACK_TRACE_C_API __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief 解析程度，与 stack_trace::ResolveLevel 一致
+ *
+ */
+enum stack_trace_resolve_level {
+    STACK_TRACE_RESOLVE_RAW = 0,
+    STACK_TRACE_RESOLVE_SYMBOL = 1,
+    STACK_TRACE_RESOLVE_FULL = 2,
+};
+
+typedef struct stack_trace_resolver stack_trace_resolver_t;
+
+/**
+ * @brief 抓取当前线程的栈帧地址，第一个栈帧是调用 stack_trace_capture 的位置
+ *
+ * @param frames 输出的地址
+ * @param max_frames frames 的大小
+ * @return int 栈帧个数
+ */
+STACK_TRACE_C_API int stack_trace_capture(void** frames, int max_frames);
+
+/**
+ * @brief 创建解析对象，不是线程安全的
+ *
+ * @param level enum stack_trace_resolve_level
+ * @return stack_trace_resolver_t* 失败时为 NULL
+ */
+STACK_TRACE_C_API stack_trace_resolver_t* stack_trace_resolver_create(int level);
+
+STACK_TRACE_C_API void stack_trace_resolver_destroy(stack_trace_resolver_t* resolver);
+
+/**
+ * @brief 把单个地址解析为一行文本，形如 "function (file:line)"，没有源码信息时为 "function" 或 "object+0x..."
+ *
+ * @param resolver
+ * @param addr
+ * @param buf 输出的缓冲区，总是以 '\0' 结尾
+ * @param size buf 的大小
+ * @return int 完整结果的长度（不含 '\0'），大于等于 size 时表示被截断，与 snprintf 一致
+ */
+STACK_TRACE_C_API int stack_trace_resolve(stack_trace_resolver_t* resolver, void* addr, char* buf, size_t size);
+
+/**
+ * @brief 按 Printer 的格式把整个栈输出到缓冲区
+ *
+ * @param resolver
+ * @param frames
+ * @param count
+ * @param buf 输出的缓冲区，总是以 '\0' 结尾
+ * @param size buf 的大小
+ * @return int 完整结果的长度（不含 '\0'），大于等于 size 时表示被截断
+ */
+STACK_TRACE_C_API int stack_trace_format(stack_trace_resolver_t* resolver, void* const* frames, int count,
+    char* buf, size_t size);
+
+/**
+ * @brief 抓取当前线程的栈并输出到文件
+ *
+ * @param fp
+ * @param depth
+ */
+STACK_TRACE_C_API void stack_trace_print(FILE* fp, int depth);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // STACK_TRACE_C_H_
@@ -0,0 +1,176 @@
+/**
+ * @file stack_trace_lib.h
+ * @author noahyzhang
+ * @brief 编译好的 libstack_trace 的公开头文件，不依赖 libbfd 的头文件，可以在任意多个源文件中包含
+ * @version 0.1
+ * @date 2023-06-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef STACK_TRACE_LIB_H_
+#define STACK_TRACE_LIB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "collect/trace_types.h"
+
+#define STACK_TRACE_API __attribute__((visibility("default")))
+
+namespace stack_trace {
+
+/**
+ * @brief 解析后的栈帧
+ *
+ */
+struct StackFrame {
+    void* addr_{nullptr};
+    // 栈帧序号，0 为最内层
+    size_t idx_{0};
+    // 所在的 ELF 文件
+    std::string object_filename_;
+    // 模块的加载偏移，addr_ 减去它即为 ELF 中的虚拟地址
+    void* object_base_{nullptr};
+    // 符号表中的函数名
+    std::string object_function_;
+    // 以下来自 DWARF，只在 ResolveLevel::FULL 时有值
+    std::string function_;
+    std::string filename_;
+    uint32_t line_{0};
+};
+
+/**
+ * @brief 抓取到的栈帧地址，只保存地址，解析交给 SymbolResolver
+ *
+ */
+class STACK_TRACE_API StackTrace {
+public:
+    StackTrace() = default;
+    /**
+     * @brief 使用已有的栈帧地址，如其他方式抓取到的栈
+     *
+     * @param thread_id 为 0 时输出不带线程信息
+     * @param frames 最内层在前
+     */
+    StackTrace(size_t thread_id, std::vector<void*> frames) : thread_id_(thread_id), frames_(std::move(frames)) {}
+    ~StackTrace() = default;
+    StackTrace(const StackTrace&) = default;
+    StackTrace& operator=(const StackTrace&) = default;
+    StackTrace(StackTrace&&) = default;
+    StackTrace& operator=(StackTrace&&) = default;
+
+public:
+    /**
+     * @brief 抓取当前线程的栈，第一个栈帧是调用 capture 的位置
+     *
+     * @param depth 最大深度
+     * @param backend
+     * @return size_t 栈帧个数
+     */
+    size_t capture(size_t depth = 32, UnwindBackend backend = UnwindBackend::BACKTRACE);
+
+    size_t get_size() const {
+        return frames_.size();
+    }
+
+    void* operator[](size_t idx) const {
+        return idx < frames_.size() ? frames_[idx] : nullptr;
+    }
+
+    const std::vector<void*>& get_frames() const {
+        return frames_;
+    }
+
+    /**
+     * @brief 获取抓取栈的线程 ID
+     *
+     * @return size_t
+     */
+    size_t get_thread_id() const {
+        return thread_id_;
+    }
+
+private:
+    size_t thread_id_{0};
+    std::vector<void*> frames_;
+};
+
+/**
+ * @brief 解析和输出栈帧，libbfd 的实现隐藏在库中
+ *
+ * 内部有符号缓存，不是线程安全的，多个线程中使用时各自创建或自行加锁
+ */
+class STACK_TRACE_API SymbolResolver {
+public:
+    explicit SymbolResolver(ResolveLevel level = ResolveLevel::FULL);
+    ~SymbolResolver();
+    SymbolResolver(const SymbolResolver&) = delete;
+    SymbolResolver& operator=(const SymbolResolver&) = delete;
+    SymbolResolver(SymbolResolver&&) = delete;
+    SymbolResolver& operator=(SymbolResolver&&) = delete;
+
+public:
+    /**
+     * @brief 设置解析程度，只对之后解析的栈帧生效
+     *
+     * @param level
+     */
+    void set_resolve_level(ResolveLevel level);
+
+    /**
+     * @brief 解析单个地址
+     *
+     * @param addr
+     * @return StackFrame
+     */
+    StackFrame resolve(void* addr);
+
+    /**
+     * @brief 解析整个栈
+     *
+     * @param st
+     * @return std::vector<StackFrame>
+     */
+    std::vector<StackFrame> resolve(const StackTrace& st);
+
+    /**
+     * @brief 按 Printer 的格式输出
+     *
+     * @param st
+     * @param os
+     * @return std::ostream&
+     */
+    std::ostream& print(const StackTrace& st, std::ostream& os);
+    FILE* print(const StackTrace& st, FILE* fp = stderr);
+
+    /**
+     * @brief 输出为字符串
+     *
+     * @param st
+     * @return std::string
+     */
+    std::string to_string(const StackTrace& st);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * @brief 抓取当前线程的栈并输出，用于简单的调试场景
+ *
+ * @param fp
+ * @param depth
+ */
+STACK_TRACE_API void print_stacktrace(FILE* fp = stderr, size_t depth = 32);
+
+}  // namespace stack_trace
+
+#endif  // STACK_TRACE_LIB_H_
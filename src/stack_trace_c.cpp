@@ -0,0 +1,143 @@
+/**
+ * @file stack_trace_c.cpp
+ * @author noahyzhang
+ * @brief stack_trace_c.h 的实现，异常不会穿过 C 接口
+ * @version 0.1
+ * @date 2023-06-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "stack_trace_c.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "stack_trace_lib.h"
+
+struct stack_trace_resolver {
+    explicit stack_trace_resolver(stack_trace::ResolveLevel level) : resolver(level) {}
+    stack_trace::SymbolResolver resolver;
+};
+
+namespace {
+
+stack_trace::ResolveLevel to_resolve_level(int level) {
+    switch (level) {
+    case STACK_TRACE_RESOLVE_RAW:
+        return stack_trace::ResolveLevel::RAW;
+    case STACK_TRACE_RESOLVE_SYMBOL:
+        return stack_trace::ResolveLevel::SYMBOL;
+    default:
+        return stack_trace::ResolveLevel::FULL;
+    }
+}
+
+std::string format_frame(const stack_trace::StackFrame& frame) {
+    std::ostringstream oss;
+    if (!frame.filename_.empty()) {
+        oss << frame.function_ << " (" << frame.filename_ << ":" << frame.line_ << ")";
+    } else if (!frame.object_function_.empty()) {
+        oss << frame.object_function_;
+    } else {
+        size_t pos = frame.object_filename_.rfind('/');
+        oss << (pos == std::string::npos ? frame.object_filename_ : frame.object_filename_.substr(pos + 1))
+            << "+0x" << std::hex << (uintptr_t(frame.addr_) - uintptr_t(frame.object_base_));
+    }
+    return oss.str();
+}
+
+/**
+ * @brief 按 snprintf 的语义拷贝到调用者的缓冲区
+ *
+ * @param str
+ * @param buf
+ * @param size
+ * @return int
+ */
+int copy_out(const std::string& str, char* buf, size_t size) {
+    if (buf != nullptr && size > 0) {
+        size_t len = std::min(str.size(), size - 1);
+        memcpy(buf, str.data(), len);
+        buf[len] = '\0';
+    }
+    return static_cast<int>(str.size());
+}
+
+}  // namespace
+
+extern "C" {
+
+__attribute__((noinline))
+int stack_trace_capture(void** frames, int max_frames) {
+    if (frames == nullptr || max_frames <= 0) {
+        return 0;
+    }
+    try {
+        stack_trace::StackTrace st;
+        // 多抓一层，跳过 stack_trace_capture 自己
+        st.capture(static_cast<size_t>(max_frames) + 1);
+        int count = 0;
+        for (size_t i = 1; i < st.get_size() && count < max_frames; ++i) {
+            frames[count++] = st[i];
+        }
+        return count;
+    } catch (...) {
+        return 0;
+    }
+}
+
+stack_trace_resolver_t* stack_trace_resolver_create(int level) {
+    return new (std::nothrow) stack_trace_resolver(to_resolve_level(level));
+}
+
+void stack_trace_resolver_destroy(stack_trace_resolver_t* resolver) {
+    delete resolver;
+}
+
+int stack_trace_resolve(stack_trace_resolver_t* resolver, void* addr, char* buf, size_t size) {
+    if (resolver == nullptr) {
+        return copy_out(std::string(), buf, size);
+    }
+    try {
+        return copy_out(format_frame(resolver->resolver.resolve(addr)), buf, size);
+    } catch (...) {
+        return copy_out(std::string(), buf, size);
+    }
+}
+
+int stack_trace_format(stack_trace_resolver_t* resolver, void* const* frames, int count, char* buf, size_t size) {
+    if (resolver == nullptr || frames == nullptr || count < 0) {
+        return copy_out(std::string(), buf, size);
+    }
+    try {
+        stack_trace::StackTrace st(0, std::vector<void*>(frames, frames + count));
+        std::ostringstream oss;
+        resolver->resolver.print(st, oss);
+        return copy_out(oss.str(), buf, size);
+    } catch (...) {
+        return copy_out(std::string(), buf, size);
+    }
+}
+
+__attribute__((noinline))
+void stack_trace_print(FILE* fp, int depth) {
+    try {
+        // 多抓一层，跳过 stack_trace_print 自己
+        stack_trace::StackTrace st;
+        st.capture(depth > 0 ? static_cast<size_t>(depth) + 1 : 33);
+        std::vector<void*> frames(st.get_frames());
+        if (!frames.empty()) {
+            frames.erase(frames.begin());
+        }
+        stack_trace::SymbolResolver resolver;
+        resolver.print(stack_trace::StackTrace(st.get_thread_id(), std::move(frames)), fp != nullptr ? fp : stderr);
+    } catch (...) {
+    }
+}
+
+}  // extern "C"
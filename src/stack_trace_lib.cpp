@@ -0,0 +1,152 @@
+/**
+ * @file stack_trace_lib.cpp
+ * @author noahyzhang
+ * @brief stack_trace_lib.h 的实现，libbfd 只在这里被包含
+ * @version 0.1
+ * @date 2023-06-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "stack_trace_lib.h"
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include "collect/trace.h"
+#include "printer/printer.h"
+
+namespace stack_trace {
+
+namespace {
+
+/**
+ * @brief 把 StackTrace 适配为 Printer 和 TraceResolver 使用的栈的接口
+ *
+ */
+class frame_view {
+public:
+    explicit frame_view(const StackTrace& st) : st_(st) {}
+
+public:
+    size_t get_size() const {
+        return st_.get_size();
+    }
+
+    Trace operator[](size_t idx) const {
+        Trace res;
+        res.addr_ = st_[idx];
+        res.idx_ = idx;
+        return res;
+    }
+
+    void* const* begin() const {
+        return st_.get_size() ? &st_.get_frames()[0] : nullptr;
+    }
+
+    size_t get_thread_id() const {
+        return st_.get_thread_id();
+    }
+
+private:
+    const StackTrace& st_;
+};
+
+StackFrame to_stack_frame(const ResolvedTrace& resolved_trace) {
+    StackFrame frame;
+    frame.addr_ = resolved_trace.addr_;
+    frame.idx_ = resolved_trace.idx_;
+    frame.object_filename_ = resolved_trace.object_filename_;
+    frame.object_base_ = resolved_trace.object_base_;
+    frame.object_function_ = resolved_trace.object_function_;
+    frame.function_ = resolved_trace.source_loc_.function_;
+    frame.filename_ = resolved_trace.source_loc_.filename_;
+    frame.line_ = resolved_trace.source_loc_.line_;
+    return frame;
+}
+
+/**
+ * @brief 抓取调用者的栈
+ *
+ * @param depth
+ * @param skip 除了 load_trace 和 capture_stack 自己之外，还要跳过的栈帧个数
+ * @param backend
+ * @return StackTrace
+ */
+__attribute__((noinline))
+StackTrace capture_stack(size_t depth, size_t skip, UnwindBackend backend) {
+    StackTraceManager st;
+    st.set_unwind_backend(backend);
+    st.load_trace(depth + skip + 1);
+    st.set_skip_count(skip + 2);
+    std::vector<void*> frames(st.begin(), st.begin() + std::min(st.get_size(), depth));
+    return StackTrace(st.get_thread_id(), std::move(frames));
+}
+
+}  // namespace
+
+__attribute__((noinline))
+size_t StackTrace::capture(size_t depth, UnwindBackend backend) {
+    *this = capture_stack(depth, 1, backend);
+    return frames_.size();
+}
+
+/**
+ * @brief 解析的实现，使用 Printer 中的 TraceResolver，这样输出和解析共用同一份符号缓存
+ *
+ */
+class SymbolResolver::Impl {
+public:
+    explicit Impl(ResolveLevel level) : printer_(true, true, false, level) {}
+
+public:
+    Printer printer_;
+};
+
+SymbolResolver::SymbolResolver(ResolveLevel level) : impl_(new Impl(level)) {}
+
+SymbolResolver::~SymbolResolver() = default;
+
+void SymbolResolver::set_resolve_level(ResolveLevel level) {
+    impl_->printer_.set_resolve_level(level);
+}
+
+StackFrame SymbolResolver::resolve(void* addr) {
+    Trace trace;
+    trace.addr_ = addr;
+    return to_stack_frame(impl_->printer_.get_resolver().resolve(trace));
+}
+
+std::vector<StackFrame> SymbolResolver::resolve(const StackTrace& st) {
+    frame_view view(st);
+    TraceResolver& resolver = impl_->printer_.get_resolver();
+    resolver.load_stacktrace(view);
+    std::vector<StackFrame> frames;
+    frames.reserve(view.get_size());
+    for (size_t i = 0; i < view.get_size(); ++i) {
+        frames.push_back(to_stack_frame(resolver.resolve(view[i])));
+    }
+    return frames;
+}
+
+std::ostream& SymbolResolver::print(const StackTrace& st, std::ostream& os) {
+    return impl_->printer_.print(frame_view(st), os);
+}
+
+FILE* SymbolResolver::print(const StackTrace& st, FILE* fp) {
+    return impl_->printer_.print(frame_view(st), fp);
+}
+
+std::string SymbolResolver::to_string(const StackTrace& st) {
+    std::ostringstream oss;
+    print(st, oss);
+    return oss.str();
+}
+
+__attribute__((noinline))
+void print_stacktrace(FILE* fp, size_t depth) {
+    SymbolResolver resolver;
+    resolver.print(capture_stack(depth, 1, UnwindBackend::BACKTRACE), fp);
+}
+
+}  // namespace stack_trace
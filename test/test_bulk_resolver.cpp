@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "collect/bulk_resolver.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+__attribute__((noinline)) void target_function() {
+    __asm__ volatile("");
+}
+
+void test_zero_thread_count() {
+    BulkTraceResolver resolver(0, ResolveLevel::RAW);
+    check(resolver.get_thread_count() == 1, "zero thread count falls back to one resolver");
+}
+
+void test_resolve_addresses() {
+    BulkTraceResolver resolver(4);
+    uintptr_t base = reinterpret_cast<uintptr_t>(&target_function);
+    // 超过一个分区的地址，每个地址重复两次，再加一个不在任何模块中的地址
+    std::vector<void*> addresses;
+    for (size_t i = 0; i < BulkTraceResolver::PARTITION_SIZE + 10; ++i) {
+        addresses.push_back(reinterpret_cast<void*>(base + i));
+        addresses.push_back(reinterpret_cast<void*>(base + i));
+    }
+    addresses.push_back(reinterpret_cast<void*>(0x10));
+    std::unordered_map<void*, ResolvedTrace> result = resolver.resolve(addresses);
+    check(result.size() == BulkTraceResolver::PARTITION_SIZE + 11, "duplicate addresses are resolved once");
+
+    bool is_all_matched = true;
+    for (void* addr : addresses) {
+        auto it = result.find(addr);
+        if (it == result.end() || it->second.addr_ != addr) {
+            is_all_matched = false;
+        }
+    }
+    check(is_all_matched, "every input address has its own result");
+    check(!result[reinterpret_cast<void*>(base)].object_filename_.empty(), "address in the main program");
+    check(result[reinterpret_cast<void*>(0x10)].object_filename_.empty(), "address outside any module");
+}
+
+void test_resolve_module_offsets() {
+    BulkTraceResolver resolver(2, ResolveLevel::RAW);
+    std::string exe = "/proc/self/exe";
+    std::vector<ModuleOffset> offsets;
+    ModuleOffset offset;
+    offset.object_filename_ = exe;
+    offset.offset_ = 0x2000;
+    offsets.push_back(offset);
+    offset.offset_ = 0x1000;
+    offsets.push_back(offset);
+    // 重复的输入
+    offset.offset_ = 0x2000;
+    offsets.push_back(offset);
+    // 找不到调试文件的 build-id
+    ModuleOffset unknown;
+    unknown.build_id_ = "00000000000000000000";
+    unknown.offset_ = 0x3000;
+    offsets.push_back(unknown);
+
+    std::vector<ResolvedTrace> result = resolver.resolve(offsets);
+    check(result.size() == offsets.size(), "one result per input");
+    bool is_ordered = result.size() == offsets.size();
+    for (size_t i = 0; is_ordered && i < result.size(); ++i) {
+        is_ordered = result[i].idx_ == i
+            && reinterpret_cast<uintptr_t>(result[i].addr_) == offsets[i].offset_;
+    }
+    check(is_ordered, "results map back to the input order");
+    check(result.size() == 4 && result[0].object_filename_ == exe && result[2].object_filename_ == exe
+        && result[1].object_filename_ == exe, "results keep the module file");
+    check(result.size() == 4 && result[0].is_object_found_ && !result[3].is_object_found_,
+        "unknown build-id has no module");
+}
+
+int main() {
+    test_zero_thread_count();
+    test_resolve_addresses();
+    test_resolve_module_offsets();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_bulk_resolver passed\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "collect/caller.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static void* level0_address = nullptr;
+static void* level0_expected = nullptr;
+static void* level1_address = nullptr;
+static void* level1_expected = nullptr;
+
+__attribute__((noinline)) void callee() {
+    level0_address = get_caller_address(0);
+    level0_expected = __builtin_return_address(0);
+    level1_address = get_caller_address(1);
+    __asm__ volatile("");
+}
+
+__attribute__((noinline)) void middle() {
+    level1_expected = __builtin_return_address(0);
+    callee();
+    __asm__ volatile("");
+}
+
+__attribute__((noinline)) const char* named_callee() {
+    return get_caller_name();
+}
+
+void test_caller_address() {
+    middle();
+    check(level0_address != nullptr && level0_address == level0_expected, "level 0 is the return address");
+    check(level1_address != nullptr && level1_address == level1_expected, "level 1 follows the frame pointer");
+}
+
+void test_caller_name() {
+    // 同一个调用点调用多次
+    const char* names[3];
+    size_t sizes[3];
+    for (int i = 0; i < 3; ++i) {
+        names[i] = named_callee();
+        sizes[i] = CallerCache::instance().get_size();
+    }
+    check(names[0] != nullptr && names[0][0] != '\0', "caller name is not empty");
+    check(names[0] == names[1] && names[1] == names[2], "repeated calls return the same pointer");
+    check(sizes[0] == sizes[1] && sizes[1] == sizes[2], "a cached call site is not resolved again");
+    check(strcmp(CallerCache::instance().lookup(nullptr), "??") == 0, "null address");
+}
+
+void test_overflow() {
+    // 最小容量为 16，超过的调用点放不进哈希表
+    CallerCache cache(16);
+    cache.set_resolve_level(ResolveLevel::RAW);
+    uintptr_t base = reinterpret_cast<uintptr_t>(&callee);
+    std::vector<const char*> names;
+    for (uintptr_t i = 0; i < 40; ++i) {
+        names.push_back(cache.lookup(reinterpret_cast<void*>(base + i)));
+    }
+    check(cache.get_size() == 40, "every call site is resolved once");
+    bool is_stable = true;
+    for (uintptr_t i = 0; i < 40; ++i) {
+        const char* name = cache.lookup(reinterpret_cast<void*>(base + i));
+        is_stable = is_stable && name != nullptr && name == names[i];
+    }
+    check(is_stable, "call sites beyond the table keep their names");
+    check(cache.get_size() == 40, "overflowed call sites are not resolved again");
+}
+
+int main() {
+    test_caller_address();
+    test_caller_name();
+    test_overflow();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_caller passed\n");
+    return 0;
+}
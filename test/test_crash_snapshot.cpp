@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "collect/crash_snapshot_reader.h"
+
+#if defined(__x86_64__)
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static std::atomic<bool> is_stopped{false};
+static std::atomic<pid_t> worker_tid{0};
+
+__attribute__((noinline)) void worker_loop() {
+    worker_tid.store(static_cast<pid_t>(syscall(SYS_gettid)));
+    while (!is_stopped.load()) {
+        usleep(1000);
+    }
+}
+
+static bool contains_address_in(const std::vector<void*>& frames, void (*function)(), size_t size) {
+    uintptr_t begin = reinterpret_cast<uintptr_t>(function);
+    for (void* frame : frames) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(frame);
+        if (addr > begin && addr < begin + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_round_trip(const std::string& directory) {
+    CrashSnapshotOptions options;
+    options.directory = directory;
+    check(CrashSnapshotWriter::instance().install(options), "install snapshot writer");
+    std::thread worker(&worker_loop);
+    while (worker_tid.load() == 0) {
+        usleep(1000);
+    }
+
+    check(CrashSnapshotWriter::instance().dump(), "dump snapshot");
+    std::string first_path = CrashSnapshotWriter::instance().get_last_path();
+    check(CrashSnapshotWriter::instance().dump(), "dump snapshot again");
+    std::string second_path = CrashSnapshotWriter::instance().get_last_path();
+    check(first_path != second_path, "repeated dumps do not overwrite each other");
+    is_stopped.store(true);
+    worker.join();
+
+    CrashSnapshotReader reader;
+    check(reader.load(first_path), "load snapshot");
+    const CrashSnapshot& snapshot = reader.get_snapshot();
+    pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    check(snapshot.header_.pid_ == getpid(), "snapshot pid");
+    check(snapshot.header_.crashed_tid_ == tid, "snapshot tid");
+    check(snapshot.header_.signo_ == 0, "dump is not a crash");
+    check(!snapshot.modules_.empty(), "snapshot has modules");
+    check(snapshot.threads_.size() == 2, "snapshot has both threads");
+
+    bool is_self_found = false;
+    bool is_worker_found = false;
+    for (const auto& thread : snapshot.threads_) {
+        check((thread.record_.flags_ & CrashThreadRecord::FLAG_CAPTURED) != 0, "thread is captured");
+        check(thread.stack_.size() == thread.record_.stack_size_, "stack size matches the record");
+        std::vector<void*> frames = reader.unwind(thread);
+        check(!frames.empty(), "unwind the saved stack");
+        if (thread.record_.tid_ == tid) {
+            is_self_found = true;
+            check((thread.record_.flags_ & CrashThreadRecord::FLAG_CRASHED) != 0, "dumping thread is flagged");
+        } else if (thread.record_.tid_ == worker_tid.load()) {
+            is_worker_found = true;
+            check(contains_address_in(frames, &worker_loop, 256), "worker stack contains worker_loop");
+        }
+    }
+    check(is_self_found && is_worker_found, "thread ids match");
+
+    // 截断的文件和计数超出文件大小的文件都应该被拒绝
+    std::ifstream ifs(first_path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::string truncated_path = directory + "/truncated.snapshot";
+    std::ofstream(truncated_path, std::ios::binary) << content.substr(0, content.size() - 1);
+    check(!reader.load(truncated_path), "reject truncated snapshot");
+
+    CrashSnapshotHeader header;
+    memcpy(&header, content.data(), sizeof(header));
+    header.thread_count_ = 0xffffffff;
+    std::string corrupt = content;
+    memcpy(&corrupt[0], &header, sizeof(header));
+    std::string corrupt_path = directory + "/corrupt.snapshot";
+    std::ofstream(corrupt_path, std::ios::binary) << corrupt;
+    check(!reader.load(corrupt_path), "reject thread count larger than the file");
+}
+
+int main() {
+    char dir_template[] = "/tmp/test_crash_snapshot_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string directory = dir_template;
+    test_round_trip(directory);
+    std::string command = "rm -rf " + directory;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "failed to remove %s\n", directory.c_str());
+    }
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_crash_snapshot passed\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    return 0;
+}
+
+#endif  // defined(__x86_64__)
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "collect/debug_file.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static void append_u32(std::vector<unsigned char>* data, uint32_t value) {
+    unsigned char bytes[4];
+    memcpy(bytes, &value, sizeof(bytes));
+    data->insert(data->end(), bytes, bytes + sizeof(bytes));
+}
+
+static void append_note(std::vector<unsigned char>* data, const char* name, uint32_t type,
+    const std::vector<unsigned char>& desc) {
+    uint32_t name_size = static_cast<uint32_t>(strlen(name) + 1);
+    append_u32(data, name_size);
+    append_u32(data, static_cast<uint32_t>(desc.size()));
+    append_u32(data, type);
+    data->insert(data->end(), name, name + name_size);
+    data->resize((data->size() + 3) & ~static_cast<size_t>(3));
+    data->insert(data->end(), desc.begin(), desc.end());
+    data->resize((data->size() + 3) & ~static_cast<size_t>(3));
+}
+
+static bool write_file(const std::string& path, const std::string& content) {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool is_written = fwrite(content.data(), 1, content.size(), fp) == content.size();
+    fclose(fp);
+    return is_written;
+}
+
+void test_crc32() {
+    const unsigned char* check_value = reinterpret_cast<const unsigned char*>("123456789");
+    check(DebugFileLocator::crc32(0, check_value, 9) == 0xcbf43926U, "crc32 check value");
+    check(DebugFileLocator::crc32(0, check_value, 0) == 0, "crc32 of empty input");
+    uint32_t crc = DebugFileLocator::crc32(0, check_value, 4);
+    check(DebugFileLocator::crc32(crc, check_value + 4, 5) == 0xcbf43926U, "crc32 accumulates across chunks");
+    const unsigned char* fox = reinterpret_cast<const unsigned char*>("The quick brown fox jumps over the lazy dog");
+    check(DebugFileLocator::crc32(0, fox, 43) == 0x414fa339U, "crc32 of a sentence");
+}
+
+void test_parse_build_id_note() {
+    std::vector<unsigned char> desc;
+    for (unsigned char i = 0; i < 20; ++i) {
+        desc.push_back(static_cast<unsigned char>(i * 13));
+    }
+    std::vector<unsigned char> note;
+    // 前面的其他 note 应该被跳过
+    append_note(&note, "GNU", 1, std::vector<unsigned char>(16, 0xff));
+    append_note(&note, "GNU", 3, desc);
+    check(DebugFileLocator::parse_build_id_note(note.data(), note.size())
+        == "000d1a2734414e5b6875828f9ca9b6c3d0ddeaf7", "parse build-id after another note");
+
+    std::vector<unsigned char> other_owner;
+    append_note(&other_owner, "XYZ", 3, desc);
+    check(DebugFileLocator::parse_build_id_note(other_owner.data(), other_owner.size()).empty(),
+        "ignore notes of other owners");
+    check(DebugFileLocator::parse_build_id_note(note.data(), note.size() - 4).empty(), "reject truncated note");
+    check(DebugFileLocator::parse_build_id_note(note.data(), 8).empty(), "reject short note header");
+}
+
+void test_parse_debuglink() {
+    // "prog.debug\0" 共 11 字节，对齐到 12 后是 CRC
+    std::vector<unsigned char> data;
+    const char* name = "prog.debug";
+    data.insert(data.end(), name, name + strlen(name) + 1);
+    data.resize(12);
+    append_u32(&data, 0x12345678U);
+    std::string debuglink;
+    uint32_t crc = 0;
+    check(DebugFileLocator::parse_debuglink(data.data(), data.size(), &debuglink, &crc), "parse debuglink");
+    check(debuglink == "prog.debug" && crc == 0x12345678U, "debuglink name and crc");
+    check(!DebugFileLocator::parse_debuglink(data.data(), data.size() - 1, &debuglink, &crc),
+        "reject debuglink without a complete crc");
+    check(!DebugFileLocator::parse_debuglink(data.data(), 10, &debuglink, &crc), "reject name without nul");
+    unsigned char empty_name[8] = {0};
+    check(!DebugFileLocator::parse_debuglink(empty_name, sizeof(empty_name), &debuglink, &crc),
+        "reject empty name");
+}
+
+void test_find(const std::string& dir) {
+    std::string content = "debug info";
+    uint32_t crc = DebugFileLocator::crc32(0, reinterpret_cast<const unsigned char*>(content.data()),
+        content.size());
+    check(mkdir((dir + "/.debug").c_str(), 0755) == 0, "create .debug directory");
+    check(write_file(dir + "/prog", "program"), "write program");
+    check(write_file(dir + "/.debug/prog.debug", content), "write debug file");
+
+    DebugFileLocator locator;
+    locator.set_search_roots(std::vector<std::string>(1, dir + "/root"));
+    check(locator.find_by_debuglink(dir + "/prog", "prog.debug", crc) == dir + "/.debug/prog.debug",
+        "find debuglink in .debug");
+    check(locator.find_by_debuglink(dir + "/prog", "prog.debug", crc + 1).empty(), "reject crc mismatch");
+
+    // 不带目录的文件名在当前目录中查找
+    char cwd[4096];
+    check(getcwd(cwd, sizeof(cwd)) != nullptr && chdir(dir.c_str()) == 0, "enter test directory");
+    check(locator.find_by_debuglink("prog", "prog.debug", crc) == "./.debug/prog.debug",
+        "find debuglink of a bare file name");
+    check(chdir(cwd) == 0, "leave test directory");
+
+    std::string build_id = "abcdef0123";
+    check(mkdir((dir + "/root").c_str(), 0755) == 0 && mkdir((dir + "/root/.build-id").c_str(), 0755) == 0
+        && mkdir((dir + "/root/.build-id/ab").c_str(), 0755) == 0, "create build-id directory");
+    check(write_file(dir + "/root/.build-id/ab/cdef0123.debug", content), "write build-id debug file");
+    check(locator.find_by_build_id(build_id) == dir + "/root/.build-id/ab/cdef0123.debug", "find by build-id");
+    check(locator.find_by_build_id("ab").empty(), "reject too short build-id");
+}
+
+int main() {
+    char dir_template[] = "/tmp/test_debug_file_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dir_template;
+    test_crc32();
+    test_parse_build_id_note();
+    test_parse_debuglink();
+    test_find(dir);
+    std::string command = "rm -rf " + dir;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir.c_str());
+    }
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_debug_file passed\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+#define STACK_TRACE_EXCEPTION_HOOK
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include "collect/exception_trace.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+// 第一个基类不是 std::exception，以 std::exception 引用捕获时对象地址与引用地址不同
+struct Tagged {
+    virtual ~Tagged() = default;
+    int tag_{0};
+};
+
+struct TaggedError : public Tagged, public std::runtime_error {
+    TaggedError() : std::runtime_error("tagged") {}
+};
+
+__attribute__((noinline)) void throw_runtime_error() {
+    throw std::runtime_error("runtime");
+}
+
+__attribute__((noinline)) void throw_tagged_error() {
+    throw TaggedError();
+}
+
+__attribute__((noinline)) void throw_logic_error() {
+    throw std::logic_error("logic");
+}
+
+__attribute__((noinline)) void throw_out_of_range() {
+    throw std::out_of_range("out of range");
+}
+
+// 测试以 -rdynamic 链接，dladdr 可以找到主程序中的函数；
+// 抛出异常的调用不会返回，返回地址可能已经在下一个函数中，减一后再查找
+static bool is_first_frame_in(const ThrowTrace& trace, void (*function)()) {
+    if (!trace.is_valid()) {
+        return false;
+    }
+    Dl_info info;
+    void* addr = static_cast<char*>(trace[0].addr_) - 1;
+    return dladdr(addr, &info) != 0 && info.dli_saddr == reinterpret_cast<void*>(function);
+}
+
+void test_find_by_base_reference(const char* backend) {
+    std::string prefix = std::string(backend) + ": ";
+    try {
+        throw_tagged_error();
+    } catch (const std::exception& e) {
+        ThrowTrace trace = ExceptionTracer::instance().find(e);
+        check(is_first_frame_in(trace, &throw_tagged_error), (prefix + "find through a base reference").c_str());
+        check(trace.get_type_name() == "TaggedError", (prefix + "type of the thrown object").c_str());
+    }
+    try {
+        throw_runtime_error();
+    } catch (const std::runtime_error& e) {
+        check(is_first_frame_in(ExceptionTracer::instance().find(e), &throw_runtime_error),
+            (prefix + "first frame is the throw site").c_str());
+        check(is_first_frame_in(ExceptionTracer::instance().get_current(), &throw_runtime_error),
+            (prefix + "get_current in the catch block").c_str());
+    }
+}
+
+void test_nested() {
+    try {
+        throw_runtime_error();
+    } catch (const std::runtime_error& outer) {
+        try {
+            throw_logic_error();
+        } catch (const std::logic_error&) {
+            check(is_first_frame_in(ExceptionTracer::instance().get_current(), &throw_logic_error),
+                "get_current in the inner catch block");
+        }
+        check(is_first_frame_in(ExceptionTracer::instance().get_current(), &throw_runtime_error),
+            "get_current in the outer catch block");
+        check(is_first_frame_in(ExceptionTracer::instance().find(outer), &throw_runtime_error),
+            "find the outer exception after the inner one");
+    }
+    check(!ExceptionTracer::instance().get_current().is_valid(), "no current exception outside catch");
+}
+
+void test_sampling() {
+    ExceptionTracer::instance().set_sample_rate(2);
+    size_t valid_count = 0;
+    for (int i = 0; i < 4; ++i) {
+        try {
+            throw_runtime_error();
+        } catch (const std::exception& e) {
+            ThrowTrace trace = ExceptionTracer::instance().find(e);
+            valid_count += trace.is_valid() ? 1 : 0;
+            check(trace.get_type_name() == "std::runtime_error", "unsampled exception keeps its type");
+        }
+    }
+    check(valid_count == 2, "one of every two exceptions is sampled");
+    ExceptionTracer::instance().set_sample_rate(1);
+}
+
+static bool is_traced(void (*thrower)()) {
+    try {
+        thrower();
+    } catch (const std::exception& e) {
+        return ExceptionTracer::instance().find(e).is_valid();
+    }
+    return false;
+}
+
+void test_filters() {
+    ExceptionTracer& tracer = ExceptionTracer::instance();
+    check(tracer.add_type_filter(typeid(std::out_of_range)), "add type filter");
+    tracer.set_filter_mode(ExceptionFilterMode::INCLUDE);
+    check(is_traced(&throw_out_of_range), "included type is traced");
+    check(!is_traced(&throw_runtime_error), "other types are not traced in INCLUDE mode");
+    // 按精确类型匹配，std::out_of_range 的基类不匹配
+    check(!is_traced(&throw_logic_error), "base class does not match the filter");
+
+    tracer.set_filter_mode(ExceptionFilterMode::EXCLUDE);
+    check(!is_traced(&throw_out_of_range), "excluded type is not traced");
+    check(is_traced(&throw_runtime_error), "other types are traced in EXCLUDE mode");
+    tracer.clear_type_filters();
+    check(is_traced(&throw_out_of_range), "all types are traced without filters");
+}
+
+int main() {
+    ExceptionTracer& tracer = ExceptionTracer::instance();
+    check(!is_traced(&throw_runtime_error), "nothing is traced before enable");
+    tracer.enable();
+    test_find_by_base_reference("backtrace");
+#if defined(__x86_64__)
+    tracer.set_unwind_backend(UnwindBackend::CFI);
+    test_find_by_base_reference("cfi");
+    tracer.set_unwind_backend(UnwindBackend::BACKTRACE);
+#endif
+    test_nested();
+    test_sampling();
+    test_filters();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_exception_trace passed\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <sstream>
+#include <string>
+#include "printer/flame_graph.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static std::string to_svg(const FlameGraph& graph) {
+    std::ostringstream oss;
+    graph.write_svg(oss);
+    return oss.str();
+}
+
+void test_folded() {
+    FlameGraph graph;
+    std::istringstream iss(
+        "main;foo;bar 10\n"
+        "main;foo;baz 5\n"
+        "main;foo 3\n"
+        "\n"
+        "main;qux\t2\r\n"
+        "no_count\n"
+        "main;bad 12x\n");
+    check(graph.read_folded(iss) == 2, "two malformed lines are ignored");
+    check(graph.get_total() == 20, "total of the folded counts");
+    // all, main, foo, bar, baz, qux
+    check(graph.get_node_count() == 6, "common prefixes share nodes");
+
+    std::string svg = to_svg(graph);
+    check(svg.find("<title>foo (18 ") != std::string::npos, "inner frame sums its children");
+    check(svg.find("<title>qux (2 ") != std::string::npos, "tab separated count");
+    check(svg.find("baseline") == std::string::npos, "no baseline without diff input");
+}
+
+void test_diff() {
+    FlameGraph graph;
+    check(graph.add_folded("main;foo 4 10"), "diff line with both counts");
+    check(graph.add_folded("main;bar 6 0"), "diff line with a removed stack");
+    check(graph.add_folded("main;foo;new 0 7"), "diff line with a new stack");
+    check(!graph.add_folded("10"), "line without a stack");
+    check(graph.get_total() == 17, "total of the current counts");
+
+    std::string svg = to_svg(graph);
+    check(svg.find("<title>all (17 ") != std::string::npos
+        && svg.find("baseline 10)</title>") != std::string::npos, "root keeps both totals");
+    check(svg.find("<title>foo (17 ") != std::string::npos
+        && svg.find("baseline 4)</title>") != std::string::npos, "frame keeps both counts");
+}
+
+void test_baseline_files() {
+    // 两个单独的 folded 文件，一个作为基线
+    FlameGraph graph;
+    std::istringstream baseline("main;foo 8\n");
+    std::istringstream current("main;foo 2\nmain;bar 3\n");
+    check(graph.read_folded(baseline, true) == 0, "read baseline");
+    check(graph.read_folded(current) == 0, "read current");
+    check(graph.get_total() == 5, "baseline is not counted in the total");
+    std::string svg = to_svg(graph);
+    check(svg.find("baseline 8)</title>") != std::string::npos, "baseline count is kept");
+}
+
+int main() {
+    test_folded();
+    test_diff();
+    test_baseline_files();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_flame_graph passed\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include "monitor/latency_scope.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static std::vector<LatencyReport> reports;
+
+// 测试以 -rdynamic 链接，dladdr 可以找到主程序中的函数
+static bool is_address_in(void* frame, void (*function)()) {
+    Dl_info info;
+    return dladdr(frame, &info) != 0 && info.dli_saddr == reinterpret_cast<void*>(function);
+}
+
+__attribute__((noinline)) void slow_function() {
+    STACK_TRACE_LATENCY_SCOPE("slow", std::chrono::milliseconds(1));
+    usleep(5 * 1000);
+}
+
+__attribute__((noinline)) void fast_function() {
+    STACK_TRACE_LATENCY_SCOPE("fast", std::chrono::seconds(10));
+}
+
+__attribute__((noinline)) void late_function() {
+    STACK_TRACE_LATENCY_SCOPE("late", std::chrono::seconds(10));
+    usleep(5 * 1000);
+}
+
+__attribute__((noinline)) void inner_function() {
+    STACK_TRACE_LATENCY_SCOPE("inner", std::chrono::seconds(10));
+    usleep(3 * 1000);
+}
+
+__attribute__((noinline)) void outer_function() {
+    STACK_TRACE_LATENCY_SCOPE("outer", std::chrono::milliseconds(1));
+    inner_function();
+}
+
+void test_slow_scope() {
+    reports.clear();
+    slow_function();
+    check(reports.size() == 1, "slow scope is reported");
+    if (reports.size() == 1) {
+        const LatencyReport& report = reports[0];
+        check(strcmp(report.site_name_.c_str(), "slow") == 0, "report site name");
+        check(report.elapsed_ns_ >= report.threshold_ns_ && report.threshold_ns_ == 1000000, "elapsed over threshold");
+        check(!report.frames_.empty() && is_address_in(report.frames_[0], &slow_function),
+            "first frame is the enclosing function");
+        check(report.child_site_name_.empty(), "no child without nested threshold");
+    }
+    check(!LatencyMonitor::instance().snapshot().empty(), "slow scope is aggregated");
+}
+
+void test_fast_scope() {
+    reports.clear();
+    fast_function();
+    check(reports.empty(), "fast scope is not reported");
+}
+
+void test_threshold_by_name() {
+    // 调用点在第一次执行时注册，之前按名字设置的阈值同样生效
+    LatencyMonitor::instance().set_threshold("late", std::chrono::milliseconds(1));
+    reports.clear();
+    late_function();
+    check(reports.size() == 1 && reports[0].threshold_ns_ == 1000000, "threshold set before registration");
+}
+
+void test_nested() {
+    reports.clear();
+    outer_function();
+    check(reports.size() == 1 && reports[0].child_site_name_.empty(), "nested capture is off by default");
+
+    LatencyMonitor::instance().set_nested_threshold(std::chrono::milliseconds(1));
+    reports.clear();
+    outer_function();
+    check(reports.size() == 1, "outer scope is reported");
+    if (reports.size() == 1) {
+        const LatencyReport& report = reports[0];
+        check(report.site_name_ == "outer" && report.child_site_name_ == "inner", "slowest child is reported");
+        check(report.child_elapsed_ns_ >= 1000000 && report.child_elapsed_ns_ <= report.elapsed_ns_,
+            "child elapsed time");
+        check(!report.child_frames_.empty() && is_address_in(report.child_frames_[0], &inner_function),
+            "child frames start in the child's function");
+    }
+    LatencyMonitor::instance().set_nested_threshold(std::chrono::nanoseconds(0));
+}
+
+int main() {
+    LatencyMonitor::instance().set_reporter([](const LatencyReport& report) { reports.push_back(report); });
+    test_slow_scope();
+    test_fast_scope();
+    test_threshold_by_name();
+    test_nested();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_latency_scope passed\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "stack_trace_lib.h"
+
+using namespace stack_trace;
+
+// 定义在 test_lib_other.cpp 和 test_lib_c.c 中
+size_t capture_in_other_unit(StackTrace* st);
+std::string to_string_in_other_unit(const StackTrace& st);
+extern "C" int run_c_api_test(void);
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+void test_capture_and_resolve() {
+    StackTrace st;
+    check(st.capture() > 0, "capture in this unit");
+    SymbolResolver resolver(ResolveLevel::SYMBOL);
+    std::vector<StackFrame> frames = resolver.resolve(st);
+    check(frames.size() == st.get_size(), "one frame per address");
+    check(!frames.empty() && frames[0].idx_ == 0 && !frames[0].object_filename_.empty(), "first frame has a module");
+    check(!frames.empty() && frames[0].object_function_.find("test_capture_and_resolve") != std::string::npos,
+        "first frame is the capturing function");
+    check(!resolver.to_string(st).empty(), "format the stack");
+}
+
+void test_other_unit() {
+    // 两个源文件都只包含 stack_trace_lib.h，链接同一个库
+    StackTrace st;
+    check(capture_in_other_unit(&st) > 0, "capture in another unit");
+    SymbolResolver resolver(ResolveLevel::SYMBOL);
+    StackFrame frame = resolver.resolve(st[0]);
+    check(frame.object_function_.find("capture_in_other_unit") != std::string::npos,
+        "first frame is the function in the other unit");
+    check(to_string_in_other_unit(st) == resolver.to_string(st), "both units format the same way");
+}
+
+int main() {
+    test_capture_and_resolve();
+    test_other_unit();
+    failures += run_c_api_test();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_lib passed\n");
+    return 0;
+}
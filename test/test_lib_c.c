@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <string.h>
+#include "stack_trace_c.h"
+
+static int failures = 0;
+
+static void check(int condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+__attribute__((noinline)) static int capture_frames(void** frames, int max_frames) {
+    int count = stack_trace_capture(frames, max_frames);
+    __asm__ volatile("");
+    return count;
+}
+
+int run_c_api_test(void) {
+    void* frames[32];
+    int count = capture_frames(frames, 32);
+    check(count > 0, "capture from C");
+    check(capture_frames(frames, 0) == 0 && stack_trace_capture(NULL, 32) == 0, "capture with no room");
+
+    stack_trace_resolver_t* resolver = stack_trace_resolver_create(STACK_TRACE_RESOLVE_SYMBOL);
+    check(resolver != NULL, "create resolver");
+    if (resolver == NULL || count <= 0) {
+        return failures;
+    }
+
+    char buf[1024];
+    int len = stack_trace_resolve(resolver, frames[0], buf, sizeof(buf));
+    check(len > 0 && (size_t)len == strlen(buf), "resolve a frame");
+    // 截断时返回完整的长度，缓冲区仍以 '\0' 结尾
+    char small[4];
+    check(stack_trace_resolve(resolver, frames[0], small, sizeof(small)) == len && strlen(small) == 3,
+        "resolve into a short buffer");
+    check(stack_trace_resolve(resolver, frames[0], NULL, 0) == len, "measure without a buffer");
+    check(stack_trace_resolve(NULL, frames[0], buf, sizeof(buf)) == 0 && buf[0] == '\0', "null resolver");
+
+    int total = stack_trace_format(resolver, frames, count, buf, sizeof(buf));
+    check(total > 0, "format the stack");
+    check((size_t)total >= sizeof(buf) ? strlen(buf) == sizeof(buf) - 1 : strlen(buf) == (size_t)total,
+        "formatted length");
+    check(stack_trace_format(resolver, frames, count, small, sizeof(small)) == total && strlen(small) == 3,
+        "format into a short buffer");
+    stack_trace_resolver_destroy(resolver);
+    return failures;
+}
@@ -0,0 +1,15 @@
+#include <string>
+#include "stack_trace_lib.h"
+
+using namespace stack_trace;
+
+__attribute__((noinline)) size_t capture_in_other_unit(StackTrace* st) {
+    size_t size = st->capture();
+    __asm__ volatile("");
+    return size;
+}
+
+std::string to_string_in_other_unit(const StackTrace& st) {
+    SymbolResolver resolver(ResolveLevel::SYMBOL);
+    return resolver.to_string(st);
+}
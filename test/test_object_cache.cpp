@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include "collect/resolver.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static void* const ADDR = reinterpret_cast<void*>(0x1000);
+
+static ObjectCounters* get_counters(const std::string& object_filename) {
+    return StatsRegistry::instance().get_object_counters(object_filename);
+}
+
+void test_default_options() {
+    ObjectCacheOptions options;
+    check(options.max_bytes != 0 && options.max_fds != 0 && options.max_failed != 0,
+        "cache is bounded by default");
+}
+
+void test_negative_ttl(const std::string& dir) {
+    TraceResolver resolver;
+    ObjectCacheOptions options;
+    options.negative_ttl = std::chrono::milliseconds(50);
+    resolver.set_object_cache_options(options);
+    std::string missing = dir + "/missing";
+    ObjectCounters* counters = get_counters(missing);
+
+    resolver.resolve_in_object(missing, ADDR, nullptr);
+    resolver.resolve_in_object(missing, ADDR, nullptr);
+    check(counters->object_cache_misses_.load() == 1 && counters->object_cache_hits_.load() == 1,
+        "failed load is not retried within the negative ttl");
+    usleep(100 * 1000);
+    resolver.resolve_in_object(missing, ADDR, nullptr);
+    check(counters->object_cache_misses_.load() == 2, "failed load is retried after the negative ttl");
+}
+
+void test_failed_limit(const std::string& dir) {
+    TraceResolver resolver;
+    ObjectCacheOptions options;
+    options.max_failed = 2;
+    resolver.set_object_cache_options(options);
+    std::string first = dir + "/first";
+    std::string second = dir + "/second";
+    std::string third = dir + "/third";
+    resolver.resolve_in_object(first, ADDR, nullptr);
+    resolver.resolve_in_object(second, ADDR, nullptr);
+    resolver.resolve_in_object(third, ADDR, nullptr);
+    // 最早失败的记录被删除，再次解析时重新加载
+    resolver.resolve_in_object(first, ADDR, nullptr);
+    check(get_counters(first)->object_cache_misses_.load() == 2, "oldest failed entry is dropped");
+    resolver.resolve_in_object(third, ADDR, nullptr);
+    check(get_counters(third)->object_cache_hits_.load() == 1, "newer failed entry is kept");
+}
+
+void test_eviction() {
+    TraceResolver resolver;
+    // 同一个文件的两个路径，在缓存中是两项
+    std::string self = "/proc/self/exe";
+    char exe[4096];
+    ssize_t len = readlink(self.c_str(), exe, sizeof(exe) - 1);
+    check(len > 0, "read executable path");
+    if (len <= 0) {
+        return;
+    }
+    std::string exe_path(exe, static_cast<size_t>(len));
+    resolver.resolve_in_object(self, ADDR, nullptr);
+    if (get_counters(self)->symtab_bytes_.load() <= 0) {
+        printf("libbfd cannot load %s, skip the eviction test\n", self.c_str());
+        return;
+    }
+    resolver.resolve_in_object(exe_path, ADDR, nullptr);
+    check(get_counters(self)->object_evictions_.load() == 0, "both files fit in the default limits");
+
+    // 收紧限制后淘汰最久未使用的文件
+    ObjectCacheOptions options;
+    options.max_fds = 1;
+    resolver.set_object_cache_options(options);
+    check(get_counters(self)->object_evictions_.load() == 1, "least recently used file is evicted");
+    check(get_counters(self)->symtab_bytes_.load() == 0, "evicted symbol table is released");
+    resolver.resolve_in_object(self, ADDR, nullptr);
+    check(get_counters(self)->object_cache_misses_.load() == 2, "evicted file is loaded again");
+}
+
+int main() {
+    StatsRegistry::instance().set_enabled(true);
+    char dir_template[] = "/tmp/test_object_cache_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dir_template;
+    test_default_options();
+    test_negative_ttl(dir);
+    test_failed_limit(dir);
+    test_eviction();
+    std::string command = "rm -rf " + dir;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir.c_str());
+    }
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_object_cache passed\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "collect/perf_profiler.h"
+
+#if defined(__x86_64__)
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+void test_kernel_symbols(const std::string& dir) {
+    std::string path = dir + "/kallsyms";
+    std::ofstream(path) << "0000000000000000 T hidden\n"
+        "ffffffff81000000 T _stext\n"
+        "ffffffff81000100 t local_function\n"
+        "ffffffff81000200 D data_symbol\n"
+        "ffffffff81000300 W weak_function\n"
+        "malformed line\n"
+        "ffffffffc0000000 t module_function\t[my_module]\n";
+    KernelSymbols symbols;
+    check(symbols.load(path), "load kallsyms fixture");
+    check(symbols.lookup(0xffffffff81000000ULL) == "_stext", "exact symbol address");
+    check(symbols.lookup(0xffffffff81000150ULL) == "local_function", "address inside a function");
+    check(symbols.lookup(0xffffffff81000250ULL) == "local_function", "data symbols are skipped");
+    check(symbols.lookup(0xffffffff81000300ULL) == "weak_function", "weak symbol");
+    check(symbols.lookup(0xffffffffc0000010ULL) == "module_function [my_module]", "module symbol");
+    check(symbols.lookup(0x1000) == "0x1000", "address below all symbols");
+
+    // kptr_restrict 隐藏地址时全部为 0
+    std::string hidden_path = dir + "/kallsyms_hidden";
+    std::ofstream(hidden_path) << "0000000000000000 T _stext\n0000000000000000 t local_function\n";
+    check(!symbols.load(hidden_path), "reject kallsyms with hidden addresses");
+    check(!symbols.load(dir + "/missing"), "reject missing file");
+}
+
+__attribute__((noinline)) uint64_t burn_cpu(std::chrono::milliseconds duration) {
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    volatile uint64_t value = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        for (int i = 0; i < 10000; ++i) {
+            value = value + i;
+        }
+    }
+    return value;
+}
+
+void test_user_profile() {
+    PerfProfilerOptions options;
+    options.frequency = 999;
+    options.is_kernel = false;
+    PerfProfiler profiler(options);
+    if (!profiler.start()) {
+        if (errno == EACCES || errno == EPERM || errno == ENOENT || errno == ENOSYS) {
+            printf("perf_event_open is not permitted (%s), skip the profile test\n", strerror(errno));
+            return;
+        }
+        check(false, "start profiler");
+        return;
+    }
+    check(!profiler.is_kernel_enabled(), "kernel stacks are not requested");
+    burn_cpu(std::chrono::milliseconds(300));
+    profiler.stop();
+    check(profiler.get_sample_count() > 0, "samples are collected");
+
+    TraceResolver resolver;
+    std::ostringstream oss;
+    profiler.write_folded(oss, resolver);
+    check(oss.str().find("burn_cpu") != std::string::npos, "folded stacks contain the busy function");
+    check(oss.str().find("_[k]") == std::string::npos, "no kernel frames in a user-only profile");
+}
+
+int main() {
+    char dir_template[] = "/tmp/test_perf_profiler_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dir_template;
+    test_kernel_symbols(dir);
+    test_user_profile();
+    std::string command = "rm -rf " + dir;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir.c_str());
+    }
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_perf_profiler passed\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    return 0;
+}
+
+#endif  // defined(__x86_64__)
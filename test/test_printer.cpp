@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "printer/printer.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+__attribute__((noinline)) void target_function() {
+    __asm__ volatile("");
+}
+
+void test_raw_non_pie() {
+    // 本测试以 -no-pie 链接，主程序的加载偏移为 0
+    Printer printer(false, true, false, ResolveLevel::RAW);
+    Trace trace;
+    trace.addr_ = reinterpret_cast<void*>(&target_function);
+    ResolvedTrace resolved_trace = printer.get_resolver().resolve(trace);
+    check(resolved_trace.is_object_found_, "main program is found");
+    check(resolved_trace.object_base_ == nullptr, "non-PIE load bias is zero");
+
+    std::ostringstream oss;
+    printer.print(0, std::vector<ResolvedTrace>(1, resolved_trace), oss);
+    std::ostringstream expected;
+    expected << "test_printer+0x" << std::hex << reinterpret_cast<uintptr_t>(&target_function);
+    check(oss.str().find(expected.str()) != std::string::npos, "main program frame prints module and offset");
+}
+
+void test_raw_unknown_object() {
+    Printer printer(false, true, false, ResolveLevel::RAW);
+    Trace trace;
+    trace.addr_ = reinterpret_cast<void*>(0x10);
+    ResolvedTrace resolved_trace = printer.get_resolver().resolve(trace);
+    check(!resolved_trace.is_object_found_, "address outside any module");
+
+    std::ostringstream oss;
+    printer.print(0, std::vector<ResolvedTrace>(1, resolved_trace), oss);
+    check(oss.str().find("+0x") == std::string::npos, "unknown module prints no offset");
+}
+
+int main() {
+    test_raw_non_pie();
+    test_raw_unknown_object();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_printer passed\n");
+    return 0;
+}
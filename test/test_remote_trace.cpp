@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "collect/remote_trace.h"
+
+#if defined(__x86_64__)
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static volatile uint64_t spin_count = 0;
+
+__attribute__((noinline)) void child_spin() {
+    for (;;) {
+        ++spin_count;
+    }
+}
+
+static int ready_fd = -1;
+
+__attribute__((noinline)) void child_main() {
+    char ready = 1;
+    if (write(ready_fd, &ready, 1) != 1) {
+        _exit(1);
+    }
+    child_spin();
+    __asm__ volatile("");
+}
+
+static bool contains_address_in(const std::vector<void*>& frames, void (*function)(), size_t size) {
+    uintptr_t begin = reinterpret_cast<uintptr_t>(function);
+    for (void* frame : frames) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(frame);
+        if (addr >= begin && addr < begin + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_capture_child() {
+    int fds[2];
+    check(pipe(fds) == 0, "create pipe");
+    pid_t pid = fork();
+    if (pid == 0) {
+        ready_fd = fds[1];
+        child_main();
+        _exit(0);
+    }
+    check(pid > 0, "fork child");
+    if (pid <= 0) {
+        return;
+    }
+    // 等子进程进入 child_main
+    char ready = 0;
+    check(read(fds[0], &ready, 1) == 1, "child is ready");
+    close(fds[0]);
+    close(fds[1]);
+    usleep(10 * 1000);
+    // fork 出的子进程与父进程的地址相同
+    RemoteStackCapture capture;
+    std::vector<RemoteThreadTrace> traces;
+    bool is_captured = capture.capture(pid, &traces);
+    if (!is_captured && capture.get_error() == EPERM) {
+        printf("ptrace is not permitted, skip the capture test\n");
+    } else {
+        check(is_captured, "capture child process");
+        check(capture.get_error() == 0, "no error after a successful capture");
+        check(traces.size() == 1 && traces[0].tid == pid, "child has one thread");
+        check(traces.size() == 1 && contains_address_in(traces[0].frames, &child_spin, 256),
+            "child stack contains the spinning function");
+        check(traces.size() == 1 && contains_address_in(traces[0].frames, &child_main, 256),
+            "child stack contains its caller");
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    // 进程已经退出
+    check(!capture.capture(pid, &traces), "capture exited process");
+    check(capture.get_error() == ENOENT || capture.get_error() == ESRCH, "error of an exited process");
+}
+
+int main() {
+    test_capture_child();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_remote_trace passed\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    return 0;
+}
+
+#endif  // defined(__x86_64__)
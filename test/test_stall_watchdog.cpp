@@ -0,0 +1,176 @@
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "monitor/stall_watchdog.h"
+
+#if defined(__x86_64__)
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static std::mutex reports_mutex;
+static std::vector<StallReport> reports;
+
+static const std::chrono::milliseconds TIMEOUT(20);
+static const std::chrono::milliseconds STALL(200);
+
+/**
+ * 等待指定线程的报告，最多等待一秒
+ */
+static bool wait_report(const std::string& name, StallReport* result) {
+    for (int i = 0; i < 100; ++i) {
+        {
+            std::lock_guard<std::mutex> lock(reports_mutex);
+            for (const auto& report : reports) {
+                if (report.thread_name_ == name) {
+                    *result = report;
+                    return true;
+                }
+            }
+        }
+        usleep(10 * 1000);
+    }
+    return false;
+}
+
+// 测试以 -rdynamic 链接，dladdr 可以找到主程序中的函数；除第一个之外的栈帧是返回地址，减一后再查找
+static bool contains_function(const StallReport& report, void (*function)()) {
+    for (const auto& stack : report.stacks_) {
+        for (size_t i = 0; i < stack.frames_.size(); ++i) {
+            Dl_info info;
+            void* addr = static_cast<char*>(stack.frames_[i]) - (i == 0 ? 0 : 1);
+            if (dladdr(addr, &info) != 0 && info.dli_saddr == reinterpret_cast<void*>(function)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static volatile uint64_t spin_count = 0;
+
+__attribute__((noinline)) void spin_stall() {
+    auto deadline = std::chrono::steady_clock::now() + STALL;
+    while (std::chrono::steady_clock::now() < deadline) {
+        // 大部分时间在本函数中，而不是在读取时钟
+        for (int i = 0; i < 100000; ++i) {
+            spin_count = spin_count + 1;
+        }
+    }
+}
+
+__attribute__((noinline)) void sleep_stall() {
+    // 抓栈的信号会打断 usleep，循环到截止时间
+    auto deadline = std::chrono::steady_clock::now() + STALL;
+    while (std::chrono::steady_clock::now() < deadline) {
+        usleep(10 * 1000);
+    }
+}
+
+static void run_watched(const std::string& name, void (*stall)(), bool is_idle) {
+    std::thread worker([&name, stall, is_idle]() {
+        WatchedThread* thread = StallWatchdog::instance().register_thread(name, TIMEOUT);
+        thread->heartbeat();
+        if (is_idle) {
+            thread->begin_idle();
+        }
+        stall();
+        thread->heartbeat();
+        // 等看门狗发现恢复，等待本身不算作停顿
+        thread->begin_idle();
+        usleep(50 * 1000);
+        StallWatchdog::instance().unregister_thread(thread);
+    });
+    worker.join();
+}
+
+void test_spin_stall() {
+    run_watched("spin", &spin_stall, false);
+    StallReport report;
+    check(wait_report("spin", &report), "spinning thread is reported");
+    check(report.is_recovered_, "spinning thread recovered");
+    check(report.duration_ns_ >= static_cast<uint64_t>(TIMEOUT.count()) * 1000000, "stall duration");
+    check(report.sample_count_ > 0, "spinning thread is sampled");
+    check(contains_function(report, &spin_stall), "stack contains the spinning function");
+}
+
+void test_sleep_stall() {
+    run_watched("sleep", &sleep_stall, false);
+    StallReport report;
+    check(wait_report("sleep", &report), "sleeping thread is reported");
+    check(report.is_recovered_, "sleeping thread recovered");
+    check(report.sample_count_ + report.missed_sample_count_ > 0, "sleeping thread is sampled");
+}
+
+void test_idle() {
+    run_watched("idle", &sleep_stall, true);
+    StallReport report;
+    check(!wait_report("idle", &report), "idle thread is not reported");
+}
+
+void test_unregister_pending() {
+    std::thread worker([]() {
+        // 屏蔽抓栈的信号，请求一直处于未处理的状态
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGRTMIN + 2);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+        WatchedThread* thread = StallWatchdog::instance().register_thread("pending", TIMEOUT);
+        thread->heartbeat();
+        usleep(100 * 1000);
+        StallWatchdog::instance().unregister_thread(thread);
+        // 取消注册之后才送达的信号直接返回
+        pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+    });
+    worker.join();
+    StallReport report;
+    check(wait_report("pending", &report), "pending thread is reported on unregister");
+    check(report.is_recovered_ && report.sample_count_ == 0 && report.missed_sample_count_ > 0,
+        "pending request is counted as missed");
+    check(report.thread_state_ != 0, "thread state is read when samples are missed");
+}
+
+int main() {
+    StallWatchdog::instance().set_reporter([](const StallReport& report) {
+        std::lock_guard<std::mutex> lock(reports_mutex);
+        reports.push_back(report);
+    });
+    StallWatchdogOptions options;
+    options.check_interval = std::chrono::milliseconds(5);
+    options.sample_interval = std::chrono::milliseconds(5);
+    check(StallWatchdog::instance().start(options), "start watchdog");
+    test_spin_stall();
+    test_sleep_stall();
+    test_idle();
+    test_unregister_pending();
+    StallWatchdog::instance().stop();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_stall_watchdog passed\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    return 0;
+}
+
+#endif  // defined(__x86_64__)
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "collect/symbol_cache.h"
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+static const char* BUILD_ID = "0123456789abcdef";
+
+static std::string write_index(const std::string& cache_dir) {
+    SymbolCache cache;
+    cache.set_cache_dir(cache_dir);
+    std::vector<SymbolCache::FunctionRange> ranges;
+    ranges.push_back(SymbolCache::FunctionRange{0x1000, 0x100, "foo"});
+    ranges.push_back(SymbolCache::FunctionRange{0x2000, 0x80, "bar"});
+    cache.add_function_ranges(BUILD_ID, std::move(ranges));
+    cache.add_line(BUILD_ID, 0x1010, "foo()", "foo.cpp", 12, 0);
+    cache.add_line(BUILD_ID, 0x2004, "bar(int)", "bar.cpp", 34, CachedSymbol::FLAG_ADJUSTED_CALL_SITE);
+    cache.flush();
+    return cache_dir + "/" + BUILD_ID + ".idx";
+}
+
+void test_round_trip(const std::string& cache_dir) {
+    write_index(cache_dir);
+    // 另一个实例（相当于另一个进程）从文件中读取
+    SymbolCache cache;
+    cache.set_cache_dir(cache_dir);
+    CachedSymbol symbol;
+    check(cache.find_line(BUILD_ID, 0x1010, &symbol), "find cached line");
+    check(symbol.function_ != nullptr && strcmp(symbol.function_, "foo()") == 0, "cached function name");
+    check(symbol.filename_ != nullptr && strcmp(symbol.filename_, "foo.cpp") == 0, "cached filename");
+    check(symbol.line_ == 12, "cached line number");
+    check(cache.find_line(BUILD_ID, 0x2004, &symbol) && symbol.flags_ == CachedSymbol::FLAG_ADJUSTED_CALL_SITE,
+        "cached flags");
+    check(!cache.find_line(BUILD_ID, 0x1014, &symbol), "unresolved address is not cached");
+
+    const char* function = cache.find_function(BUILD_ID, 0x1080);
+    check(function != nullptr && strcmp(function, "foo") == 0, "find function range");
+    check(cache.find_function(BUILD_ID, 0x1100) == nullptr, "address past the function range");
+    check(!cache.need_function_ranges(BUILD_ID), "function ranges come from the index");
+
+    // 新的记录与已有的索引合并
+    cache.add_line(BUILD_ID, 0x2010, "bar(int)", "bar.cpp", 36, 0);
+    cache.flush();
+    check(cache.find_line(BUILD_ID, 0x1010, &symbol) && symbol.line_ == 12, "merge keeps existing lines");
+    check(cache.find_line(BUILD_ID, 0x2010, &symbol) && symbol.line_ == 36, "merge adds new lines");
+}
+
+void test_automatic_flush(const std::string& cache_dir) {
+    SymbolCache cache;
+    cache.set_cache_dir(cache_dir);
+    std::string filename = cache_dir + "/" + BUILD_ID + ".idx";
+    // 函数范围立即写入
+    std::vector<SymbolCache::FunctionRange> ranges;
+    ranges.push_back(SymbolCache::FunctionRange{0x1000, 0x100, "foo"});
+    cache.add_function_ranges(BUILD_ID, std::move(ranges));
+    std::unique_ptr<SymbolIndex> index = SymbolIndex::open_file(filename);
+    check(index != nullptr && index->header()->range_count_ == 1, "function ranges are written immediately");
+
+    // 行号攒够一批后写入，不需要 flush 或析构
+    for (size_t i = 0; i + 1 < SymbolCache::FLUSH_LINE_COUNT; ++i) {
+        cache.add_line(BUILD_ID, 0x1000 + i, "foo()", "foo.cpp", static_cast<uint32_t>(i), 0);
+    }
+    index = SymbolIndex::open_file(filename);
+    check(index != nullptr && index->header()->line_count_ == 0, "lines below the batch size stay pending");
+    cache.add_line(BUILD_ID, 0x1100, "foo()", "foo.cpp", 99, 0);
+    index = SymbolIndex::open_file(filename);
+    check(index != nullptr && index->header()->line_count_ == SymbolCache::FLUSH_LINE_COUNT,
+        "a full batch of lines is written");
+
+    // 切换目录时丢弃未写入的记录
+    cache.add_line(BUILD_ID, 0x2000, "bar()", "bar.cpp", 1, 0);
+    cache.set_cache_dir(cache_dir + "/other");
+    cache.flush();
+    check(access((cache_dir + "/other/" + BUILD_ID + ".idx").c_str(), F_OK) != 0,
+        "pending entries are not written to a new directory");
+}
+
+static bool patch_file(const std::string& filename, long offset, const void* data, size_t size) {
+    FILE* fp = fopen(filename.c_str(), "r+b");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool is_written = fseek(fp, offset, SEEK_SET) == 0 && fwrite(data, size, 1, fp) == 1;
+    fclose(fp);
+    return is_written;
+}
+
+void test_corrupt_file(const std::string& cache_dir) {
+    std::string filename = write_index(cache_dir);
+    check(SymbolIndex::open_file(filename) != nullptr, "valid index opens");
+
+    // 字符串偏移超出字符串表
+    uint32_t offset = 0x7fffffff;
+    check(patch_file(filename, sizeof(SymbolIndexHeader) + offsetof(SymbolIndexRange, function_),
+        &offset, sizeof(offset)), "patch range string offset");
+    check(SymbolIndex::open_file(filename) == nullptr, "reject range string offset out of bounds");
+
+    filename = write_index(cache_dir + "/lines");
+    std::unique_ptr<SymbolIndex> index = SymbolIndex::open_file(filename);
+    check(index != nullptr, "valid index opens");
+    long lines_offset = static_cast<long>(sizeof(SymbolIndexHeader)
+        + index->header()->range_count_ * sizeof(SymbolIndexRange));
+    index.reset();
+    check(patch_file(filename, lines_offset + static_cast<long>(offsetof(SymbolIndexLine, filename_)),
+        &offset, sizeof(offset)), "patch line string offset");
+    check(SymbolIndex::open_file(filename) == nullptr, "reject line string offset out of bounds");
+
+    // 计数超出文件大小
+    filename = write_index(cache_dir + "/counts");
+    uint32_t count = 0xffffff;
+    check(patch_file(filename, offsetof(SymbolIndexHeader, line_count_), &count, sizeof(count)),
+        "patch line count");
+    check(SymbolIndex::open_file(filename) == nullptr, "reject counts larger than the file");
+
+    // 截断的文件
+    filename = write_index(cache_dir + "/truncated");
+    check(truncate(filename.c_str(), sizeof(SymbolIndexHeader) + 4) == 0, "truncate index");
+    check(SymbolIndex::open_file(filename) == nullptr, "reject truncated index");
+
+    // 魔数不对
+    filename = write_index(cache_dir + "/magic");
+    check(patch_file(filename, 0, "XXXXXXXX", 8), "patch magic");
+    check(SymbolIndex::open_file(filename) == nullptr, "reject bad magic");
+}
+
+int main() {
+    char dir_template[] = "/tmp/test_symbol_cache_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string cache_dir = dir_template;
+    test_round_trip(cache_dir + "/round_trip");
+    test_corrupt_file(cache_dir + "/corrupt");
+    test_automatic_flush(cache_dir + "/automatic");
+    std::string command = "rm -rf " + cache_dir;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "failed to remove %s\n", cache_dir.c_str());
+    }
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_symbol_cache passed\n");
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include "common/thread_pool.h"
+
+using namespace stack_trace::utils;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+void test_zero_thread_count() {
+    // hardware_concurrency() 可能返回 0
+    ThreadPool pool(0);
+    check(pool.get_thread_count() == 1, "zero thread count falls back to one thread");
+    std::atomic<int> count{0};
+    pool.submit([&count](size_t) { ++count; }, 5);
+    pool.wait();
+    check(count.load() == 1, "task runs with a single thread");
+}
+
+void test_stealing() {
+    static const int TASK_COUNT = 16;
+    ThreadPool pool(2);
+    std::atomic<int> done_count{0};
+    std::atomic<bool> is_blocker_released{false};
+    // 所有任务都放进 0 号线程的队列，阻塞的任务等其余任务执行完，只有被另一个线程窃取才能完成
+    pool.submit([&](size_t) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (done_count.load() < TASK_COUNT && std::chrono::steady_clock::now() < deadline) {
+            usleep(1000);
+        }
+        is_blocker_released.store(done_count.load() == TASK_COUNT);
+    }, 0);
+    for (int i = 0; i < TASK_COUNT; ++i) {
+        pool.submit([&](size_t) {
+            ++done_count;
+        }, 0);
+    }
+    pool.wait();
+    check(is_blocker_released.load(), "tasks queued behind a blocked task are stolen");
+}
+
+static void submit_tree(ThreadPool* pool, std::atomic<int>* count, int depth) {
+    ++*count;
+    if (depth == 0) {
+        return;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        pool->submit([pool, count, depth](size_t) { submit_tree(pool, count, depth - 1); }, i);
+    }
+}
+
+void test_wait_for_nested_tasks() {
+    ThreadPool pool(4);
+    std::atomic<int> count{0};
+    pool.submit([&pool, &count](size_t) { submit_tree(&pool, &count, 5); }, 0);
+    pool.wait();
+    // 深度为 5 的二叉树共 63 个节点
+    check(count.load() == 63, "wait covers tasks submitted by running tasks");
+
+    // 等待之后可以继续提交
+    pool.submit([&count](size_t) { ++count; }, 1);
+    pool.wait();
+    check(count.load() == 64, "pool is reusable after wait");
+}
+
+int main() {
+    test_zero_thread_count();
+    test_stealing();
+    test_wait_for_nested_tasks();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_thread_pool passed\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "collect/unwind_cfi.h"
+
+#if defined(__x86_64__)
+
+using namespace stack_trace;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++failures;
+    }
+}
+
+// 第一个栈帧分别是 backtrace 和 unwind 在本函数中的返回地址，从第二个开始比较
+static bool is_same_trace(void** expected, size_t expected_size, void** actual, size_t actual_size) {
+    if (expected_size != actual_size || expected_size < 2) {
+        fprintf(stderr, "size mismatch: backtrace %zu, cfi %zu\n", expected_size, actual_size);
+        return false;
+    }
+    for (size_t i = 1; i < expected_size; ++i) {
+        if (expected[i] != actual[i]) {
+            fprintf(stderr, "frame %zu mismatch: backtrace %p, cfi %p\n", i, expected[i], actual[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+__attribute__((noinline)) void compare_with_backtrace() {
+    void* expected[64];
+    void* actual[64];
+    size_t expected_size = static_cast<size_t>(backtrace(expected, 64));
+    size_t actual_size = CFIUnwinder::instance().unwind(actual, 64);
+    check(is_same_trace(expected, expected_size, actual, actual_size), "cfi unwind matches backtrace");
+}
+
+// 变长数组使函数以 rbp 作为 CFA 的基址，其余的栈帧以 rsp 为基址
+__attribute__((noinline)) void recurse(int depth) {
+    char buffer[depth * 64 + 1];
+    buffer[0] = static_cast<char>(depth);
+    __asm__ volatile("" : : "r"(buffer) : "memory");
+    if (depth > 0) {
+        recurse(depth - 1);
+    } else {
+        compare_with_backtrace();
+    }
+    __asm__ volatile("");
+}
+
+static void* signal_expected[64];
+static size_t signal_expected_size = 0;
+static void* signal_actual[64];
+static size_t signal_actual_size = 0;
+
+static void signal_handler(int, siginfo_t*, void*) {
+    signal_expected_size = static_cast<size_t>(backtrace(signal_expected, 64));
+    signal_actual_size = CFIUnwinder::instance().unwind(signal_actual, 64);
+}
+
+__attribute__((noinline)) void raise_in(int depth) {
+    if (depth > 0) {
+        raise_in(depth - 1);
+        __asm__ volatile("");
+    } else {
+        raise(SIGUSR1);
+    }
+}
+
+void test_unwind() {
+    recurse(5);
+    std::thread thread([] { recurse(3); });
+    thread.join();
+}
+
+void test_signal_frame() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO;
+    action.sa_sigaction = &signal_handler;
+    sigaction(SIGUSR1, &action, nullptr);
+    // 先在正常上下文中回溯一次，预热规则缓存和线程栈的范围
+    compare_with_backtrace();
+    raise_in(4);
+    check(is_same_trace(signal_expected, signal_expected_size, signal_actual, signal_actual_size),
+        "cfi unwind through signal frame matches backtrace");
+}
+
+void test_invalid_registers() {
+    // 不在任何模块中的 pc 退化为帧指针回溯，rbp 不在栈上时回溯应该结束而不是崩溃
+    UnwindRegisters regs;
+    regs.rip = 0x1234;
+    regs.rsp = 0x10000;
+    regs.rbp = 0x20000;
+    void* frames[8];
+    size_t count = CFIUnwinder::instance().unwind_from(regs, true, frames, 8);
+    check(count == 1, "unwind stops at an out-of-stack frame pointer");
+}
+
+int main() {
+    test_unwind();
+    test_signal_frame();
+    test_invalid_registers();
+    if (failures != 0) {
+        return 1;
+    }
+    printf("test_unwind_cfi passed\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    return 0;
+}
+
+#endif  // defined(__x86_64__)
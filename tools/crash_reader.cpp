@@ -0,0 +1,111 @@
+/**
+ * @file crash_reader.cpp
+ * @author noahyzhang
+ * @brief 离线分析崩溃快照，用法：stack_trace_crash_reader [-l raw|symbol|full] [-r] [-s sysroot] <snapshot>
+ * @version 0.1
+ * @date 2023-06-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+#include "collect/crash_snapshot_reader.h"
+#include "printer/printer.h"
+
+using namespace stack_trace;
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [-l raw|symbol|full] [-r] [-s sysroot] <snapshot>" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    ResolveLevel level = ResolveLevel::FULL;
+    // 使用快照中基于帧指针的原始栈帧，不重新做 CFI 回溯
+    bool is_raw_frames = false;
+    std::string sysroot;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:rs:")) != -1) {
+        switch (opt) {
+        case 'l':
+            if (strcmp(optarg, "raw") == 0) {
+                level = ResolveLevel::RAW;
+            } else if (strcmp(optarg, "symbol") == 0) {
+                level = ResolveLevel::SYMBOL;
+            } else if (strcmp(optarg, "full") == 0) {
+                level = ResolveLevel::FULL;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            is_raw_frames = true;
+            break;
+        case 's':
+            sysroot = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    CrashSnapshotReader reader;
+    if (!reader.load(argv[optind])) {
+        std::cerr << "failed to load crash snapshot " << argv[optind] << std::endl;
+        return 1;
+    }
+    reader.set_root_dir(sysroot);
+    const CrashSnapshot& snapshot = reader.get_snapshot();
+    const CrashSnapshotHeader& header = snapshot.header_;
+    std::cout << "Process " << header.pid_ << ", thread " << header.crashed_tid_;
+    if (header.signo_ != 0) {
+        std::cout << ", signal " << header.signo_ << " (" << strsignal(header.signo_) << "), code " << header.si_code_
+            << ", fault address " << reinterpret_cast<void*>(header.fault_addr_);
+    } else {
+        std::cout << ", manual dump";
+    }
+    std::cout << ", captured in " << header.capture_ns_ / 1000 << " us\n\n";
+
+    std::cout << "Modules:\n";
+    for (const auto& module : snapshot.modules_) {
+        std::cout << "  " << reinterpret_cast<void*>(module.begin_) << "-" << reinterpret_cast<void*>(module.end_)
+            << " " << module.path_;
+        std::string build_id = CrashSnapshotReader::get_build_id(module);
+        if (!build_id.empty()) {
+            std::cout << " build-id " << build_id;
+        }
+        if (!reader.is_build_id_matched(module)) {
+            std::cout << " (local file differs)";
+        }
+        std::cout << "\n";
+    }
+    std::cout << std::endl;
+
+    Printer printer(true, true, false, level);
+    for (const auto& thread : snapshot.threads_) {
+        std::cout << "Thread " << thread.record_.tid_;
+        if (thread.record_.flags_ & CrashThreadRecord::FLAG_CRASHED) {
+            std::cout << " (crashed)";
+        }
+        if (!(thread.record_.flags_ & CrashThreadRecord::FLAG_CAPTURED)) {
+            std::cout << " (not captured)\n" << std::endl;
+            continue;
+        }
+        std::cout << "\n";
+        std::vector<void*> frames = is_raw_frames ? thread.frames_ : reader.unwind(thread);
+        printer.print(static_cast<size_t>(thread.record_.tid_), reader.resolve(frames, printer.get_resolver()),
+            std::cout);
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file flame_graph.cpp
+ * @author noahyzhang
+ * @brief 由 folded 格式的栈生成火焰图，用法：stack_trace_flame_graph [-t 标题] [-w 宽度] [-i] [-b 基线文件] [-o 输出] [输入...]
+ * @version 0.1
+ * @date 2023-06-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "printer/flame_graph.h"
+
+using namespace stack_trace;
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [-t title] [-w width] [-c count_name] [-i] [-b baseline.folded]"
+        << " [-o output.svg] [input.folded ...]" << std::endl;
+}
+
+static bool read_file(FlameGraph* graph, const std::string& path, bool is_baseline) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        std::cerr << "failed to open " << path << std::endl;
+        return false;
+    }
+    size_t error_count = graph->read_folded(ifs, is_baseline);
+    if (error_count != 0) {
+        std::cerr << path << ": ignored " << error_count << " malformed lines" << std::endl;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    FlameGraphOptions options;
+    std::string baseline;
+    std::string output;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:c:ib:o:")) != -1) {
+        switch (opt) {
+        case 't':
+            options.title = optarg;
+            break;
+        case 'w':
+            options.width = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+            break;
+        case 'c':
+            options.count_name = optarg;
+            break;
+        case 'i':
+            options.is_icicle = true;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.width == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FlameGraph graph;
+    if (!baseline.empty() && !read_file(&graph, baseline, true)) {
+        return 1;
+    }
+    if (optind >= argc) {
+        graph.read_folded(std::cin);
+    }
+    for (int i = optind; i < argc; ++i) {
+        if (!read_file(&graph, argv[i], false)) {
+            return 1;
+        }
+    }
+    if (output.empty()) {
+        graph.write_svg(std::cout, options);
+        return 0;
+    }
+    std::ofstream ofs(output);
+    graph.write_svg(ofs, options);
+    return ofs ? 0 : 1;
+}
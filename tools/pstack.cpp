@@ -0,0 +1,78 @@
+/**
+ * @file pstack.cpp
+ * @author noahyzhang
+ * @brief 从外部抓取其他进程所有线程的堆栈，用法：stack_trace_pstack [-l raw|symbol|full] [-w 栈窗口KB] [-d 深度] <pid>
+ * @version 0.1
+ * @date 2023-06-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+#include "collect/remote_trace.h"
+#include "printer/printer.h"
+
+using namespace stack_trace;
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [-l raw|symbol|full] [-w stack_window_kb] [-d depth] <pid>" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    ResolveLevel level = ResolveLevel::FULL;
+    size_t stack_window = RemoteStackCapture::DEFAULT_STACK_WINDOW;
+    size_t depth = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:w:d:")) != -1) {
+        switch (opt) {
+        case 'l':
+            if (strcmp(optarg, "raw") == 0) {
+                level = ResolveLevel::RAW;
+            } else if (strcmp(optarg, "symbol") == 0) {
+                level = ResolveLevel::SYMBOL;
+            } else if (strcmp(optarg, "full") == 0) {
+                level = ResolveLevel::FULL;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'w':
+            stack_window = static_cast<size_t>(strtoul(optarg, nullptr, 10)) << 10;
+            break;
+        case 'd':
+            depth = static_cast<size_t>(strtoul(optarg, nullptr, 10));
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    pid_t pid = static_cast<pid_t>(atoi(argv[optind]));
+
+    RemoteStackCapture capture(stack_window, depth);
+    std::vector<RemoteThreadTrace> traces;
+    if (!capture.capture(pid, &traces)) {
+        std::cerr << "failed to capture process " << pid << ": " << strerror(capture.get_error()) << std::endl;
+        return 1;
+    }
+    std::cerr << "process " << pid << ": " << traces.size() << " threads, paused for "
+        << capture.get_pause_ns() / 1000 << " us" << std::endl;
+
+    Printer printer(true, true, false, level);
+    for (const auto& trace : traces) {
+        std::cout << "Thread " << trace.tid << " (" << trace.name << ")\n";
+        printer.print(static_cast<size_t>(trace.tid), capture.resolve(trace, printer.get_resolver()), std::cout);
+        std::cout << std::endl;
+    }
+    return 0;
+}